@@ -17,6 +17,9 @@ else:
     DAEMON_EXE = "build/bin/peer_daemon"
     CMD_EXE = "build/bin/send_cmd"
 
+# Extra daemon options, e.g. --serve=epoll
+DAEMON_ARGS = sys.argv[1:]
+
 def create_test_file(filename, size_mb):
     with open(filename, 'wb') as f:
         f.write(os.urandom(size_mb * 1024 * 1024))
@@ -66,7 +69,7 @@ def main():
     try:
         # 3. Start Seeder Daemon (P2P: 9001, Control: 9991)
         print("Starting Seeder Daemon...")
-        seeder_daemon = run_process_bg([DAEMON_EXE, "9001", "9991"])
+        seeder_daemon = run_process_bg([DAEMON_EXE, "9001", "9991"] + DAEMON_ARGS)
         time.sleep(1)
         
         send_cmd(9991, "tracker", "127.0.0.1", "8080")
@@ -76,22 +79,25 @@ def main():
 
         # 4. Start Leecher Daemon (P2P: 9002, Control: 9992)
         print("Starting Leecher Daemon...")
-        leech_daemon = run_process_bg([DAEMON_EXE, "9002", "9992"])
+        leech_daemon = run_process_bg([DAEMON_EXE, "9002", "9992"] + DAEMON_ARGS)
         time.sleep(1)
         
         send_cmd(9992, "tracker", "127.0.0.1", "8080")
         resp = send_cmd(9992, "download", EXPECTED_HASH, "downloaded.bin")
         print(f"Leecher Response: {resp}")
 
-        # Wait for download
+        # Wait for the download job; the output file has its full size from the start
         print("Waiting for download...")
         start_time = time.time()
         success = False
         while time.time() - start_time < 30:
-            if os.path.exists("downloaded.bin"):
-                if os.path.getsize("downloaded.bin") == os.path.getsize(SRC_FILE):
-                     success = True
-                     break
+            jobs = send_cmd(9992, "jobs")
+            if " done " in jobs:
+                success = True
+                break
+            if " failed " in jobs:
+                print(f"Download failed: {jobs}")
+                sys.exit(1)
             time.sleep(0.5)
             
         if not success:
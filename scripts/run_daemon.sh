@@ -21,7 +21,7 @@ fi
 
 echo "Starting Peer Daemon on P2P Port $P2P_PORT (Control Port $CONTROL_PORT)..."
 if [ -f "build/bin/peer_daemon.exe" ]; then
-    ./build/bin/peer_daemon.exe $P2P_PORT $CONTROL_PORT
+    ./build/bin/peer_daemon.exe $P2P_PORT $CONTROL_PORT "${@:3}"
 else
-    ./build/bin/peer_daemon $P2P_PORT $CONTROL_PORT
+    ./build/bin/peer_daemon $P2P_PORT $CONTROL_PORT "${@:3}"
 fi
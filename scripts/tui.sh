@@ -33,9 +33,14 @@ while true; do
         break
     elif [[ "$line" == "help" ]]; then
          echo "Available Commands:"
-         echo "  seed <path> (e.g., ./test_file.txt)"
-         echo "  download <hash> <out>"
+         echo "  seed <path> (a file, or a directory as one bundle)"
+         echo "  download <hash> <out> [--recheck] [--priority=1-10] [--only=path,...] [--stream=path]"
+         echo "  stream <hash> <out> (verified bytes to stdout as they arrive)"
+         echo "  jobs"
+         echo "  pause <job> / resume <job>"
+         echo "  priority <job> <1-10>"
          echo "  tracker <ip> <port>"
+         echo "  stats"
          echo "  ping"
          echo "  exit"
     elif [[ -n "$line" ]]; then
@@ -0,0 +1,234 @@
+#include "blake3.h"
+#include "blake3_backends.h"
+#include "cpu_features.h"
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+
+// BLAKE3 (https://github.com/BLAKE3-team/BLAKE3-specs). The chunk tree and
+// the one-block compressions that finish chunks and merge subtrees live
+// here; runs of whole chunks go to whichever backend this CPU supports best,
+// see blake3_backends.h.
+
+namespace blake3_backends {
+const uint32_t IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+// Message word order for each of the seven rounds.
+const uint8_t MSG_SCHEDULE[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13},
+};
+} // namespace blake3_backends
+
+using namespace blake3_backends;
+
+// Whole chunks handed to the backend at once.
+constexpr size_t CHUNK_BATCH = 16;
+
+static inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t load32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void g(uint32_t v[16], int a, int b, int c, int d, uint32_t x, uint32_t y) {
+    v[a] = v[a] + v[b] + x;
+    v[d] = rotr(v[d] ^ v[a], 16);
+    v[c] = v[c] + v[d];
+    v[b] = rotr(v[b] ^ v[c], 12);
+    v[a] = v[a] + v[b] + y;
+    v[d] = rotr(v[d] ^ v[a], 8);
+    v[c] = v[c] + v[d];
+    v[b] = rotr(v[b] ^ v[c], 7);
+}
+
+void blake3_backends::compress(uint32_t cv[8], const uint8_t block[64], uint32_t blockLength, uint64_t counter,
+                               uint32_t flags) {
+    uint32_t m[16];
+    for (int i = 0; i < 16; ++i) m[i] = load32(block + 4 * i);
+    uint32_t v[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        IV[0], IV[1], IV[2], IV[3], (uint32_t)counter, (uint32_t)(counter >> 32), blockLength, flags,
+    };
+    for (const uint8_t* s : MSG_SCHEDULE) {
+        // Columns, then diagonals
+        g(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+        g(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+        g(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+        g(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+        g(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+        g(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+        g(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+        g(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+    for (int i = 0; i < 8; ++i) cv[i] = v[i] ^ v[8 + i];
+}
+
+static void storeCv(uint8_t* out, const uint32_t cv[8]) {
+    for (int i = 0; i < 32; ++i) out[i] = (uint8_t)(cv[i / 4] >> (8 * (i % 4)));
+}
+
+void blake3_backends::hashChunksPortable(const uint8_t* input, size_t count, uint64_t counter, uint8_t* out) {
+    for (size_t c = 0; c < count; ++c, input += Blake3::CHUNK_LEN, out += 32) {
+        uint32_t cv[8];
+        memcpy(cv, IV, sizeof(IV));
+        for (size_t b = 0; b < Blake3::CHUNK_LEN / 64; ++b) {
+            uint32_t flags = (b == 0 ? CHUNK_START : 0) | (b == Blake3::CHUNK_LEN / 64 - 1 ? CHUNK_END : 0);
+            compress(cv, input + 64 * b, 64, counter + c, flags);
+        }
+        storeCv(out, cv);
+    }
+}
+
+static bool cpuSupports(Blake3Backend b) {
+    switch (b) {
+    case Blake3Backend::SSE41: return CpuFeatures::get().sse41;
+    case Blake3Backend::AVX2: return CpuFeatures::get().avx2;
+    default: return true;
+    }
+}
+
+static std::atomic<Blake3Backend>& activeBackend() {
+    static std::atomic<Blake3Backend> active(cpuSupports(Blake3Backend::AVX2)    ? Blake3Backend::AVX2
+                                             : cpuSupports(Blake3Backend::SSE41) ? Blake3Backend::SSE41
+                                                                                 : Blake3Backend::PORTABLE);
+    return active;
+}
+
+static void hashChunks(const uint8_t* input, size_t count, uint64_t counter, uint8_t* out) {
+    switch (activeBackend().load()) {
+    case Blake3Backend::AVX2: hashChunksAvx2(input, count, counter, out); break;
+    case Blake3Backend::SSE41: hashChunksSse41(input, count, counter, out); break;
+    default: hashChunksPortable(input, count, counter, out); break;
+    }
+}
+
+Blake3Stream::Blake3Stream() {
+    startChunk(0);
+}
+
+void Blake3Stream::startChunk(uint64_t counter) {
+    memcpy(chunkCv, IV, sizeof(IV));
+    chunkCounter = counter;
+    blockLength = 0;
+    blocksCompressed = 0;
+}
+
+void Blake3Stream::pushChunk(const uint32_t cv[8], uint64_t totalChunks) {
+    uint32_t node[8];
+    memcpy(node, cv, sizeof(node));
+    // Every trailing zero bit of the count is a subtree this chunk completes
+    while ((totalChunks & 1) == 0) {
+        uint8_t pair[64];
+        storeCv(pair, stack[--stackSize]);
+        storeCv(pair + 32, node);
+        memcpy(node, IV, sizeof(IV));
+        compress(node, pair, 64, 0, PARENT);
+        totalChunks >>= 1;
+    }
+    memcpy(stack[stackSize++], node, sizeof(node));
+}
+
+// A finished chunk is only pushed once more input shows it is not the last;
+// the last one, and the merges above it, are left for finish().
+void Blake3Stream::update(const void* input, size_t size) {
+    const uint8_t* data = (const uint8_t*)input;
+    while (size > 0) {
+        if (chunkLength() == Blake3::CHUNK_LEN) {
+            uint32_t flags = (blocksCompressed == 0 ? CHUNK_START : 0) | CHUNK_END;
+            compress(chunkCv, block, (uint32_t)blockLength, chunkCounter, flags);
+            pushChunk(chunkCv, chunkCounter + 1);
+            startChunk(chunkCounter + 1);
+        }
+        // Whole chunks with more input after them go to the backend together
+        if (chunkLength() == 0 && size > Blake3::CHUNK_LEN) {
+            size_t count = std::min((size - 1) / Blake3::CHUNK_LEN, CHUNK_BATCH);
+            uint8_t cvs[CHUNK_BATCH * 32];
+            hashChunks(data, count, chunkCounter, cvs);
+            for (size_t i = 0; i < count; ++i) {
+                uint32_t cv[8];
+                for (int w = 0; w < 8; ++w) cv[w] = load32(cvs + 32 * i + 4 * w);
+                pushChunk(cv, chunkCounter + i + 1);
+            }
+            startChunk(chunkCounter + count);
+            data += count * Blake3::CHUNK_LEN;
+            size -= count * Blake3::CHUNK_LEN;
+            continue;
+        }
+        if (blockLength == 64) {
+            compress(chunkCv, block, 64, chunkCounter, blocksCompressed == 0 ? CHUNK_START : 0);
+            ++blocksCompressed;
+            blockLength = 0;
+        }
+        size_t take = std::min(64 - blockLength, size);
+        memcpy(block + blockLength, data, take);
+        blockLength += take;
+        data += take;
+        size -= take;
+    }
+}
+
+Digest Blake3Stream::finish() {
+    // The node still open: the last chunk, then each parent above it
+    uint32_t cv[8];
+    memcpy(cv, chunkCv, sizeof(cv));
+    uint8_t last[64] = {};
+    memcpy(last, block, blockLength);
+    uint32_t length = (uint32_t)blockLength;
+    uint64_t counter = chunkCounter;
+    uint32_t flags = (blocksCompressed == 0 ? CHUNK_START : 0) | CHUNK_END;
+    while (stackSize > 0) {
+        compress(cv, last, length, counter, flags);
+        storeCv(last, stack[--stackSize]);
+        storeCv(last + 32, cv);
+        memcpy(cv, IV, sizeof(IV));
+        length = 64;
+        counter = 0;
+        flags = PARENT;
+    }
+    compress(cv, last, length, counter, flags | ROOT);
+    Digest d;
+    storeCv(d.data(), cv);
+    return d;
+}
+
+Digest Blake3::digest(const void* data, size_t size) {
+    Blake3Stream stream;
+    stream.update(data, size);
+    return stream.finish();
+}
+
+std::string Blake3::hash(const std::string& data) {
+    return digest(data).hex();
+}
+
+Blake3Backend Blake3::backend() {
+    return activeBackend();
+}
+
+bool Blake3::supported(Blake3Backend backend) {
+    return cpuSupports(backend);
+}
+
+bool Blake3::setBackend(Blake3Backend backend) {
+    if (!cpuSupports(backend)) return false;
+    activeBackend() = backend;
+    return true;
+}
+
+const char* Blake3::backendName(Blake3Backend backend) {
+    switch (backend) {
+    case Blake3Backend::SSE41: return "sse4.1";
+    case Blake3Backend::AVX2: return "avx2";
+    default: return "portable";
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef BLAKE3_H
+#define BLAKE3_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include "digest.h"
+
+// How whole 1 KB chunks are compressed. The best one the CPU has is picked
+// at startup.
+enum class Blake3Backend {
+    PORTABLE, // Plain C++, one chunk at a time
+    SSE41,    // Four chunks in parallel lanes
+    AVX2      // Eight chunks in parallel lanes
+};
+
+// Hashes a message that arrives in pieces, in order. finish() is called
+// once, after the last update().
+class Blake3Stream {
+public:
+    Blake3Stream();
+    void update(const void* data, size_t size);
+    Digest finish();
+
+private:
+    size_t chunkLength() const { return blocksCompressed * 64 + blockLength; }
+    void startChunk(uint64_t counter);
+    // Adds the chaining value of a finished chunk, `totalChunks` counting
+    // it, and merges the completed subtrees below it.
+    void pushChunk(const uint32_t cv[8], uint64_t totalChunks);
+
+    // The chunk being filled
+    uint32_t chunkCv[8];
+    uint64_t chunkCounter = 0;
+    uint8_t block[64];
+    size_t blockLength = 0;
+    size_t blocksCompressed = 0;
+    // Chaining values of complete subtrees, largest first; one per set bit
+    // of the chunk count, so 54 cover any 64-bit length
+    uint32_t stack[54][8];
+    size_t stackSize = 0;
+};
+
+// BLAKE3, unkeyed, with 32-byte output. A message is cut into 1 KB chunks
+// that are hashed independently and merged as a binary tree, so one large
+// message keeps every SIMD lane busy where SHA-256 would run serially.
+class Blake3 {
+public:
+    static constexpr size_t CHUNK_LEN = 1024;
+
+    static Digest digest(const void* data, size_t size);
+    static Digest digest(const std::string& data) { return digest(data.data(), data.size()); }
+    // Hex, for logs and tests.
+    static std::string hash(const std::string& data);
+
+    static Blake3Backend backend();
+    static bool supported(Blake3Backend backend);
+    // Switches every later hash to `backend`, for tests and benchmarks.
+    // False if this CPU lacks it.
+    static bool setBackend(Blake3Backend backend);
+    static const char* backendName(Blake3Backend backend);
+};
+
+#endif // BLAKE3_H
@@ -0,0 +1,31 @@
+#ifndef BLAKE3_BACKENDS_H
+#define BLAKE3_BACKENDS_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Chunk functions behind Blake3, one per backend. Each turns `count` whole
+// 1 KB chunks, starting at `input` and numbered from `counter`, into their
+// 32-byte chaining values at `out`.
+namespace blake3_backends {
+
+constexpr uint32_t CHUNK_START = 1;
+constexpr uint32_t CHUNK_END = 2;
+constexpr uint32_t PARENT = 4;
+constexpr uint32_t ROOT = 8;
+
+extern const uint32_t IV[8];
+extern const uint8_t MSG_SCHEDULE[7][16];
+
+// One 64-byte block into the chaining value `cv`; for a root, the first 32
+// bytes of output, all a digest needs.
+void compress(uint32_t cv[8], const uint8_t block[64], uint32_t blockLength, uint64_t counter, uint32_t flags);
+
+void hashChunksPortable(const uint8_t* input, size_t count, uint64_t counter, uint8_t* out);
+// x86 only; CpuFeatures says whether they may be called.
+void hashChunksSse41(const uint8_t* input, size_t count, uint64_t counter, uint8_t* out);
+void hashChunksAvx2(const uint8_t* input, size_t count, uint64_t counter, uint8_t* out);
+
+} // namespace blake3_backends
+
+#endif // BLAKE3_BACKENDS_H
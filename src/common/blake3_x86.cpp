@@ -0,0 +1,227 @@
+#include "blake3_backends.h"
+#include "blake3.h"
+
+// The SSE4.1 and AVX2 chunk functions: four or eight chunks side by side,
+// each vector holding the same state word of every chunk. Like the SHA-256
+// ones they are compiled for their instruction sets function by function and
+// only called once the CPU checks pass.
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#define TARGET(features)
+#define INLINE __forceinline
+#else
+#define TARGET(features) __attribute__((target(features)))
+#define INLINE inline __attribute__((always_inline))
+#endif
+
+using namespace blake3_backends;
+
+constexpr size_t BLOCKS_PER_CHUNK = Blake3::CHUNK_LEN / 64;
+
+// Counter words of `lanes` consecutive chunks from `counter`.
+static void laneCounters(uint64_t counter, int lanes, uint32_t lo[8], uint32_t hi[8]) {
+    for (int l = 0; l < lanes; ++l) {
+        lo[l] = (uint32_t)(counter + l);
+        hi[l] = (uint32_t)((counter + l) >> 32);
+    }
+}
+
+// ---- SSE4.1: four lanes ----
+
+TARGET("sse4.1,ssse3")
+static INLINE void g4(__m128i& a, __m128i& b, __m128i& c, __m128i& d, __m128i x, __m128i y) {
+    const __m128i rot16 = _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m128i rot8 = _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+    a = _mm_add_epi32(_mm_add_epi32(a, b), x);
+    d = _mm_shuffle_epi8(_mm_xor_si128(d, a), rot16);
+    c = _mm_add_epi32(c, d);
+    b = _mm_xor_si128(b, c);
+    b = _mm_or_si128(_mm_srli_epi32(b, 12), _mm_slli_epi32(b, 20));
+    a = _mm_add_epi32(_mm_add_epi32(a, b), y);
+    d = _mm_shuffle_epi8(_mm_xor_si128(d, a), rot8);
+    c = _mm_add_epi32(c, d);
+    b = _mm_xor_si128(b, c);
+    b = _mm_or_si128(_mm_srli_epi32(b, 7), _mm_slli_epi32(b, 25));
+}
+
+TARGET("sse4.1,ssse3")
+static INLINE void round4(__m128i v[16], const __m128i m[16], const uint8_t s[16]) {
+    g4(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+    g4(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+    g4(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+    g4(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+    g4(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+    g4(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+    g4(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+    g4(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+}
+
+// Rows in, columns out: word w of each lane becomes lane w of vector w.
+TARGET("sse4.1,ssse3")
+static INLINE void transpose4(__m128i v[4]) {
+    __m128i ab01 = _mm_unpacklo_epi32(v[0], v[1]);
+    __m128i ab23 = _mm_unpackhi_epi32(v[0], v[1]);
+    __m128i cd01 = _mm_unpacklo_epi32(v[2], v[3]);
+    __m128i cd23 = _mm_unpackhi_epi32(v[2], v[3]);
+    v[0] = _mm_unpacklo_epi64(ab01, cd01);
+    v[1] = _mm_unpackhi_epi64(ab01, cd01);
+    v[2] = _mm_unpacklo_epi64(ab23, cd23);
+    v[3] = _mm_unpackhi_epi64(ab23, cd23);
+}
+
+TARGET("sse4.1,ssse3")
+static void hash4(const uint8_t* input, uint64_t counter, uint8_t* out) {
+    uint32_t lo[8], hi[8];
+    laneCounters(counter, 4, lo, hi);
+    __m128i counterLo = _mm_loadu_si128((const __m128i*)lo);
+    __m128i counterHi = _mm_loadu_si128((const __m128i*)hi);
+    __m128i h[8];
+    for (int i = 0; i < 8; ++i) h[i] = _mm_set1_epi32((int)IV[i]);
+
+    for (size_t b = 0; b < BLOCKS_PER_CHUNK; ++b) {
+        __m128i m[16];
+        for (int q = 0; q < 4; ++q) {
+            // Words 4q..4q+3 of this block in every lane
+            for (int l = 0; l < 4; ++l) {
+                m[4 * q + l] = _mm_loadu_si128((const __m128i*)(input + l * Blake3::CHUNK_LEN + b * 64 + 16 * q));
+            }
+            transpose4(m + 4 * q);
+        }
+        uint32_t flags = (b == 0 ? CHUNK_START : 0) | (b == BLOCKS_PER_CHUNK - 1 ? CHUNK_END : 0);
+        __m128i v[16] = {
+            h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+            _mm_set1_epi32((int)IV[0]), _mm_set1_epi32((int)IV[1]), _mm_set1_epi32((int)IV[2]),
+            _mm_set1_epi32((int)IV[3]), counterLo, counterHi, _mm_set1_epi32(64), _mm_set1_epi32((int)flags),
+        };
+        for (const uint8_t* s : MSG_SCHEDULE) round4(v, m, s);
+        for (int i = 0; i < 8; ++i) h[i] = _mm_xor_si128(v[i], v[i + 8]);
+    }
+    transpose4(h);
+    transpose4(h + 4);
+    for (int l = 0; l < 4; ++l) {
+        _mm_storeu_si128((__m128i*)(out + 32 * l), h[l]);
+        _mm_storeu_si128((__m128i*)(out + 32 * l + 16), h[4 + l]);
+    }
+}
+
+void blake3_backends::hashChunksSse41(const uint8_t* input, size_t count, uint64_t counter, uint8_t* out) {
+    for (; count >= 4; count -= 4, counter += 4, input += 4 * Blake3::CHUNK_LEN, out += 4 * 32) {
+        hash4(input, counter, out);
+    }
+    hashChunksPortable(input, count, counter, out);
+}
+
+// ---- AVX2: eight lanes ----
+
+TARGET("avx2")
+static INLINE void g8(__m256i& a, __m256i& b, __m256i& c, __m256i& d, __m256i x, __m256i y) {
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                           2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 = _mm256_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12,
+                                          1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+    a = _mm256_add_epi32(_mm256_add_epi32(a, b), x);
+    d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot16);
+    c = _mm256_add_epi32(c, d);
+    b = _mm256_xor_si256(b, c);
+    b = _mm256_or_si256(_mm256_srli_epi32(b, 12), _mm256_slli_epi32(b, 20));
+    a = _mm256_add_epi32(_mm256_add_epi32(a, b), y);
+    d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot8);
+    c = _mm256_add_epi32(c, d);
+    b = _mm256_xor_si256(b, c);
+    b = _mm256_or_si256(_mm256_srli_epi32(b, 7), _mm256_slli_epi32(b, 25));
+}
+
+TARGET("avx2")
+static INLINE void round8(__m256i v[16], const __m256i m[16], const uint8_t s[16]) {
+    g8(v[0], v[4], v[8], v[12], m[s[0]], m[s[1]]);
+    g8(v[1], v[5], v[9], v[13], m[s[2]], m[s[3]]);
+    g8(v[2], v[6], v[10], v[14], m[s[4]], m[s[5]]);
+    g8(v[3], v[7], v[11], v[15], m[s[6]], m[s[7]]);
+    g8(v[0], v[5], v[10], v[15], m[s[8]], m[s[9]]);
+    g8(v[1], v[6], v[11], v[12], m[s[10]], m[s[11]]);
+    g8(v[2], v[7], v[8], v[13], m[s[12]], m[s[13]]);
+    g8(v[3], v[4], v[9], v[14], m[s[14]], m[s[15]]);
+}
+
+TARGET("avx2")
+static INLINE void transpose8(__m256i v[8]) {
+    __m256i ab0145 = _mm256_unpacklo_epi32(v[0], v[1]);
+    __m256i ab2367 = _mm256_unpackhi_epi32(v[0], v[1]);
+    __m256i cd0145 = _mm256_unpacklo_epi32(v[2], v[3]);
+    __m256i cd2367 = _mm256_unpackhi_epi32(v[2], v[3]);
+    __m256i ef0145 = _mm256_unpacklo_epi32(v[4], v[5]);
+    __m256i ef2367 = _mm256_unpackhi_epi32(v[4], v[5]);
+    __m256i gh0145 = _mm256_unpacklo_epi32(v[6], v[7]);
+    __m256i gh2367 = _mm256_unpackhi_epi32(v[6], v[7]);
+    __m256i abcd04 = _mm256_unpacklo_epi64(ab0145, cd0145);
+    __m256i abcd15 = _mm256_unpackhi_epi64(ab0145, cd0145);
+    __m256i abcd26 = _mm256_unpacklo_epi64(ab2367, cd2367);
+    __m256i abcd37 = _mm256_unpackhi_epi64(ab2367, cd2367);
+    __m256i efgh04 = _mm256_unpacklo_epi64(ef0145, gh0145);
+    __m256i efgh15 = _mm256_unpackhi_epi64(ef0145, gh0145);
+    __m256i efgh26 = _mm256_unpacklo_epi64(ef2367, gh2367);
+    __m256i efgh37 = _mm256_unpackhi_epi64(ef2367, gh2367);
+    v[0] = _mm256_permute2x128_si256(abcd04, efgh04, 0x20);
+    v[1] = _mm256_permute2x128_si256(abcd15, efgh15, 0x20);
+    v[2] = _mm256_permute2x128_si256(abcd26, efgh26, 0x20);
+    v[3] = _mm256_permute2x128_si256(abcd37, efgh37, 0x20);
+    v[4] = _mm256_permute2x128_si256(abcd04, efgh04, 0x31);
+    v[5] = _mm256_permute2x128_si256(abcd15, efgh15, 0x31);
+    v[6] = _mm256_permute2x128_si256(abcd26, efgh26, 0x31);
+    v[7] = _mm256_permute2x128_si256(abcd37, efgh37, 0x31);
+}
+
+TARGET("avx2")
+static void hash8(const uint8_t* input, uint64_t counter, uint8_t* out) {
+    uint32_t lo[8], hi[8];
+    laneCounters(counter, 8, lo, hi);
+    __m256i counterLo = _mm256_loadu_si256((const __m256i*)lo);
+    __m256i counterHi = _mm256_loadu_si256((const __m256i*)hi);
+    __m256i h[8];
+    for (int i = 0; i < 8; ++i) h[i] = _mm256_set1_epi32((int)IV[i]);
+
+    for (size_t b = 0; b < BLOCKS_PER_CHUNK; ++b) {
+        __m256i m[16];
+        for (int q = 0; q < 2; ++q) {
+            // Words 8q..8q+7 of this block in every lane
+            for (int l = 0; l < 8; ++l) {
+                m[8 * q + l] =
+                    _mm256_loadu_si256((const __m256i*)(input + l * Blake3::CHUNK_LEN + b * 64 + 32 * q));
+            }
+            transpose8(m + 8 * q);
+        }
+        uint32_t flags = (b == 0 ? CHUNK_START : 0) | (b == BLOCKS_PER_CHUNK - 1 ? CHUNK_END : 0);
+        __m256i v[16] = {
+            h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+            _mm256_set1_epi32((int)IV[0]), _mm256_set1_epi32((int)IV[1]), _mm256_set1_epi32((int)IV[2]),
+            _mm256_set1_epi32((int)IV[3]), counterLo, counterHi, _mm256_set1_epi32(64),
+            _mm256_set1_epi32((int)flags),
+        };
+        for (const uint8_t* s : MSG_SCHEDULE) round8(v, m, s);
+        for (int i = 0; i < 8; ++i) h[i] = _mm256_xor_si256(v[i], v[i + 8]);
+    }
+    transpose8(h);
+    for (int l = 0; l < 8; ++l) _mm256_storeu_si256((__m256i*)(out + 32 * l), h[l]);
+}
+
+void blake3_backends::hashChunksAvx2(const uint8_t* input, size_t count, uint64_t counter, uint8_t* out) {
+    for (; count >= 8; count -= 8, counter += 8, input += 8 * Blake3::CHUNK_LEN, out += 8 * 32) {
+        hash8(input, counter, out);
+    }
+    hashChunksSse41(input, count, counter, out);
+}
+
+#else
+
+// Other architectures hash portably.
+void blake3_backends::hashChunksSse41(const uint8_t* input, size_t count, uint64_t counter, uint8_t* out) {
+    hashChunksPortable(input, count, counter, out);
+}
+void blake3_backends::hashChunksAvx2(const uint8_t* input, size_t count, uint64_t counter, uint8_t* out) {
+    hashChunksPortable(input, count, counter, out);
+}
+
+#endif
@@ -0,0 +1,64 @@
+#include "cpu_features.h"
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+static void cpuid(uint32_t leaf, uint32_t sub, uint32_t regs[4]) {
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, (int)leaf, (int)sub);
+    for (int i = 0; i < 4; ++i) regs[i] = (uint32_t)r[i];
+#else
+    __cpuid_count(leaf, sub, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Which register state the OS saves on a context switch.
+static uint64_t xgetbv0() {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+static CpuFeatures detect() {
+    CpuFeatures f;
+    uint32_t r[4];
+    cpuid(0, 0, r);
+    uint32_t maxLeaf = r[0];
+    if (maxLeaf < 1) return f;
+    cpuid(1, 0, r);
+    bool ssse3 = r[2] & (1u << 9);
+    bool sse41 = r[2] & (1u << 19);
+    bool osxsave = r[2] & (1u << 27);
+    bool avx = r[2] & (1u << 28);
+    bool ymmSaved = osxsave && (xgetbv0() & 6) == 6;
+    f.sse41 = ssse3 && sse41;
+    if (maxLeaf < 7) return f;
+    cpuid(7, 0, r);
+    f.shaNi = f.sse41 && (r[1] & (1u << 29));
+    f.avx2 = f.sse41 && avx && ymmSaved && (r[1] & (1u << 5));
+    return f;
+}
+
+#else
+
+static CpuFeatures detect() {
+    return CpuFeatures();
+}
+
+#endif
+
+const CpuFeatures& CpuFeatures::get() {
+    static const CpuFeatures f = detect();
+    return f;
+}
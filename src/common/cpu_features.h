@@ -0,0 +1,14 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+// The instruction set extensions the hash backends can use, checked once
+// with cpuid. All false off x86.
+struct CpuFeatures {
+    bool sse41 = false; // SSE4.1 and SSSE3
+    bool shaNi = false;
+    bool avx2 = false;  // And the OS saves the YMM registers
+
+    static const CpuFeatures& get();
+};
+
+#endif // CPU_FEATURES_H
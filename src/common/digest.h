@@ -0,0 +1,75 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <array>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+
+// A 32-byte SHA-256 or BLAKE3 digest: file, bundle and chunk hashes. Kept
+// binary in maps, files and packets; hex() is for logs and the user.
+struct Digest {
+    static constexpr size_t SIZE = 32;
+    std::array<uint8_t, SIZE> bytes{};
+
+    const uint8_t* data() const { return bytes.data(); }
+    uint8_t* data() { return bytes.data(); }
+
+    static Digest fromBytes(const void* raw) {
+        Digest d;
+        memcpy(d.bytes.data(), raw, SIZE);
+        return d;
+    }
+
+    // False unless `hex` is exactly 64 hex digits, in either case.
+    static bool fromHex(const std::string& hex, Digest& out) {
+        if (hex.size() != 2 * SIZE) return false;
+        for (size_t i = 0; i < SIZE; ++i) {
+            int hi = nibble(hex[2 * i]);
+            int lo = nibble(hex[2 * i + 1]);
+            if (hi < 0 || lo < 0) return false;
+            out.bytes[i] = (uint8_t)(hi << 4 | lo);
+        }
+        return true;
+    }
+
+    std::string hex() const {
+        static const char digits[] = "0123456789abcdef";
+        std::string out(2 * SIZE, '0');
+        for (size_t i = 0; i < SIZE; ++i) {
+            out[2 * i] = digits[bytes[i] >> 4];
+            out[2 * i + 1] = digits[bytes[i] & 0xf];
+        }
+        return out;
+    }
+
+    bool operator==(const Digest& other) const { return bytes == other.bytes; }
+    bool operator!=(const Digest& other) const { return bytes != other.bytes; }
+    bool operator<(const Digest& other) const { return bytes < other.bytes; }
+
+private:
+    static int nibble(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+};
+
+static_assert(sizeof(Digest) == Digest::SIZE, "digests are read and written as raw bytes");
+
+// Digests are uniformly distributed, so any eight bytes make a good hash.
+namespace std {
+template <>
+struct hash<Digest> {
+    size_t operator()(const Digest& d) const noexcept {
+        size_t h;
+        memcpy(&h, d.data(), sizeof(h));
+        return h;
+    }
+};
+} // namespace std
+
+#endif // DIGEST_H
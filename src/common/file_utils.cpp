@@ -0,0 +1,141 @@
+#include "file_utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+    #include <io.h>
+    #include <sys/stat.h>
+#else
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+FileHandle::~FileHandle() {
+    if (fd_ < 0) return;
+#ifdef _WIN32
+    _close(fd_);
+#else
+    close(fd_);
+#endif
+}
+
+std::shared_ptr<FileHandle> FileUtils::openRead(const std::string& path) {
+#ifdef _WIN32
+    int fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+    if (fd < 0) return nullptr;
+    return std::make_shared<FileHandle>(fd);
+}
+
+bool FileUtils::readAt(int fd, void* data, size_t size, uint64_t offset) {
+    char* ptr = static_cast<char*>(data);
+    size_t total = 0;
+    while (total < size) {
+#ifdef _WIN32
+        // No pread on Windows: ReadFile with an explicit offset does not depend
+        // on the descriptor's position, so threads can share the descriptor.
+        HANDLE handle = (HANDLE)_get_osfhandle(fd);
+        if (handle == INVALID_HANDLE_VALUE) return false;
+        uint64_t at = offset + total;
+        OVERLAPPED ov = {};
+        ov.Offset = (DWORD)at;
+        ov.OffsetHigh = (DWORD)(at >> 32);
+        DWORD want = (DWORD)std::min<size_t>(size - total, 1u << 30);
+        DWORD n = 0;
+        if (!ReadFile(handle, ptr + total, want, &n, &ov)) return false;
+#else
+        ssize_t n = pread(fd, ptr + total, size - total, (off_t)(offset + total));
+        if (n < 0 && errno == EINTR) continue;
+#endif
+        if (n <= 0) return false;
+        total += (size_t)n;
+    }
+    return true;
+}
+
+static bool syncFd(int fd) {
+#ifdef _WIN32
+    return _commit(fd) == 0;
+#elif defined(__linux__)
+    return fdatasync(fd) == 0;
+#else
+    return fsync(fd) == 0;
+#endif
+}
+
+bool FileUtils::writeFileAtomic(const std::string& path, const void* data, size_t size) {
+    std::string tmp = path + ".tmp";
+#ifdef _WIN32
+    int fd = _open(tmp.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+    if (fd < 0) return false;
+    {
+        FileHandle file(fd);
+        const char* ptr = static_cast<const char*>(data);
+        size_t total = 0;
+        while (total < size) {
+#ifdef _WIN32
+            int n = _write(fd, ptr + total, (unsigned int)(size - total));
+#else
+            ssize_t n = write(fd, ptr + total, size - total);
+            if (n < 0 && errno == EINTR) continue;
+#endif
+            if (n <= 0) return false;
+            total += (size_t)n;
+        }
+        if (!syncFd(fd)) return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+    if (mapped) munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+}
+
+bool MappedFile::open(const std::string& path) {
+    std::shared_ptr<FileHandle> file = FileUtils::openRead(path);
+    if (!file) return false;
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_fstat64(file->fd(), &st) != 0) return false;
+#else
+    struct stat st;
+    if (fstat(file->fd(), &st) != 0) return false;
+#endif
+    size_t size = (size_t)st.st_size;
+    if (size == 0) return true;
+#ifndef _WIN32
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file->fd(), 0);
+    if (map != MAP_FAILED) {
+        data_ = static_cast<const uint8_t*>(map);
+        size_ = size;
+        mapped = true;
+        return true;
+    }
+#endif
+    copy.resize(size);
+    if (!FileUtils::readAt(file->fd(), copy.data(), size, 0)) return false;
+    data_ = copy.data();
+    size_ = size;
+    return true;
+}
@@ -0,0 +1,59 @@
+#ifndef FILE_UTILS_H
+#define FILE_UTILS_H
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+// Owns an open file descriptor and closes it on destruction.
+class FileHandle {
+public:
+    explicit FileHandle(int fd) : fd_(fd) {}
+    ~FileHandle();
+
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+
+    int fd() const { return fd_; }
+
+private:
+    int fd_;
+};
+
+// A whole file mapped read-only, so that only the pages actually read are
+// brought in. Where mapping is not available the file is read in full.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // False if `path` cannot be opened or mapped. An empty file maps to
+    // size() 0.
+    bool open(const std::string& path);
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped = false;
+    std::vector<uint8_t> copy; // When not mapped
+};
+
+class FileUtils {
+public:
+    // Opens `path` read-only. Returns nullptr on failure.
+    static std::shared_ptr<FileHandle> openRead(const std::string& path);
+    // Reads exactly `size` bytes at `offset`. Never depends on the descriptor's
+    // file position, so threads may read through one descriptor at once.
+    static bool readAt(int fd, void* data, size_t size, uint64_t offset);
+    // Replaces `path` with `size` bytes so that a crash leaves either the old
+    // or the new contents: writes a temporary file, syncs it, renames it over.
+    static bool writeFileAtomic(const std::string& path, const void* data, size_t size);
+};
+
+#endif // FILE_UTILS_H
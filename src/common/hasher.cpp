@@ -0,0 +1,33 @@
+#include "hasher.h"
+
+void HashStream::update(const void* data, size_t size) {
+    if (algorithm == HashAlgorithm::BLAKE3) blake3.update(data, size);
+    else sha256.update(data, size);
+}
+
+Digest HashStream::finish() {
+    return algorithm == HashAlgorithm::BLAKE3 ? blake3.finish() : sha256.finish();
+}
+
+Digest Hasher::digest(HashAlgorithm algorithm, const void* data, size_t size) {
+    return algorithm == HashAlgorithm::BLAKE3 ? Blake3::digest(data, size) : SHA256::digest(data, size);
+}
+
+std::vector<Digest> Hasher::digestMany(HashAlgorithm algorithm, const std::vector<SHA256Input>& inputs) {
+    if (algorithm != HashAlgorithm::BLAKE3) return SHA256::digestMany(inputs);
+    std::vector<Digest> out;
+    out.reserve(inputs.size());
+    for (const SHA256Input& input : inputs) out.push_back(Blake3::digest(input.data, input.size));
+    return out;
+}
+
+const char* Hasher::name(HashAlgorithm algorithm) {
+    return algorithm == HashAlgorithm::BLAKE3 ? "blake3" : "sha256";
+}
+
+bool Hasher::parse(const std::string& name, HashAlgorithm& out) {
+    if (name == "sha256") out = HashAlgorithm::SHA256;
+    else if (name == "blake3") out = HashAlgorithm::BLAKE3;
+    else return false;
+    return true;
+}
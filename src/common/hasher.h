@@ -0,0 +1,44 @@
+#ifndef HASHER_H
+#define HASHER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "digest.h"
+#include "sha256.h"
+#include "blake3.h"
+
+// The hash a file's chunks and whole-file hash are taken with. A property
+// of each file, chosen by its seeder; downloaders learn it with the chunk
+// hashes. Bundle manifests and Merkle tree nodes are always SHA-256.
+enum class HashAlgorithm : uint8_t {
+    SHA256 = 0, // The default, understood by every peer
+    BLAKE3 = 1
+};
+
+// Hashes a message in pieces with either algorithm.
+class HashStream {
+public:
+    explicit HashStream(HashAlgorithm algorithm) : algorithm(algorithm) {}
+    void update(const void* data, size_t size);
+    Digest finish();
+
+private:
+    HashAlgorithm algorithm;
+    SHA256Stream sha256;
+    Blake3Stream blake3;
+};
+
+class Hasher {
+public:
+    static Digest digest(HashAlgorithm algorithm, const void* data, size_t size);
+    // The digests of independent buffers, in order: SHA-256 hashes them side
+    // by side, BLAKE3 one by one, each spread over its own lanes.
+    static std::vector<Digest> digestMany(HashAlgorithm algorithm, const std::vector<SHA256Input>& inputs);
+
+    static const char* name(HashAlgorithm algorithm);
+    // False unless `name` is "sha256" or "blake3".
+    static bool parse(const std::string& name, HashAlgorithm& out);
+};
+
+#endif // HASHER_H
@@ -17,9 +17,20 @@ enum class PacketType : uint8_t {
     // Peer <-> Peer
     REQUEST_METADATA = 30,
     RESPONSE_METADATA = 31,
+    REQUEST_MANIFEST = 32,  // Bundle file list and chunk hashes
+    RESPONSE_MANIFEST = 33,
+    REQUEST_TREE = 34,      // Merkle root, file size and chunk size
+    RESPONSE_TREE = 35,
+    REQUEST_HASHES = 36,    // One span of chunk hashes with its Merkle proof
+    RESPONSE_HASHES = 37,
     
     REQUEST_CHUNK = 10,
     SEND_CHUNK = 11,
+    BITFIELD = 12,    // Chunks a peer holds; answered with the receiver's own BITFIELD
+    HAVE = 13,        // Seeder -> downloader: a chunk acquired since the last BITFIELD
+    REQUEST_BLOCK = 14, // A byte range of one chunk
+    SEND_BLOCK = 15,
+    CANCEL = 16,      // Downloader -> seeder: drop a queued SEND_BLOCK, no reply
     
     // Responses
     RESPONSE_PEERS = 20, // Tracker -> Peer: List of IPs/Ports
@@ -34,6 +45,11 @@ struct PacketHeader {
 };
 #pragma pack(pop)
 
+// Largest request body a peer server accepts, in either serving mode.
+// Requests carry a hash and an index or a bitfield; anything larger is a
+// broken peer.
+constexpr uint32_t MAX_REQUEST_BODY = 1024 * 1024;
+
 // Example Payload Structures (Serialize manually or using structs)
 
 // Register: 
@@ -54,4 +70,25 @@ struct PacketHeader {
 // Send Chunk:
 // [Header] [FileHash (32 bytes)] [ChunkIndex (uint32_t)] [DataSize (uint32_t)] [Data...]
 
+// Bitfield:
+// [Header] [FileHash (32 bytes)] [ChunkCount (uint32_t)] [Bits (ChunkCount+7)/8, MSB first]
+
+// Have:
+// [Header] [FileHash (32 bytes)] [ChunkIndex (uint32_t)]
+
+// Request Block:
+// [Header] [FileHash (32 bytes)] [ChunkIndex (uint32_t)] [Offset (uint32_t)] [Length (uint32_t)]
+
+// Send Block:
+// [Header] [FileHash (32 bytes)] [ChunkIndex (uint32_t)] [Offset (uint32_t)] [DataSize (uint32_t)] [Data...]
+
+// Cancel:
+// [Header] [FileHash (32 bytes)] [ChunkIndex (uint32_t)] [Offset (uint32_t)]
+
+// Request Manifest:
+// [Header] [BundleHash (32 bytes)]
+
+// Response Manifest (RESPONSE_ERROR if the hash is not a bundle):
+// [Header] [Encoded manifest, whose SHA-256 is the bundle hash (see bundle.h)]
+
 #endif // PROTOCOL_H
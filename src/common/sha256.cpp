@@ -1,23 +1,19 @@
 #include "sha256.h"
-#include <iostream>
+#include "sha256_backends.h"
+#include "cpu_features.h"
 #include <vector>
 #include <fstream>
-#include <sstream>
-#include <iomanip>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
 
-// Simplified SHA256 implementation or wrapper.
-// For a production system, use OpenSSL. for this exercise, we will implementation a basic one
-// OR use a lightweight single-header lib.
-// To keep it dependency-free and simple for this specific request, I'll use a standard implementation logic.
-
-// ... Actually, writing a full SHA256 from scratch is error prone and verbose.
-// For the sake of this environment and simplicity without external deps, 
-// I'll implement a very simple hash or a placeholder if allowed,
-// but the prompt asked for SHA256. I will use a concise implementation.
+// SHA-256 (FIPS 180-4). Message handling and padding live here; the block
+// compression runs on whichever backend this CPU supports best, see
+// sha256_backends.h.
 
 // Constants for SHA-256
-const unsigned int k[64] = {
+namespace sha256_backends {
+const uint32_t K[64] = {
     0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
     0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
     0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
@@ -27,6 +23,14 @@ const unsigned int k[64] = {
     0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
     0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
 };
+}
+
+using sha256_backends::K;
+
+// Initial hash value
+static const uint32_t IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
 
 // Rotation functions
 #define ROTRIGHT(a,b) (((a) >> (b)) | ((a) << (32-(b))))
@@ -37,153 +41,232 @@ const unsigned int k[64] = {
 #define SIG0(x) (ROTRIGHT(x,7) ^ ROTRIGHT(x,18) ^ ((x) >> 3))
 #define SIG1(x) (ROTRIGHT(x,17) ^ ROTRIGHT(x,19) ^ ((x) >> 10))
 
-struct SHA256Context {
-    unsigned char data[64];
-    unsigned int datalen;
-    unsigned long long bitlen;
-    unsigned int state[8];
-};
+void sha256_backends::compressPortable(uint32_t state[8], const uint8_t* data, size_t blocks) {
+    uint32_t a, b, c, d, e, f, g, h, i, j, t1, t2, m[64];
 
-void sha256_transform(SHA256Context *ctx, const unsigned char *data) {
-    unsigned int a, b, c, d, e, f, g, h, i, j, t1, t2, m[64];
-
-    for (i = 0, j = 0; i < 16; ++i, j += 4)
-        m[i] = (data[j] << 24) | (data[j + 1] << 16) | (data[j + 2] << 8) | (data[j + 3]);
-    for (; i < 64; ++i)
-        m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
-
-    a = ctx->state[0];
-    b = ctx->state[1];
-    c = ctx->state[2];
-    d = ctx->state[3];
-    e = ctx->state[4];
-    f = ctx->state[5];
-    g = ctx->state[6];
-    h = ctx->state[7];
-
-    for (i = 0; i < 64; ++i) {
-        t1 = h + EP1(e) + CH(e, f, g) + k[i] + m[i];
-        t2 = EP0(a) + MAJ(a, b, c);
-        h = g;
-        g = f;
-        f = e;
-        e = d + t1;
-        d = c;
-        c = b;
-        b = a;
-        a = t1 + t2;
-    }
+    for (; blocks > 0; --blocks, data += 64) {
+        for (i = 0, j = 0; i < 16; ++i, j += 4)
+            m[i] = ((uint32_t)data[j] << 24) | (data[j + 1] << 16) | (data[j + 2] << 8) | (data[j + 3]);
+        for (; i < 64; ++i)
+            m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
+
+        a = state[0];
+        b = state[1];
+        c = state[2];
+        d = state[3];
+        e = state[4];
+        f = state[5];
+        g = state[6];
+        h = state[7];
 
-    ctx->state[0] += a;
-    ctx->state[1] += b;
-    ctx->state[2] += c;
-    ctx->state[3] += d;
-    ctx->state[4] += e;
-    ctx->state[5] += f;
-    ctx->state[6] += g;
-    ctx->state[7] += h;
-}
-
-void sha256_init(SHA256Context *ctx) {
-    ctx->datalen = 0;
-    ctx->bitlen = 0;
-    ctx->state[0] = 0x6a09e667;
-    ctx->state[1] = 0xbb67ae85;
-    ctx->state[2] = 0x3c6ef372;
-    ctx->state[3] = 0xa54ff53a;
-    ctx->state[4] = 0x510e527f;
-    ctx->state[5] = 0x9b05688c;
-    ctx->state[6] = 0x1f83d9ab;
-    ctx->state[7] = 0x5be0cd19;
-}
-
-void sha256_update(SHA256Context *ctx, const unsigned char *data, size_t len) {
-    for (size_t i = 0; i < len; ++i) {
-        ctx->data[ctx->datalen] = data[i];
-        ctx->datalen++;
-        if (ctx->datalen == 64) {
-            sha256_transform(ctx, ctx->data);
-            ctx->bitlen += 512;
-            ctx->datalen = 0;
+        for (i = 0; i < 64; ++i) {
+            t1 = h + EP1(e) + CH(e, f, g) + K[i] + m[i];
+            t2 = EP0(a) + MAJ(a, b, c);
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
         }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
     }
 }
 
-void sha256_final(SHA256Context *ctx, unsigned char hash[]) {
-    unsigned int i = ctx->datalen;
-
-    if (ctx->datalen < 56) {
-        ctx->data[i++] = 0x80;
-        while (i < 56)
-            ctx->data[i++] = 0x00;
-    } else {
-        ctx->data[i++] = 0x80;
-        while (i < 64)
-            ctx->data[i++] = 0x00;
-        sha256_transform(ctx, ctx->data);
-        memset(ctx->data, 0, 56);
+static bool cpuSupports(SHA256Backend b) {
+    switch (b) {
+    case SHA256Backend::SHA_NI: return CpuFeatures::get().shaNi;
+    case SHA256Backend::AVX2: return CpuFeatures::get().avx2;
+    default: return true;
     }
+}
 
-    ctx->bitlen += ctx->datalen * 8;
-    ctx->data[63] = ctx->bitlen;
-    ctx->data[62] = ctx->bitlen >> 8;
-    ctx->data[61] = ctx->bitlen >> 16;
-    ctx->data[60] = ctx->bitlen >> 24;
-    ctx->data[59] = ctx->bitlen >> 32;
-    ctx->data[58] = ctx->bitlen >> 40;
-    ctx->data[57] = ctx->bitlen >> 48;
-    ctx->data[56] = ctx->bitlen >> 56;
-    sha256_transform(ctx, ctx->data);
-
-    for (i = 0; i < 4; ++i) {
-        hash[i]      = (ctx->state[0] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 4]  = (ctx->state[1] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 8]  = (ctx->state[2] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 12] = (ctx->state[3] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 16] = (ctx->state[4] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 20] = (ctx->state[5] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 24] = (ctx->state[6] >> (24 - i * 8)) & 0x000000ff;
-        hash[i + 28] = (ctx->state[7] >> (24 - i * 8)) & 0x000000ff;
+// SHA-NI does a single message faster than AVX2 lanes do eight
+static std::atomic<SHA256Backend>& activeBackend() {
+    static std::atomic<SHA256Backend> active(cpuSupports(SHA256Backend::SHA_NI) ? SHA256Backend::SHA_NI
+                                             : cpuSupports(SHA256Backend::AVX2) ? SHA256Backend::AVX2
+                                                                                : SHA256Backend::PORTABLE);
+    return active;
+}
+
+// What hashes a single message; AVX2 only helps several at once.
+static SHA256Stream::CompressFn singleCompress() {
+    return activeBackend() == SHA256Backend::SHA_NI ? sha256_backends::compressShaNi
+                                                    : sha256_backends::compressPortable;
+}
+
+SHA256Stream::SHA256Stream() {
+    memcpy(state, IV, sizeof(IV));
+    compress = singleCompress();
+}
+
+// Whole blocks are compressed straight from the input; only a partial block
+// at either end goes through `buffer`.
+void SHA256Stream::update(const void* input, size_t len) {
+    const uint8_t* data = (const uint8_t*)input;
+    bitlen += (uint64_t)len * 8;
+    if (buffered > 0) {
+        size_t take = std::min<size_t>(64 - buffered, len);
+        memcpy(buffer + buffered, data, take);
+        buffered += take;
+        data += take;
+        len -= take;
+        if (buffered < 64) return;
+        compress(state, buffer, 1);
+        buffered = 0;
+    }
+    size_t blocks = len / 64;
+    if (blocks > 0) {
+        compress(state, data, blocks);
+        data += blocks * 64;
+        len -= blocks * 64;
     }
+    memcpy(buffer, data, len);
+    buffered = len;
 }
 
+// Appends the 0x80 byte, zeros and the bit length after the `size % 64`
+// bytes left in `tail`. Returns the blocks written: 1, or 2 if the length
+// no longer fits.
+static size_t sha256_pad(unsigned char tail[128], size_t size, unsigned long long bitlen) {
+    size_t i = size % 64;
+    size_t blocks = i < 56 ? 1 : 2;
+    tail[i++] = 0x80;
+    memset(tail + i, 0, blocks * 64 - i);
+    for (int b = 0; b < 8; ++b) tail[blocks * 64 - 1 - b] = (unsigned char)(bitlen >> (8 * b));
+    return blocks;
+}
+
+// The state words, big-endian.
+static Digest toDigest(const uint32_t state[8]) {
+    Digest d;
+    for (int i = 0; i < 32; ++i) d.bytes[i] = (uint8_t)(state[i / 4] >> (24 - 8 * (i % 4)));
+    return d;
+}
+
+Digest SHA256Stream::finish() {
+    unsigned char tail[128];
+    memcpy(tail, buffer, buffered);
+    size_t blocks = sha256_pad(tail, buffered, bitlen);
+    compress(state, tail, blocks);
+    return toDigest(state);
+}
+
+Digest SHA256::digest(const void* data, size_t size) {
+    SHA256Stream stream;
+    stream.update(data, size);
+    return stream.finish();
+}
 
 std::string SHA256::hash(const std::string& data) {
-    SHA256Context ctx;
-    unsigned char hash[32];
-    sha256_init(&ctx);
-    sha256_update(&ctx, (const unsigned char*)data.c_str(), data.size());
-    sha256_final(&ctx, hash);
-
-    std::stringstream ss;
-    for (int i = 0; i < 32; ++i) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
-    }
-    return ss.str();
+    return digest(data).hex();
 }
 
-std::string SHA256::hashFile(const std::string& filepath) {
+bool SHA256::digestFile(const std::string& filepath, Digest& out) {
     std::ifstream file(filepath, std::ios::binary);
-    if (!file.is_open()) return "";
+    if (!file.is_open()) return false;
 
-    SHA256Context ctx;
-    unsigned char hash[32];
-    sha256_init(&ctx);
-
-    const int bufSize = 32768; // 32KB
+    SHA256Stream stream;
+    const int bufSize = 1024 * 1024; // 1MB
     std::vector<char> buffer(bufSize);
     while (file.read(buffer.data(), bufSize)) {
-        sha256_update(&ctx, (const unsigned char*)buffer.data(), file.gcount());
+        stream.update(buffer.data(), (size_t)file.gcount());
     }
     // handle remaining bytes
     if (file.gcount() > 0) {
-        sha256_update(&ctx, (const unsigned char*)buffer.data(), file.gcount());
+        stream.update(buffer.data(), (size_t)file.gcount());
+    }
+    if (file.bad()) return false;
+    out = stream.finish();
+    return true;
+}
+
+std::vector<Digest> SHA256::digestMany(const std::vector<SHA256Input>& inputs) {
+    std::vector<Digest> out(inputs.size());
+    if (activeBackend() != SHA256Backend::AVX2 || inputs.size() < 2) {
+        for (size_t i = 0; i < inputs.size(); ++i) out[i] = digest(inputs[i].data, inputs[i].size);
+        return out;
+    }
+
+    // Each lane takes the next message as soon as its last one is done, so
+    // messages of different lengths still keep the lanes busy
+    struct Lane {
+        bool busy = false;
+        size_t input = 0;
+        size_t block = 0;
+        size_t full = 0;  // Blocks read straight from the input
+        size_t total = 0; // Plus the padded tail
+        unsigned char tail[128];
+    };
+    static const unsigned char idle[64] = {};
+    Lane lanes[LANES];
+    uint32_t state[8][LANES];
+    size_t next = 0;
+    while (true) {
+        const uint8_t* blocks[LANES];
+        uint32_t active = 0;
+        for (size_t l = 0; l < LANES; ++l) {
+            Lane& lane = lanes[l];
+            if (!lane.busy && next < inputs.size()) {
+                const SHA256Input& in = inputs[next];
+                lane.busy = true;
+                lane.input = next++;
+                lane.block = 0;
+                lane.full = in.size / 64;
+                memcpy(lane.tail, (const unsigned char*)in.data + lane.full * 64, in.size % 64);
+                lane.total = lane.full + sha256_pad(lane.tail, in.size, (unsigned long long)in.size * 8);
+                for (int w = 0; w < 8; ++w) state[w][l] = IV[w];
+            }
+            if (!lane.busy) {
+                blocks[l] = idle;
+                continue;
+            }
+            blocks[l] = lane.block < lane.full ? (const uint8_t*)inputs[lane.input].data + lane.block * 64
+                                               : lane.tail + (lane.block - lane.full) * 64;
+            active |= 1u << l;
+        }
+        if (!active) break;
+        sha256_backends::compressAvx2x8(state, blocks, active);
+        for (size_t l = 0; l < LANES; ++l) {
+            Lane& lane = lanes[l];
+            if (!lane.busy || ++lane.block < lane.total) continue;
+            uint32_t words[8];
+            for (int w = 0; w < 8; ++w) words[w] = state[w][l];
+            out[lane.input] = toDigest(words);
+            lane.busy = false;
+        }
     }
-    sha256_final(&ctx, hash);
+    return out;
+}
+
+SHA256Backend SHA256::backend() {
+    return activeBackend();
+}
+
+bool SHA256::supported(SHA256Backend backend) {
+    return cpuSupports(backend);
+}
+
+bool SHA256::setBackend(SHA256Backend backend) {
+    if (!cpuSupports(backend)) return false;
+    activeBackend() = backend;
+    return true;
+}
 
-    std::stringstream ss;
-    for (int i = 0; i < 32; ++i) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
+const char* SHA256::backendName(SHA256Backend backend) {
+    switch (backend) {
+    case SHA256Backend::SHA_NI: return "sha-ni";
+    case SHA256Backend::AVX2: return "avx2";
+    default: return "portable";
     }
-    return ss.str();
 }
@@ -2,11 +2,63 @@
 #define SHA256_H
 
 #include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "digest.h"
+
+// How blocks are compressed. The best one the CPU has is picked at startup.
+enum class SHA256Backend {
+    PORTABLE, // Plain C++, one block at a time
+    SHA_NI,   // x86 SHA extensions
+    AVX2      // Eight independent messages in parallel lanes; single messages run portably
+};
+
+// One buffer of a digestMany batch.
+struct SHA256Input {
+    const void* data;
+    size_t size;
+};
+
+// Hashes a message that arrives in pieces, in order. finish() is called
+// once, after the last update().
+class SHA256Stream {
+public:
+    using CompressFn = void (*)(uint32_t state[8], const uint8_t* data, size_t blocks);
+
+    SHA256Stream();
+    void update(const void* data, size_t size);
+    Digest finish();
+
+private:
+    uint8_t buffer[64];
+    size_t buffered = 0;
+    uint64_t bitlen = 0;
+    uint32_t state[8];
+    CompressFn compress;
+};
 
 class SHA256 {
 public:
+    // Messages the AVX2 backend hashes side by side.
+    static constexpr size_t LANES = 8;
+
+    // Hashes the caller's buffer where it is, without copying it.
+    static Digest digest(const void* data, size_t size);
+    static Digest digest(const std::string& data) { return digest(data.data(), data.size()); }
+    // Hex, for logs and tests.
     static std::string hash(const std::string& data);
-    static std::string hashFile(const std::string& filepath);
+    static bool digestFile(const std::string& filepath, Digest& out);
+    // The digests of independent buffers, in order. Batches of LANES or more
+    // keep every AVX2 lane busy; other backends hash them one after another.
+    static std::vector<Digest> digestMany(const std::vector<SHA256Input>& inputs);
+
+    static SHA256Backend backend();
+    static bool supported(SHA256Backend backend);
+    // Switches every later hash to `backend`, for tests and benchmarks.
+    // False if this CPU lacks it.
+    static bool setBackend(SHA256Backend backend);
+    static const char* backendName(SHA256Backend backend);
 };
 
 #endif // SHA256_H
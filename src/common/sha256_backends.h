@@ -0,0 +1,23 @@
+#ifndef SHA256_BACKENDS_H
+#define SHA256_BACKENDS_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Block functions behind SHA256, one per backend. Each compresses whole
+// 64-byte blocks into the running state; padding is left to the caller.
+namespace sha256_backends {
+
+extern const uint32_t K[64];
+
+void compressPortable(uint32_t state[8], const uint8_t* data, size_t blocks);
+
+// x86 only; CpuFeatures says whether the others may be called.
+void compressShaNi(uint32_t state[8], const uint8_t* data, size_t blocks);
+// One block for each of eight messages. `state` holds word w of lane l at
+// state[w][l]; lanes whose bit in `activeLanes` is clear keep their state.
+void compressAvx2x8(uint32_t state[8][8], const uint8_t* const data[8], uint32_t activeLanes);
+
+} // namespace sha256_backends
+
+#endif // SHA256_BACKENDS_H
@@ -0,0 +1,149 @@
+#include "sha256_backends.h"
+
+// The SHA-NI and AVX2 block functions. They are compiled for their
+// instruction sets function by function, so the rest of the build keeps its
+// baseline flags, and only called once the CPU checks pass.
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#define TARGET(features)
+#else
+#define TARGET(features) __attribute__((target(features)))
+#endif
+
+// Four rounds per step: sha256rnds2 does two, on state kept as ABEF and
+// CDGH. Message words 16-63 come from sha256msg1/msg2 over the last sixteen.
+TARGET("sha,sse4.1,ssse3")
+void sha256_backends::compressShaNi(uint32_t state[8], const uint8_t* data, size_t blocks) {
+    const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_loadu_si128((const __m128i*)&state[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i*)&state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);               // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);         // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);      // CDGH
+
+    for (; blocks > 0; --blocks, data += 64) {
+        __m128i saved0 = state0;
+        __m128i saved1 = state1;
+        __m128i msg[4];
+        for (int g = 0; g < 16; ++g) {
+            __m128i& cur = msg[g & 3];
+            if (g < 4) cur = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * g)), byteSwap);
+            __m128i words = _mm_add_epi32(cur, _mm_loadu_si128((const __m128i*)&K[4 * g]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, words);
+            if (g >= 3 && g <= 14) {
+                __m128i& ahead = msg[(g + 1) & 3];
+                ahead = _mm_add_epi32(ahead, _mm_alignr_epi8(cur, msg[(g + 3) & 3], 4));
+                ahead = _mm_sha256msg2_epu32(ahead, cur);
+            }
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(words, 0x0E));
+            if (g >= 1 && g <= 12) msg[(g + 3) & 3] = _mm_sha256msg1_epu32(msg[(g + 3) & 3], cur);
+        }
+        state0 = _mm_add_epi32(state0, saved0);
+        state1 = _mm_add_epi32(state1, saved1);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);        // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);     // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);  // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);     // ABEF
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+#define ROTR8(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define XOR3(x, y, z) _mm256_xor_si256(_mm256_xor_si256(x, y), z)
+
+// Lane l of every vector belongs to message l: the message words are
+// transposed in, then the rounds run as in the portable code, eight wide.
+TARGET("avx2")
+void sha256_backends::compressAvx2x8(uint32_t state[8][8], const uint8_t* const data[8], uint32_t activeLanes) {
+    const __m256i byteSwap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                             12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    __m256i m[16];
+    for (int half = 0; half < 2; ++half) {
+        __m256i r[8];
+        for (int l = 0; l < 8; ++l) r[l] = _mm256_loadu_si256((const __m256i*)(data[l] + 32 * half));
+        __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]), t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+        __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]), t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+        __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]), t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+        __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]), t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+        __m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+        __m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+        __m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6);
+        __m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+        __m256i* w = m + 8 * half;
+        w[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+        w[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+        w[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+        w[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+        w[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+        w[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+        w[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+        w[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+        for (int i = 0; i < 8; ++i) w[i] = _mm256_shuffle_epi8(w[i], byteSwap);
+    }
+
+    __m256i saved[8];
+    for (int i = 0; i < 8; ++i) saved[i] = _mm256_loadu_si256((const __m256i*)state[i]);
+    __m256i a = saved[0], b = saved[1], c = saved[2], d = saved[3];
+    __m256i e = saved[4], f = saved[5], g = saved[6], h = saved[7];
+
+    for (int t = 0; t < 64; ++t) {
+        __m256i& wt = m[t & 15];
+        if (t >= 16) {
+            __m256i w2 = m[(t - 2) & 15];
+            __m256i w15 = m[(t - 15) & 15];
+            __m256i s1 = XOR3(ROTR8(w2, 17), ROTR8(w2, 19), _mm256_srli_epi32(w2, 10));
+            __m256i s0 = XOR3(ROTR8(w15, 7), ROTR8(w15, 18), _mm256_srli_epi32(w15, 3));
+            wt = _mm256_add_epi32(_mm256_add_epi32(wt, s0), _mm256_add_epi32(m[(t - 7) & 15], s1));
+        }
+        __m256i ep1 = XOR3(ROTR8(e, 6), ROTR8(e, 11), ROTR8(e, 25));
+        __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+        __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, ep1),
+                                      _mm256_add_epi32(_mm256_add_epi32(ch, wt), _mm256_set1_epi32((int)K[t])));
+        __m256i ep0 = XOR3(ROTR8(a, 2), ROTR8(a, 13), ROTR8(a, 22));
+        __m256i maj = XOR3(_mm256_and_si256(a, b), _mm256_and_si256(a, c), _mm256_and_si256(b, c));
+        __m256i t2 = _mm256_add_epi32(ep0, maj);
+        h = g;
+        g = f;
+        f = e;
+        e = _mm256_add_epi32(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = _mm256_add_epi32(t1, t2);
+    }
+
+    __m256i keep = _mm256_set_epi32(
+        (activeLanes >> 7 & 1) ? -1 : 0, (activeLanes >> 6 & 1) ? -1 : 0, (activeLanes >> 5 & 1) ? -1 : 0,
+        (activeLanes >> 4 & 1) ? -1 : 0, (activeLanes >> 3 & 1) ? -1 : 0, (activeLanes >> 2 & 1) ? -1 : 0,
+        (activeLanes >> 1 & 1) ? -1 : 0, (activeLanes & 1) ? -1 : 0);
+    __m256i result[8] = {a, b, c, d, e, f, g, h};
+    for (int i = 0; i < 8; ++i) {
+        __m256i sum = _mm256_add_epi32(saved[i], result[i]);
+        _mm256_storeu_si256((__m256i*)state[i], _mm256_blendv_epi8(saved[i], sum, keep));
+    }
+}
+
+#else
+
+// Other architectures hash portably.
+void sha256_backends::compressShaNi(uint32_t state[8], const uint8_t* data, size_t blocks) {
+    compressPortable(state, data, blocks);
+}
+void sha256_backends::compressAvx2x8(uint32_t state[8][8], const uint8_t* const data[8], uint32_t activeLanes) {
+    for (int l = 0; l < 8; ++l) {
+        if (!(activeLanes >> l & 1)) continue;
+        uint32_t lane[8];
+        for (int w = 0; w < 8; ++w) lane[w] = state[w][l];
+        compressPortable(lane, data[l], 1);
+        for (int w = 0; w < 8; ++w) state[w][l] = lane[w];
+    }
+}
+
+#endif
@@ -1,6 +1,12 @@
 #include "socket_utils.h"
 #include "logger.h"
 #include <iostream>
+#include <cerrno>
+
+#ifdef __linux__
+    #include <sys/sendfile.h>
+    #include <sys/uio.h>
+#endif
 
 bool SocketUtils::init() {
 #ifdef _WIN32
@@ -90,6 +96,25 @@ void SocketUtils::closeSocket(SocketType sock) {
 #endif
 }
 
+void SocketUtils::shutdownSocket(SocketType sock) {
+#ifdef _WIN32
+    shutdown(sock, SD_BOTH);
+#else
+    shutdown(sock, SHUT_RDWR);
+#endif
+}
+
+bool SocketUtils::setRecvTimeout(SocketType sock, int ms) {
+#ifdef _WIN32
+    DWORD tv = (DWORD)ms;
+#else
+    timeval tv;
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+#endif
+    return setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv)) == 0;
+}
+
 bool SocketUtils::sendAll(SocketType sock, const void* data, size_t size) {
     const char* ptr = static_cast<const char*>(data);
     size_t totalSent = 0;
@@ -115,3 +140,55 @@ bool SocketUtils::recvAll(SocketType sock, void* data, size_t size) {
     }
     return true;
 }
+
+bool SocketUtils::sendAllv(SocketType sock, const IoSlice* slices, size_t count) {
+#ifdef __linux__
+    size_t first = 0;
+    size_t offset = 0; // Bytes of slices[first] already sent
+    while (first < count) {
+        iovec iov[16];
+        int cnt = 0;
+        for (size_t i = first; i < count && cnt < 16; ++i, ++cnt) {
+            size_t skip = (i == first) ? offset : 0;
+            iov[cnt].iov_base = (char*)slices[i].data + skip;
+            iov[cnt].iov_len = slices[i].size - skip;
+        }
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = cnt;
+        ssize_t sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        size_t left = (size_t)sent;
+        while (first < count && left >= slices[first].size - offset) {
+            left -= slices[first].size - offset;
+            offset = 0;
+            ++first;
+        }
+        offset += left;
+    }
+    return true;
+#else
+    for (size_t i = 0; i < count; ++i) {
+        if (!sendAll(sock, slices[i].data, slices[i].size)) return false;
+    }
+    return true;
+#endif
+}
+
+long long SocketUtils::sendFile(SocketType sock, int fd, uint64_t offset, size_t length) {
+#ifdef __linux__
+    off_t off = (off_t)offset;
+    ssize_t sent;
+    do {
+        sent = sendfile(sock, fd, &off, length);
+    } while (sent < 0 && errno == EINTR);
+    return sent;
+#else
+    (void)sock; (void)fd; (void)offset; (void)length;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
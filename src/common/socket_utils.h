@@ -18,6 +18,12 @@
     #define SOCKET_ERROR -1
 #endif
 
+// One buffer of a vectored send.
+struct IoSlice {
+    const void* data;
+    size_t size;
+};
+
 class SocketUtils {
 public:
     static bool init();
@@ -28,9 +34,20 @@ public:
     static SocketType acceptConnection(SocketType sock, std::string& clientIp);
     static bool connectToServer(SocketType sock, const std::string& ip, int port);
     static void closeSocket(SocketType sock);
+    // Wakes any thread blocked on the socket; later sends and receives fail.
+    static void shutdownSocket(SocketType sock);
+    // Makes recv fail instead of blocking longer than `ms` (0 waits forever).
+    static bool setRecvTimeout(SocketType sock, int ms);
 
     static bool sendAll(SocketType sock, const void* data, size_t size);
     static bool recvAll(SocketType sock, void* data, size_t size);
+
+    // Sends every slice in order with as few system calls as possible.
+    static bool sendAllv(SocketType sock, const IoSlice* slices, size_t count);
+    // Sends up to `length` bytes of file `fd` from `offset` without copying them
+    // through user space. Returns the bytes sent, or -1 with errno set. Always
+    // fails with ENOSYS where the kernel has no sendfile.
+    static long long sendFile(SocketType sock, int fd, uint64_t offset, size_t length);
 };
 
 #endif // SOCKET_UTILS_H
@@ -2,9 +2,13 @@
 #include "socket_utils.h"
 #include "logger.h"
 #include "colors.h"
+#include "download_manager.h"
 #include <thread>
 #include <sstream>
+#include <iomanip>
+#include <fstream>
 #include <vector>
+#include <chrono>
 
 IPCServer::IPCServer(int port, PeerNode* node) : port(port), node(node) {}
 
@@ -13,6 +17,12 @@ void IPCServer::start() {
     Logger::log("IPC Server listening on local port " + std::to_string(port));
 }
 
+static void sendResponse(SocketType client, const std::string& response) {
+    uint32_t respLen = (uint32_t)response.size();
+    SocketUtils::sendAll(client, &respLen, sizeof(respLen));
+    SocketUtils::sendAll(client, response.c_str(), respLen);
+}
+
 void IPCServer::serverLoop() {
     SocketType listener = SocketUtils::createSocket();
     if (!SocketUtils::bindSocket(listener, port)) {
@@ -33,18 +43,137 @@ void IPCServer::serverLoop() {
             if (SocketUtils::recvAll(client, buf.data(), len)) {
                 buf[len] = '\0';
                 std::string cmd(buf.data());
+                if (cmd.rfind("stream ", 0) == 0) {
+                    // Keeps the connection for as long as the download runs
+                    std::thread(&IPCServer::streamDownload, this, client, cmd).detach();
+                    continue;
+                }
+                if (cmd.rfind("seed ", 0) == 0) {
+                    // Replies once hashing is done; `seeds` is served meanwhile
+                    std::thread([this, client, cmd] {
+                        sendResponse(client, handleCommand(cmd));
+                        SocketUtils::closeSocket(client);
+                    }).detach();
+                    continue;
+                }
                 
-                std::string response = handleCommand(cmd);
-                
-                uint32_t respLen = (uint32_t)response.size();
-                SocketUtils::sendAll(client, &respLen, sizeof(respLen));
-                SocketUtils::sendAll(client, response.c_str(), respLen);
+                sendResponse(client, handleCommand(cmd));
             }
         }
         SocketUtils::closeSocket(client);
     }
 }
 
+// Passes a stream on to a file or named pipe. It is opened on the first
+// bytes, so a pipe's reader may attach after the job was queued, and closed
+// when a run of the job ends; a resumed job appends where it stopped.
+static StreamSink fileSink(const std::string& path) {
+    auto out = std::make_shared<std::ofstream>();
+    auto written = std::make_shared<uint64_t>(0);
+    return [path, out, written](uint64_t offset, const char* data, size_t size) {
+        if (!data) {
+            out->close();
+            return true;
+        }
+        if (offset + size <= *written) return true; // Passed on by an earlier run
+        if (!out->is_open()) {
+            out->open(path, std::ios::binary | (*written ? std::ios::app : std::ios::trunc));
+            if (!*out) return false;
+        }
+        size_t skip = (size_t)(*written - offset);
+        out->write(data + skip, size - skip);
+        out->flush();
+        *written = offset + size;
+        return (bool)*out;
+    };
+}
+
+bool IPCServer::parseDownload(std::stringstream& ss, DownloadSpec& spec, int& priority) {
+    std::string flag;
+    std::string hash;
+    ss >> hash >> spec.outputName;
+    if (!Digest::fromHex(hash, spec.fileHash) || spec.outputName.empty()) return false;
+    while (ss >> flag) {
+        if (flag == "--recheck") {
+            spec.recheck = true;
+        } else if (flag.rfind("--priority=", 0) == 0) {
+            priority = std::atoi(flag.c_str() + 11);
+        } else if (flag.rfind("--only=", 0) == 0) {
+            // Bundle files or directories, comma-separated
+            std::stringstream paths(flag.substr(7));
+            std::string path;
+            while (std::getline(paths, path, ',')) {
+                if (!path.empty()) spec.only.push_back(path);
+            }
+        } else if (flag.rfind("--stream=", 0) == 0 && flag.size() > 9) {
+            spec.stream = fileSink(flag.substr(9));
+        } else if (flag.rfind("--basis=", 0) == 0 && flag.size() > 8) {
+            spec.basis = flag.substr(8);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+void IPCServer::streamDownload(SocketType client, const std::string& cmd) {
+    struct Connection {
+        std::mutex mutex;
+        bool open = true;
+        uint64_t written = 0;
+    };
+    auto conn = std::make_shared<Connection>();
+
+    std::stringstream ss(cmd);
+    std::string action;
+    ss >> action;
+    DownloadSpec spec;
+    int priority = DEFAULT_PRIORITY;
+    bool complete = false;
+    std::string result;
+    if (!parseDownload(ss, spec, priority) || spec.stream || !spec.only.empty()) {
+        result = Color::RED + "Usage: stream <hash> <out> [--recheck] [--priority=N] [--basis=path]" + Color::RESET;
+    } else {
+        spec.stream = [conn, client](uint64_t offset, const char* data, size_t size) {
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            if (!conn->open) return false;
+            if (!data || offset + size <= conn->written) return true;
+            size_t skip = (size_t)(conn->written - offset);
+            uint32_t len = (uint32_t)(size - skip);
+            if (!SocketUtils::sendAll(client, &len, sizeof(len)) || !SocketUtils::sendAll(client, data + skip, len)) {
+                conn->open = false; // The client went away
+                return false;
+            }
+            conn->written = offset + size;
+            return true;
+        };
+        uint32_t id = node->downloads().add(spec, priority);
+        if (id == 0) {
+            result = Color::RED + "A download to " + spec.outputName + " is already in progress" + Color::RESET;
+        } else {
+            DownloadJobInfo info;
+            while (node->downloads().find(id, info) &&
+                   (info.state == JobState::QUEUED || info.state == JobState::RUNNING)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            complete = info.state == JobState::DONE;
+            result = complete ? Color::GREEN + "Streamed " + spec.fileHash.hex() + " (job " + std::to_string(id) + ")" + Color::RESET
+                              : Color::RED + "Job " + std::to_string(id) + " " + jobStateName(info.state) + Color::RESET;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(conn->mutex);
+    conn->open = false;
+    uint32_t end = 0;
+    uint8_t ok = complete ? 1 : 0;
+    uint32_t respLen = (uint32_t)result.size();
+    SocketUtils::sendAll(client, &end, sizeof(end));
+    SocketUtils::sendAll(client, &ok, sizeof(ok));
+    SocketUtils::sendAll(client, &respLen, sizeof(respLen));
+    SocketUtils::sendAll(client, result.c_str(), respLen);
+    SocketUtils::closeSocket(client);
+}
+
 std::string IPCServer::handleCommand(const std::string& cmd) {
     std::stringstream ss(cmd);
     std::string action;
@@ -55,18 +184,44 @@ std::string IPCServer::handleCommand(const std::string& cmd) {
         ss >> path;
         if (path.empty()) return Color::RED + "Usage: seed <path>" + Color::RESET;
         
-        // This runs in IPC thread, might need thread-safety in node?
-        // Node implementation uses mutexes, so it should be fine.
+        // On its own thread (see serverLoop); the node guards its state
         node->seedFile(path);
         return Color::GREEN + "Started seeding: " + path + Color::RESET;
     }
     else if (action == "download") {
-        std::string hash, out;
-        ss >> hash >> out;
-        if (hash.empty() || out.empty()) return Color::RED + "Usage: download <hash> <out>" + Color::RESET;
-        
-        node->downloadFile(hash, out);
-        return Color::GREEN + "Started download for " + hash + Color::RESET;
+        std::string usage = "Usage: download <hash> <out> [--recheck] [--priority=N] [--only=path,...] [--stream=path] [--basis=path]";
+        DownloadSpec spec;
+        int priority = DEFAULT_PRIORITY;
+        if (!parseDownload(ss, spec, priority)) return Color::RED + usage + Color::RESET;
+
+        // Runs in the background; `jobs` shows how it is doing
+        uint32_t id = node->downloads().add(spec, priority);
+        if (id == 0) return Color::RED + "A download to " + spec.outputName + " is already in progress" + Color::RESET;
+        return Color::GREEN + "Queued download job " + std::to_string(id) + " for " + spec.fileHash.hex() + Color::RESET;
+    }
+    else if (action == "jobs") {
+        return listJobs();
+    }
+    else if (action == "seeds") {
+        return listSeeds();
+    }
+    else if (action == "pause" || action == "resume") {
+        uint32_t id = 0;
+        ss >> id;
+        bool ok = action == "pause" ? node->downloads().pause(id) : node->downloads().resume(id);
+        if (!ok) return Color::RED + "Cannot " + action + " job " + std::to_string(id) + Color::RESET;
+        return Color::GREEN + (action == "pause" ? "Pausing job " : "Resumed job ") + std::to_string(id) + Color::RESET;
+    }
+    else if (action == "priority") {
+        uint32_t id = 0;
+        int priority = 0;
+        ss >> id >> priority;
+        if (priority < MIN_PRIORITY || priority > MAX_PRIORITY) {
+            return Color::RED + "Usage: priority <job> <" + std::to_string(MIN_PRIORITY) + "-" +
+                   std::to_string(MAX_PRIORITY) + ">" + Color::RESET;
+        }
+        if (!node->downloads().setPriority(id, priority)) return Color::RED + "No job " + std::to_string(id) + Color::RESET;
+        return "Job " + std::to_string(id) + " priority set to " + std::to_string(priority) + ".";
     }
     else if (action == "tracker") {
         std::string ip; 
@@ -75,9 +230,51 @@ std::string IPCServer::handleCommand(const std::string& cmd) {
         node->setTracker(ip, p);
         return "Tracker updated.";
     }
+    else if (action == "stats") {
+        return node->getStats();
+    }
     else if (action == "ping") {
         return "pong";
     }
     
     return Color::RED + "Unknown command" + Color::RESET;
 }
+
+std::string IPCServer::listJobs() {
+    std::vector<DownloadJobInfo> jobs = node->downloads().list();
+    if (jobs.empty()) return "No download jobs.";
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(2);
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const DownloadJobInfo& j = jobs[i];
+        if (i) ss << "\n";
+        int percent = j.chunksTotal ? (int)(100.0 * j.chunksDone / j.chunksTotal) : 0;
+        double rate = j.seconds > 0 ? j.bytes / j.seconds / (1024 * 1024) : 0;
+        ss << "Job " << j.id << " " << (j.stopping ? "pausing" : jobStateName(j.state))
+           << " prio " << j.priority << " " << percent << "% (" << j.chunksDone << "/" << j.chunksTotal << " chunks) "
+           << rate << " MB/s ";
+        if (j.saved) ss << (double)j.saved / (1024 * 1024) << " MB saved ";
+        ss << j.fileHash.hex().substr(0, 16) << "... -> " << j.outputName;
+    }
+    return ss.str();
+}
+
+std::string IPCServer::listSeeds() {
+    std::vector<std::shared_ptr<const SeedProgress>> seeds = node->seedsInProgress();
+    if (seeds.empty()) return "No files being hashed.";
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(2);
+    for (size_t i = 0; i < seeds.size(); ++i) {
+        const SeedProgress& s = *seeds[i];
+        if (i) ss << "\n";
+        uint64_t done = s.bytesDone;
+        double seconds = s.seconds();
+        int percent = s.totalBytes ? (int)(100.0 * done / s.totalBytes) : 0;
+        double rate = seconds > 0 ? done / seconds / (1024 * 1024) : 0;
+        ss << "Hashing " << percent << "% (" << (double)done / (1024 * 1024) << "/"
+           << (double)s.totalBytes / (1024 * 1024) << " MB) " << rate << " MB/s " << s.path;
+    }
+    return ss.str();
+}
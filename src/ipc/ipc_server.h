@@ -3,7 +3,9 @@
 
 #include <string>
 #include <functional>
+#include <sstream>
 #include "peer_node.h"
+#include "download_manager.h"
 
 // Callback: Command string -> Response string
 using CommandHandler = std::function<std::string(const std::string&)>;
@@ -18,6 +20,14 @@ private:
     PeerNode* node;
     void serverLoop();
     std::string handleCommand(const std::string& cmd);
+    std::string listJobs();
+    std::string listSeeds();
+    // <hash> <out> and the download flags. False on a malformed command.
+    bool parseDownload(std::stringstream& ss, DownloadSpec& spec, int& priority);
+    // `stream`: sends the download's bytes to the client as they verify, as
+    // frames of [len u32][bytes], then a zero length, a u8 that is 1 if the
+    // download completed, and the usual [len][text] response.
+    void streamDownload(SocketType client, const std::string& cmd);
 };
 
 #endif // IPC_SERVER_H
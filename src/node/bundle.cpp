@@ -0,0 +1,259 @@
+#include "bundle.h"
+#include "output_file.h"
+#include "file_utils.h"
+#include "logger.h"
+#include "sha256.h"
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+
+namespace fs = std::filesystem;
+
+constexpr char BUNDLE_MAGIC[8] = { 'P', 'W', 'B', 'U', 'N', 'D', 'L', '1' };
+// Bundle files a download keeps open for writing at once.
+constexpr size_t MAX_OPEN_OUTPUT_FILES = 64;
+
+static void appendRaw(std::string& out, const void* data, size_t size) {
+    out.append(static_cast<const char*>(data), size);
+}
+
+uint64_t BundleManifest::totalSize() const {
+    return files.empty() ? 0 : files.back().offset + files.back().size;
+}
+
+std::vector<BundleSegment> BundleManifest::locate(uint64_t offset, uint64_t length) const {
+    std::vector<BundleSegment> out;
+    uint64_t end = offset + length;
+    auto it = std::partition_point(files.begin(), files.end(), [&](const BundleEntry& e) {
+        return e.offset + e.size <= offset;
+    });
+    for (; it != files.end() && it->offset < end; ++it) {
+        if (it->size == 0) continue;
+        uint64_t from = std::max(offset, it->offset);
+        uint64_t to = std::min(end, it->offset + it->size);
+        out.push_back(BundleSegment{(uint32_t)(it - files.begin()), from - it->offset, to - from, from - offset});
+    }
+    return out;
+}
+
+std::vector<bool> BundleManifest::select(const std::vector<std::string>& only) const {
+    std::vector<bool> selected(files.size(), only.empty());
+    for (std::string prefix : only) {
+        while (!prefix.empty() && prefix.back() == '/') prefix.pop_back();
+        for (size_t i = 0; i < files.size(); ++i) {
+            const std::string& p = files[i].path;
+            if (prefix.empty() || p == prefix || (p.size() > prefix.size() && p[prefix.size()] == '/' &&
+                                                  p.compare(0, prefix.size(), prefix) == 0)) {
+                selected[i] = true;
+            }
+        }
+    }
+    return selected;
+}
+
+bool Bundle::scan(const std::string& root, BundleManifest& out) {
+    std::error_code ec;
+    fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec);
+    if (ec) return false;
+
+    out.files.clear();
+    out.chunkHashes.clear();
+    for (; it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (ec) return false;
+        if (it->is_symlink(ec) || !it->is_regular_file(ec)) continue;
+        BundleEntry entry;
+        entry.path = it->path().lexically_relative(root).generic_string();
+        if (entry.path.size() > UINT16_MAX) return false;
+        entry.size = it->file_size(ec);
+        if (ec) return false;
+        out.files.push_back(std::move(entry));
+    }
+    if (ec) return false;
+
+    std::sort(out.files.begin(), out.files.end(), [](const BundleEntry& a, const BundleEntry& b) {
+        return a.path < b.path;
+    });
+    uint64_t offset = 0;
+    for (auto& f : out.files) {
+        f.offset = offset;
+        offset += f.size;
+    }
+    return true;
+}
+
+bool Bundle::hashChunks(const std::string& root, BundleManifest& manifest) {
+    if (manifest.chunkSize == 0) return false;
+    manifest.chunkHashes.clear();
+    std::vector<char> buffer(manifest.chunkSize);
+    size_t filled = 0;
+    for (const auto& f : manifest.files) {
+        if (f.size == 0) continue;
+        std::ifstream file(fs::path(root) / f.path, std::ios::binary);
+        uint64_t left = f.size;
+        while (left > 0) {
+            size_t toRead = (size_t)std::min<uint64_t>(left, buffer.size() - filled);
+            if (!file.read(buffer.data() + filled, toRead)) {
+                Logger::error("Cannot read " + f.path + " in bundle " + root);
+                return false;
+            }
+            filled += toRead;
+            left -= toRead;
+            if (filled == buffer.size()) {
+                manifest.chunkHashes.push_back(SHA256::digest(buffer.data(), filled));
+                filled = 0;
+            }
+        }
+    }
+    if (filled > 0) manifest.chunkHashes.push_back(SHA256::digest(buffer.data(), filled));
+    return true;
+}
+
+std::string Bundle::encode(const BundleManifest& manifest) {
+    std::string out;
+    uint32_t fileCount = (uint32_t)manifest.files.size();
+    uint32_t chunkCount = (uint32_t)manifest.chunkHashes.size();
+    appendRaw(out, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC));
+    appendRaw(out, &manifest.chunkSize, sizeof(manifest.chunkSize));
+    appendRaw(out, &fileCount, sizeof(fileCount));
+    for (const auto& f : manifest.files) {
+        uint16_t pathLen = (uint16_t)f.path.size();
+        appendRaw(out, &f.size, sizeof(f.size));
+        appendRaw(out, &pathLen, sizeof(pathLen));
+        out += f.path;
+    }
+    appendRaw(out, &chunkCount, sizeof(chunkCount));
+    for (const Digest& h : manifest.chunkHashes) appendRaw(out, h.data(), Digest::SIZE);
+    return out;
+}
+
+bool Bundle::decode(const std::string& data, BundleManifest& out) {
+    size_t pos = 0;
+    auto take = [&](void* dst, size_t size) {
+        if (data.size() - pos < size) return false;
+        memcpy(dst, data.data() + pos, size);
+        pos += size;
+        return true;
+    };
+
+    char magic[sizeof(BUNDLE_MAGIC)];
+    uint32_t fileCount = 0;
+    if (!take(magic, sizeof(magic)) || memcmp(magic, BUNDLE_MAGIC, sizeof(magic)) != 0) return false;
+    if (!take(&out.chunkSize, sizeof(out.chunkSize)) || out.chunkSize == 0) return false;
+    if (!take(&fileCount, sizeof(fileCount))) return false;
+
+    out.files.clear();
+    out.chunkHashes.clear();
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < fileCount; ++i) {
+        BundleEntry entry;
+        uint16_t pathLen = 0;
+        if (!take(&entry.size, sizeof(entry.size)) || !take(&pathLen, sizeof(pathLen))) return false;
+        if (data.size() - pos < pathLen) return false;
+        entry.path.assign(data, pos, pathLen);
+        pos += pathLen;
+        if (!isSafePath(entry.path)) return false;
+        if (!out.files.empty() && !(out.files.back().path < entry.path)) return false;
+        if (entry.size > UINT64_MAX - offset) return false;
+        entry.offset = offset;
+        offset += entry.size;
+        out.files.push_back(std::move(entry));
+    }
+
+    uint32_t chunkCount = 0;
+    if (!take(&chunkCount, sizeof(chunkCount))) return false;
+    if (chunkCount != (offset + out.chunkSize - 1) / out.chunkSize) return false;
+    if (data.size() - pos != (size_t)chunkCount * 32) return false;
+    for (uint32_t i = 0; i < chunkCount; ++i, pos += 32) out.chunkHashes.push_back(Digest::fromBytes(data.data() + pos));
+    return true;
+}
+
+bool Bundle::isSafePath(const std::string& path) {
+    if (path.empty() || path.front() == '/' || path.find('\\') != std::string::npos) return false;
+#ifdef _WIN32
+    if (path.find(':') != std::string::npos) return false; // Drive letters and streams
+#endif
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos) end = path.size();
+        std::string part = path.substr(start, end - start);
+        if (part.empty() || part == "." || part == "..") return false;
+        start = end + 1;
+    }
+    return true;
+}
+
+bool Bundle::readAt(const std::string& root, const BundleManifest& manifest,
+                    uint64_t offset, char* data, size_t size) {
+    uint64_t covered = 0;
+    for (const BundleSegment& s : manifest.locate(offset, size)) {
+        std::shared_ptr<FileHandle> file = FileUtils::openRead((fs::path(root) / manifest.files[s.file].path).string());
+        if (!file || !FileUtils::readAt(file->fd(), data + s.rangeOffset, (size_t)s.length, s.fileOffset)) return false;
+        covered += s.length;
+    }
+    return covered == size;
+}
+
+BundleOutput::BundleOutput(const std::string& r, std::shared_ptr<const BundleManifest> m,
+                           const std::vector<bool>& sel)
+    : root(r), manifest(std::move(m)), selected(sel) {
+}
+
+BundleOutput::~BundleOutput() = default;
+
+std::unique_ptr<BundleOutput> BundleOutput::open(const std::string& root,
+                                                 std::shared_ptr<const BundleManifest> manifest,
+                                                 const std::vector<bool>& selected) {
+    std::error_code ec;
+    fs::create_directories(root, ec);
+    if (ec) return nullptr;
+    // Every selected file exists at its final size before the first chunk
+    // arrives; empty ones never receive a write.
+    for (size_t i = 0; i < manifest->files.size(); ++i) {
+        if (!selected[i]) continue;
+        fs::path path = fs::path(root) / manifest->files[i].path;
+        fs::create_directories(path.parent_path(), ec);
+        if (ec || !OutputFile::open(path.string(), manifest->files[i].size)) {
+            Logger::error("Cannot create " + path.string());
+            return nullptr;
+        }
+    }
+    return std::unique_ptr<BundleOutput>(new BundleOutput(root, std::move(manifest), selected));
+}
+
+OutputFile* BundleOutput::fileFor(uint32_t index) {
+    auto it = openFiles.find(index);
+    if (it != openFiles.end()) return it->second.get();
+    if (openFiles.size() >= MAX_OPEN_OUTPUT_FILES) {
+        // Chunks arrive in no particular order, so any file is as good to close as another
+        auto victim = openFiles.begin();
+        if (!victim->second->sync()) syncFailed = true;
+        openFiles.erase(victim);
+    }
+    const BundleEntry& entry = manifest->files[index];
+    std::unique_ptr<OutputFile> file = OutputFile::open((fs::path(root) / entry.path).string(), entry.size);
+    if (!file) return nullptr;
+    return openFiles.emplace(index, std::move(file)).first->second.get();
+}
+
+bool BundleOutput::writeAt(uint64_t offset, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const BundleSegment& s : manifest->locate(offset, size)) {
+        if (!selected[s.file]) continue;
+        OutputFile* file = fileFor(s.file);
+        if (!file || !file->writeAt(s.fileOffset, bytes + s.rangeOffset, (size_t)s.length)) return false;
+    }
+    return true;
+}
+
+bool BundleOutput::sync() {
+    std::lock_guard<std::mutex> lock(mutex);
+    bool ok = !syncFailed;
+    syncFailed = false;
+    for (auto& [index, file] : openFiles) {
+        if (!file->sync()) ok = false;
+    }
+    return ok;
+}
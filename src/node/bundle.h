@@ -0,0 +1,102 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include "digest.h"
+
+class OutputFile;
+
+struct BundleEntry {
+    std::string path;    // Relative to the bundle root, '/'-separated
+    uint64_t size = 0;
+    uint64_t offset = 0; // Where the file starts in the bundle's byte stream
+};
+
+// The part of a bundle byte range that falls in one file.
+struct BundleSegment {
+    uint32_t file;       // Index into BundleManifest::files
+    uint64_t fileOffset;
+    uint64_t length;
+    uint64_t rangeOffset; // Where it starts within the requested range
+};
+
+// A directory shared as one unit. Its regular files, in byte order of their
+// paths, are concatenated into one stream that is chunked like a single
+// file, so chunks span file boundaries and a tree of small files neither
+// pads out to a chunk per file nor needs an announce per file.
+//
+// The bundle hash is the SHA-256 of the encoded manifest, which lists every
+// path and size and every chunk hash; a downloader that checks it can trust
+// all three. Layout: magic "PWBUNDL1", chunkSize u32, fileCount u32, then per
+// file size u64, pathLen u16, path; then chunkCount u32 and the 32-byte
+// chunk hashes.
+struct BundleManifest {
+    uint32_t chunkSize = 0;
+    std::vector<BundleEntry> files;
+    std::vector<Digest> chunkHashes;
+
+    uint64_t totalSize() const;
+    // Files overlapping [offset, offset + length), in stream order; empty
+    // files never overlap anything.
+    std::vector<BundleSegment> locate(uint64_t offset, uint64_t length) const;
+    // Which files a selection of paths and directory prefixes covers; an
+    // empty selection covers every file.
+    std::vector<bool> select(const std::vector<std::string>& only) const;
+};
+
+class Bundle {
+public:
+    // Lists the regular files under `root` in bundle order, setting offsets.
+    // Symlinks are skipped. Chunk hashes are left empty.
+    static bool scan(const std::string& root, BundleManifest& out);
+    // Reads the files in order and fills in the chunk hashes.
+    static bool hashChunks(const std::string& root, BundleManifest& manifest);
+
+    static std::string encode(const BundleManifest& manifest);
+    // Fails on truncated data, unsorted or duplicate paths, and paths that
+    // would leave the bundle root.
+    static bool decode(const std::string& data, BundleManifest& out);
+    static bool isSafePath(const std::string& path);
+
+    // Reads `size` bytes of the stream at `offset` from the files under `root`.
+    static bool readAt(const std::string& root, const BundleManifest& manifest,
+                       uint64_t offset, char* data, size_t size);
+};
+
+// A bundle download's output tree. Opening it creates the selected files at
+// their full size; writes of stream ranges are split across the files they
+// cover, and the parts that fall in unselected files are dropped. A bounded
+// set of files stays open; closing one syncs it first, so sync() still
+// covers everything written since the last call.
+class BundleOutput {
+public:
+    static std::unique_ptr<BundleOutput> open(const std::string& root,
+                                              std::shared_ptr<const BundleManifest> manifest,
+                                              const std::vector<bool>& selected);
+    ~BundleOutput();
+
+    BundleOutput(const BundleOutput&) = delete;
+    BundleOutput& operator=(const BundleOutput&) = delete;
+
+    bool writeAt(uint64_t offset, const void* data, size_t size);
+    bool sync();
+
+private:
+    BundleOutput(const std::string& root, std::shared_ptr<const BundleManifest> manifest,
+                 const std::vector<bool>& selected);
+    OutputFile* fileFor(uint32_t index); // Caller holds the mutex
+
+    std::string root;
+    std::shared_ptr<const BundleManifest> manifest;
+    std::vector<bool> selected;
+    std::mutex mutex;
+    std::map<uint32_t, std::unique_ptr<OutputFile>> openFiles;
+    bool syncFailed = false; // A file closed early failed to sync
+};
+
+#endif // BUNDLE_H
@@ -0,0 +1,43 @@
+#include "chunk_bitfield.h"
+
+ChunkBitfield::ChunkBitfield(uint32_t n, bool full)
+    : count(n), words(new std::atomic<uint64_t>[(n + 63) / 64]), setCount(full ? n : 0) {
+    uint32_t wordCount = (n + 63) / 64;
+    for (uint32_t w = 0; w < wordCount; ++w) {
+        uint64_t v = 0;
+        if (full) {
+            uint32_t bits = (w + 1) * 64 <= n ? 64 : n - w * 64;
+            v = bits == 64 ? ~0ULL : ((1ULL << bits) - 1);
+        }
+        words[w].store(v);
+    }
+}
+
+bool ChunkBitfield::has(uint32_t index) const {
+    if (index >= count) return false;
+    return (words[index / 64].load() >> (index % 64)) & 1;
+}
+
+bool ChunkBitfield::set(uint32_t index) {
+    if (index >= count) return false;
+    uint64_t bit = 1ULL << (index % 64);
+    if (words[index / 64].fetch_or(bit) & bit) return false;
+    ++setCount;
+    return true;
+}
+
+std::vector<uint8_t> ChunkBitfield::toBytes() const {
+    std::vector<uint8_t> out((count + 7) / 8, 0);
+    for (uint32_t i = 0; i < count; ++i) {
+        if (has(i)) out[i / 8] |= (uint8_t)(0x80 >> (i % 8));
+    }
+    return out;
+}
+
+std::vector<bool> ChunkBitfield::fromBytes(const uint8_t* data, uint32_t n) {
+    std::vector<bool> bits(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        bits[i] = (data[i / 8] & (0x80 >> (i % 8))) != 0;
+    }
+    return bits;
+}
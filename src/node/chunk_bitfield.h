@@ -0,0 +1,32 @@
+#ifndef CHUNK_BITFIELD_H
+#define CHUNK_BITFIELD_H
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+// Which chunks of a file this node holds. Bits are only ever set, and may be
+// set and read concurrently without a lock.
+class ChunkBitfield {
+public:
+    explicit ChunkBitfield(uint32_t count, bool full = false);
+
+    uint32_t size() const { return count; }
+    bool has(uint32_t index) const;
+    // Returns true if the bit was not already set.
+    bool set(uint32_t index);
+    uint32_t countSet() const { return setCount.load(); }
+    bool complete() const { return countSet() == count; }
+
+    // Wire form: bit i is (byte i/8) & (0x80 >> i%8).
+    std::vector<uint8_t> toBytes() const;
+    static std::vector<bool> fromBytes(const uint8_t* data, uint32_t count);
+
+private:
+    uint32_t count;
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+    std::atomic<uint32_t> setCount;
+};
+
+#endif // CHUNK_BITFIELD_H
@@ -0,0 +1,94 @@
+#include "chunk_cache.h"
+#include <functional>
+
+// Share of a shard that SLRU reserves for chunks that were hit more than once.
+constexpr size_t PROTECTED_PERCENT = 80;
+
+ChunkCache::ChunkCache(size_t capacityBytes, CachePolicy pol, size_t shardCount)
+    : capacity(capacityBytes), policy(pol) {
+    if (shardCount == 0) shardCount = 1;
+    shardCapacity = capacity / shardCount;
+    for (size_t i = 0; i < shardCount; ++i) {
+        shards.push_back(std::make_unique<Shard>());
+    }
+}
+
+ChunkCache::Shard& ChunkCache::shardFor(const Key& key) {
+    return *shards[KeyHash()(key) % shards.size()];
+}
+
+ChunkBuffer ChunkCache::get(const Digest& fileHash, uint32_t index) {
+    if (!enabled()) return nullptr;
+    Key key{fileHash, index};
+    Shard& shard = shardFor(key);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end()) {
+        ++misses_;
+        return nullptr;
+    }
+    ++hits_;
+
+    Entry& e = it->second;
+    if (policy == CachePolicy::SLRU && !e.isProtected) {
+        // Second hit: promote to the protected segment
+        shard.probation.erase(e.pos);
+        shard.protectedList.push_front(key);
+        e.pos = shard.protectedList.begin();
+        e.isProtected = true;
+        shard.protectedBytes += e.data->size();
+
+        // Demote the oldest protected chunks back to probation when over budget
+        size_t protectedCap = shardCapacity * PROTECTED_PERCENT / 100;
+        while (shard.protectedBytes > protectedCap && shard.protectedList.size() > 1) {
+            Key victim = shard.protectedList.back();
+            shard.protectedList.pop_back();
+            Entry& v = shard.entries[victim];
+            shard.protectedBytes -= v.data->size();
+            shard.probation.push_front(victim);
+            v.pos = shard.probation.begin();
+            v.isProtected = false;
+        }
+    } else {
+        std::list<Key>& segment = e.isProtected ? shard.protectedList : shard.probation;
+        segment.splice(segment.begin(), segment, e.pos);
+    }
+    return e.data;
+}
+
+void ChunkCache::put(const Digest& fileHash, uint32_t index, ChunkBuffer data) {
+    if (!enabled() || !data || data->size() > shardCapacity) return;
+    Key key{fileHash, index};
+    Shard& shard = shardFor(key);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.entries.count(key)) return; // Same content, already cached
+
+    shard.probation.push_front(key);
+    shard.entries[key] = Entry{data, false, shard.probation.begin()};
+    shard.bytes += data->size();
+    while (shard.bytes > shardCapacity) evict(shard);
+}
+
+void ChunkCache::evict(Shard& shard) {
+    // New and once-used chunks go first; protected ones only when probation is empty.
+    std::list<Key>& segment = shard.probation.empty() ? shard.protectedList : shard.probation;
+    if (segment.empty()) return;
+
+    auto it = shard.entries.find(segment.back());
+    shard.bytes -= it->second.data->size();
+    if (it->second.isProtected) shard.protectedBytes -= it->second.data->size();
+    shard.entries.erase(it);
+    segment.pop_back();
+    ++evictions_;
+}
+
+size_t ChunkCache::sizeBytes() {
+    size_t total = 0;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->bytes;
+    }
+    return total;
+}
@@ -0,0 +1,75 @@
+#ifndef CHUNK_CACHE_H
+#define CHUNK_CACHE_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include "peer_reply.h"
+#include "digest.h"
+
+enum class CachePolicy {
+    LRU,  // Evict the least recently used chunk
+    SLRU  // Segmented LRU: chunks hit a second time move to a protected
+          // segment, so a burst of one-off reads cannot flush popular chunks
+};
+
+// Size-bounded in-memory cache of seeded chunks, keyed by (file hash, index).
+// Split into independently locked shards to keep concurrent senders apart.
+class ChunkCache {
+public:
+    ChunkCache(size_t capacityBytes, CachePolicy policy, size_t shardCount = 16);
+
+    bool enabled() const { return capacity > 0; }
+
+    // Returns nullptr on a miss.
+    ChunkBuffer get(const Digest& fileHash, uint32_t index);
+    void put(const Digest& fileHash, uint32_t index, ChunkBuffer data);
+
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+    uint64_t evictions() const { return evictions_; }
+    size_t sizeBytes();
+
+private:
+    struct Key {
+        Digest fileHash;
+        uint32_t index;
+        bool operator==(const Key& other) const { return index == other.index && fileHash == other.fileHash; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& k) const { return std::hash<Digest>()(k.fileHash) ^ (k.index * 0x9e3779b97f4a7c15ULL); }
+    };
+
+    struct Entry {
+        ChunkBuffer data;
+        bool isProtected;
+        std::list<Key>::iterator pos;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::list<Key> probation; // Most recently used first
+        std::list<Key> protectedList;
+        std::unordered_map<Key, Entry, KeyHash> entries;
+        size_t bytes = 0;
+        size_t protectedBytes = 0;
+    };
+
+    Shard& shardFor(const Key& key);
+    void evict(Shard& shard);
+
+    size_t capacity;
+    size_t shardCapacity;
+    CachePolicy policy;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> evictions_{0};
+};
+
+#endif // CHUNK_CACHE_H
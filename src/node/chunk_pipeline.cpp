@@ -0,0 +1,138 @@
+#include "chunk_pipeline.h"
+
+ChunkPipeline::ChunkPipeline(size_t verifyThreads, size_t verifyQueueSize, size_t writeQueueSize,
+                             VerifyFn v, CorruptFn c, WriteFn w)
+    : verify(std::move(v)), corrupt(std::move(c)), write(std::move(w)),
+      verifyQueue(verifyQueueSize), writeQueue(writeQueueSize) {
+    if (verifyThreads == 0) verifyThreads = 1;
+    // Enough to cover every buffer that can be queued or being worked on
+    maxFreeBuffers = verifyQueue.capacity() + writeQueue.capacity() + verifyThreads + 1;
+    for (size_t i = 0; i < verifyThreads; ++i) verifiers.emplace_back(&ChunkPipeline::verifyLoop, this);
+    writer = std::thread(&ChunkPipeline::writeLoop, this);
+}
+
+ChunkPipeline::~ChunkPipeline() {
+    finish();
+}
+
+std::vector<char> ChunkPipeline::acquireBuffer(size_t size) {
+    std::vector<char> buffer;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!freeBuffers.empty()) {
+            buffer.swap(freeBuffers.back());
+            freeBuffers.pop_back();
+            reused++;
+        } else {
+            allocated++;
+        }
+    }
+    buffer.resize(size);
+    return buffer;
+}
+
+void ChunkPipeline::releaseBuffer(std::vector<char> buffer) {
+    if (buffer.capacity() == 0) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!finished && freeBuffers.size() < maxFreeBuffers) freeBuffers.push_back(std::move(buffer));
+}
+
+bool ChunkPipeline::submit(uint32_t index, std::vector<char> data) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (finished) return false;
+        inFlight++;
+    }
+    if (verifyQueue.push(Item{index, std::move(data)})) return true;
+    retire();
+    return false;
+}
+
+size_t ChunkPipeline::pending() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return inFlight;
+}
+
+void ChunkPipeline::waitForProgress(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    progress.wait_for(lock, timeout);
+}
+
+void ChunkPipeline::notifyProgress() {
+    std::lock_guard<std::mutex> lock(mutex);
+    progress.notify_all();
+}
+
+void ChunkPipeline::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (finished) return;
+        finished = true;
+    }
+    verifyQueue.close();
+    for (auto& t : verifiers) t.join();
+    // Verifiers are gone, so nothing else can be queued for the writer
+    writeQueue.close();
+    writer.join();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    freeBuffers.clear();
+    freeBuffers.shrink_to_fit();
+}
+
+PipelineStats ChunkPipeline::stats() const {
+    PipelineStats s;
+    s.verifyDepth = verifyQueue.depth();
+    s.verifyPeak = verifyQueue.peakDepth();
+    s.verifyCapacity = verifyQueue.capacity();
+    s.writeDepth = writeQueue.depth();
+    s.writePeak = writeQueue.peakDepth();
+    s.writeCapacity = writeQueue.capacity();
+    std::lock_guard<std::mutex> lock(mutex);
+    s.verified = verified;
+    s.corrupt = corruptCount;
+    s.written = written;
+    s.buffersAllocated = allocated;
+    s.buffersReused = reused;
+    return s;
+}
+
+void ChunkPipeline::verifyLoop() {
+    Item item;
+    while (verifyQueue.pop(item)) {
+        if (verify(item.index, item.data)) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                verified++;
+            }
+            if (writeQueue.push(std::move(item))) continue;
+        } else {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                corruptCount++;
+            }
+            corrupt(item.index);
+        }
+        releaseBuffer(std::move(item.data));
+        retire();
+    }
+}
+
+void ChunkPipeline::writeLoop() {
+    Item item;
+    while (writeQueue.pop(item)) {
+        write(item.index, item.data);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            written++;
+        }
+        releaseBuffer(std::move(item.data));
+        retire();
+    }
+}
+
+void ChunkPipeline::retire() {
+    std::lock_guard<std::mutex> lock(mutex);
+    inFlight--;
+    progress.notify_all();
+}
@@ -0,0 +1,155 @@
+#ifndef CHUNK_PIPELINE_H
+#define CHUNK_PIPELINE_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+// Fixed-capacity FIFO between two pipeline stages. push() blocks while the
+// queue is full, which is how a slow stage holds back the one feeding it.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+    // False once the queue is closed; the item is dropped.
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&] { return closed || items.size() < capacity_; });
+        if (closed) return false;
+        items.push_back(std::move(item));
+        if (items.size() > peak) peak = items.size();
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // False once the queue is closed and drained.
+    bool pop(T& out) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&] { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        out = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // Wakes every waiter. Items already queued are still handed out.
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+    size_t depth() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return items.size();
+    }
+    size_t peakDepth() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return peak;
+    }
+    size_t capacity() const { return capacity_; }
+
+private:
+    mutable std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::deque<T> items;
+    size_t capacity_;
+    size_t peak = 0;
+    bool closed = false;
+};
+
+struct PipelineStats {
+    size_t verifyDepth;
+    size_t verifyPeak;
+    size_t verifyCapacity;
+    size_t writeDepth;
+    size_t writePeak;
+    size_t writeCapacity;
+    uint64_t verified;
+    uint64_t corrupt;
+    uint64_t written;
+    uint64_t buffersAllocated; // Chunk buffers created
+    uint64_t buffersReused;    // Chunk buffers handed out again from the pool
+};
+
+// The receive side of a download, split into stages that run at the same
+// time: network workers assemble chunks into pooled buffers and submit()
+// them, a pool of threads checks each chunk, and one writer thread stores
+// the good ones. Both hand-offs go through bounded queues, so a slow disk
+// or slow hashing throttles the network instead of buffering without limit.
+class ChunkPipeline {
+public:
+    // True if the chunk's data matches its expected hash.
+    using VerifyFn = std::function<bool(uint32_t index, const std::vector<char>& data)>;
+    // Called on a verify thread for a chunk that failed.
+    using CorruptFn = std::function<void(uint32_t index)>;
+    // Called on the writer thread, in verification order.
+    using WriteFn = std::function<void(uint32_t index, const std::vector<char>& data)>;
+
+    ChunkPipeline(size_t verifyThreads, size_t verifyQueue, size_t writeQueue,
+                  VerifyFn verify, CorruptFn corrupt, WriteFn write);
+    ~ChunkPipeline();
+
+    ChunkPipeline(const ChunkPipeline&) = delete;
+    ChunkPipeline& operator=(const ChunkPipeline&) = delete;
+
+    // A buffer of `size` bytes, recycled from an earlier chunk when possible.
+    std::vector<char> acquireBuffer(size_t size);
+    void releaseBuffer(std::vector<char> buffer);
+
+    // Queues an assembled chunk. Blocks while the verify queue is full.
+    // False after finish().
+    bool submit(uint32_t index, std::vector<char> data);
+    // Chunks submitted whose verify or write callback has not returned yet.
+    size_t pending() const;
+    // Waits until some chunk leaves the pipeline, `timeout`, or notifyProgress().
+    void waitForProgress(std::chrono::milliseconds timeout);
+    // Wakes the waiters, for progress made outside the pipeline.
+    void notifyProgress();
+    // Processes everything still queued, then stops the threads and frees
+    // the pooled buffers. Stats stay readable.
+    void finish();
+
+    PipelineStats stats() const;
+
+private:
+    struct Item {
+        uint32_t index;
+        std::vector<char> data;
+    };
+
+    void verifyLoop();
+    void writeLoop();
+    void retire();
+
+    VerifyFn verify;
+    CorruptFn corrupt;
+    WriteFn write;
+    BoundedQueue<Item> verifyQueue;
+    BoundedQueue<Item> writeQueue;
+    std::vector<std::thread> verifiers;
+    std::thread writer;
+
+    mutable std::mutex mutex; // Guards everything below
+    std::condition_variable progress;
+    std::vector<std::vector<char>> freeBuffers;
+    size_t maxFreeBuffers;
+    size_t inFlight = 0;
+    bool finished = false;
+    uint64_t verified = 0;
+    uint64_t corruptCount = 0;
+    uint64_t written = 0;
+    uint64_t allocated = 0;
+    uint64_t reused = 0;
+};
+
+#endif // CHUNK_PIPELINE_H
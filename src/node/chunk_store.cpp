@@ -0,0 +1,65 @@
+#include "chunk_store.h"
+#include <algorithm>
+
+void ChunkStore::addFile(const Digest& fileHash, const std::vector<Digest>& chunkHashes,
+                         const std::vector<uint32_t>& lengths) {
+    std::lock_guard<std::mutex> lock(mutex);
+    removeLocked(fileHash);
+    size_t count = std::min(chunkHashes.size(), lengths.size());
+    for (size_t i = 0; i < count; ++i) {
+        auto [it, added] = chunks.try_emplace(chunkHashes[i]);
+        if (added) {
+            it->second.length = lengths[i];
+            totals.uniqueChunks++;
+            totals.uniqueBytes += lengths[i];
+        }
+        it->second.locations.push_back(ChunkLocation{fileHash, (uint32_t)i});
+        totals.referencedChunks++;
+        totals.referencedBytes += it->second.length;
+    }
+    files[fileHash].assign(chunkHashes.begin(), chunkHashes.begin() + count);
+}
+
+void ChunkStore::removeFile(const Digest& fileHash) {
+    std::lock_guard<std::mutex> lock(mutex);
+    removeLocked(fileHash);
+}
+
+void ChunkStore::removeLocked(const Digest& fileHash) {
+    auto file = files.find(fileHash);
+    if (file == files.end()) return;
+    for (const Digest& hash : file->second) {
+        // A chunk repeated within the file has all its locations dropped the
+        // first time round
+        auto it = chunks.find(hash);
+        if (it == chunks.end()) continue;
+        std::vector<ChunkLocation>& locations = it->second.locations;
+        auto from = std::remove_if(locations.begin(), locations.end(), [&](const ChunkLocation& l) {
+            return l.fileHash == fileHash;
+        });
+        uint64_t removed = (uint64_t)(locations.end() - from);
+        locations.erase(from, locations.end());
+        totals.referencedChunks -= removed;
+        totals.referencedBytes -= removed * it->second.length;
+        if (locations.empty()) {
+            totals.uniqueChunks--;
+            totals.uniqueBytes -= it->second.length;
+            chunks.erase(it);
+        }
+    }
+    files.erase(file);
+}
+
+std::vector<ChunkLocation> ChunkStore::locate(const Digest& chunkHash) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = chunks.find(chunkHash);
+    if (it == chunks.end()) return {};
+    return it->second.locations;
+}
+
+ChunkStoreStats ChunkStore::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    ChunkStoreStats s = totals;
+    s.files = files.size();
+    return s;
+}
@@ -0,0 +1,60 @@
+#ifndef CHUNK_STORE_H
+#define CHUNK_STORE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include "digest.h"
+
+// Chunk `index` of the seeded file or bundle `fileHash`.
+struct ChunkLocation {
+    Digest fileHash;
+    uint32_t index;
+};
+
+struct ChunkStoreStats {
+    uint64_t files = 0;
+    uint64_t uniqueChunks = 0;    // Distinct chunk hashes
+    uint64_t uniqueBytes = 0;     // What the chunks take stored once each
+    uint64_t referencedChunks = 0; // Chunks over all files, repeats included
+    uint64_t referencedBytes = 0;
+
+    // Referenced over unique bytes; 1 when nothing is shared.
+    double dedupRatio() const { return uniqueBytes ? (double)referencedBytes / uniqueBytes : 1.0; }
+};
+
+// Index of every chunk this node seeds or downloads, keyed by chunk hash, so
+// a chunk shared by several files (versions of an image, copies in different
+// bundles) can be read from whichever of them holds it. The data itself stays
+// in the files; the index only says where to look, and readers check the
+// hash of what they read.
+class ChunkStore {
+public:
+    // Replaces what was indexed for `fileHash`. `lengths` runs parallel to
+    // `chunkHashes`.
+    void addFile(const Digest& fileHash, const std::vector<Digest>& chunkHashes,
+                 const std::vector<uint32_t>& lengths);
+    void removeFile(const Digest& fileHash);
+
+    // Every indexed copy of the chunk, in the order files were added.
+    std::vector<ChunkLocation> locate(const Digest& chunkHash) const;
+    ChunkStoreStats stats() const;
+
+private:
+    struct Entry {
+        uint32_t length = 0;
+        std::vector<ChunkLocation> locations;
+    };
+
+    void removeLocked(const Digest& fileHash);
+
+    mutable std::mutex mutex;
+    std::unordered_map<Digest, Entry> chunks;
+    std::map<Digest, std::vector<Digest>> files; // File hash -> its chunk hashes
+    ChunkStoreStats totals; // `files` aside
+};
+
+#endif // CHUNK_STORE_H
@@ -0,0 +1,140 @@
+#include "chunker.h"
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+// Smallest minimum size accepted, to keep per-chunk overhead sensible.
+constexpr uint32_t MIN_CHUNK_LENGTH = 4 * 1024;
+// Seed of the gear table. Peers only agree on boundaries if their tables
+// match, so it must never change.
+constexpr uint64_t GEAR_SEED = 0x5057434443303031ULL; // "PWCDC001"
+
+static const uint64_t* gearTable() {
+    static const auto table = []() {
+        std::vector<uint64_t> t(256);
+        uint64_t state = GEAR_SEED;
+        for (auto& v : t) {
+            // splitmix64
+            uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            v = z ^ (z >> 31);
+        }
+        return t;
+    }();
+    return table.data();
+}
+
+// `bits` ones in the top of the word, which the gear hash mixes best.
+static uint64_t topMask(int bits) {
+    bits = std::clamp(bits, 1, 63);
+    return ~0ULL << (64 - bits);
+}
+
+bool ChunkingParams::valid() const {
+    return minSize >= MIN_CHUNK_LENGTH && minSize <= avgSize && avgSize <= maxSize && minSize < maxSize &&
+           maxSize <= ChunkLayout::MAX_LENGTH;
+}
+
+ChunkLayout ChunkLayout::fixed(uint64_t fileSize, uint32_t chunkSize) {
+    ChunkLayout layout;
+    layout.size = fileSize;
+    layout.fixedSize = chunkSize;
+    return layout;
+}
+
+ChunkLayout ChunkLayout::variable(const std::vector<uint32_t>& lengths) {
+    ChunkLayout layout;
+    layout.starts.reserve(lengths.size() + 1);
+    layout.starts.push_back(0);
+    for (uint32_t length : lengths) {
+        if (length == 0 || length > MAX_LENGTH) return ChunkLayout();
+        layout.starts.push_back(layout.starts.back() + length);
+    }
+    layout.size = layout.starts.back();
+    if (lengths.empty()) layout.starts.clear();
+    return layout;
+}
+
+uint32_t ChunkLayout::count() const {
+    if (!isFixed()) return (uint32_t)(starts.size() - 1);
+    return fixedSize ? (uint32_t)((size + fixedSize - 1) / fixedSize) : 0;
+}
+
+uint64_t ChunkLayout::offset(uint32_t index) const {
+    if (!isFixed()) return starts[std::min<size_t>(index, starts.size() - 1)];
+    return std::min<uint64_t>((uint64_t)index * fixedSize, size);
+}
+
+uint32_t ChunkLayout::length(uint32_t index) const {
+    return (uint32_t)(offset(index + 1) - offset(index));
+}
+
+uint32_t ChunkLayout::maxLength() const {
+    if (isFixed()) return (uint32_t)std::min<uint64_t>(fixedSize, size);
+    uint32_t longest = 0;
+    for (uint32_t i = 0; i < count(); ++i) longest = std::max(longest, length(i));
+    return longest;
+}
+
+std::vector<uint32_t> ChunkLayout::lengths() const {
+    std::vector<uint32_t> out(count());
+    for (uint32_t i = 0; i < out.size(); ++i) out[i] = length(i);
+    return out;
+}
+
+Chunker::Chunker(const ChunkingParams& p) : params(p) {
+    // Normalized chunking, level 2: two bits stricter below the average, two
+    // looser above it.
+    int bits = (int)std::lround(std::log2((double)std::max<uint32_t>(p.avgSize, 2)));
+    maskSmall = topMask(bits + 2);
+    maskLarge = topMask(bits - 2);
+}
+
+size_t Chunker::cut(const uint8_t* data, size_t size) const {
+    if (size <= params.minSize) return size;
+    size_t end = std::min<size_t>(size, params.maxSize);
+    size_t normal = std::min<size_t>(end, params.avgSize);
+    const uint64_t* gear = gearTable();
+    uint64_t hash = 0;
+    size_t i = params.minSize;
+    for (; i < normal; ++i) {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & maskSmall)) return i + 1;
+    }
+    for (; i < end; ++i) {
+        hash = (hash << 1) + gear[data[i]];
+        if (!(hash & maskLarge)) return i + 1;
+    }
+    return end;
+}
+
+bool Chunker::cutFile(const std::string& path, const ChunkingParams& params, std::vector<uint32_t>& lengths) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    Chunker chunker(params);
+    lengths.clear();
+
+    std::vector<uint8_t> buffer(std::max<size_t>((size_t)params.maxSize * 4, 4 * 1024 * 1024));
+    size_t start = 0;
+    size_t end = 0;
+    bool eof = false;
+    while (true) {
+        if (!eof && end - start < params.maxSize) {
+            // Refill behind what is left, so a cut always sees maxSize bytes
+            memmove(buffer.data(), buffer.data() + start, end - start);
+            end -= start;
+            start = 0;
+            file.read(reinterpret_cast<char*>(buffer.data()) + end, (std::streamsize)(buffer.size() - end));
+            end += (size_t)file.gcount();
+            if (file.bad()) return false;
+            eof = !file;
+        }
+        if (start == end) break;
+        size_t length = chunker.cut(buffer.data() + start, end - start);
+        lengths.push_back((uint32_t)length);
+        start += length;
+    }
+    return true;
+}
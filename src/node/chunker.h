@@ -0,0 +1,74 @@
+#ifndef CHUNKER_H
+#define CHUNKER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "digest.h"
+
+// How files are cut into chunks when seeded.
+struct ChunkingParams {
+    bool contentDefined = false; // Fixed-size chunks otherwise
+    uint32_t minSize = 128 * 1024;
+    uint32_t avgSize = 512 * 1024;
+    uint32_t maxSize = 2 * 1024 * 1024;
+
+    // Sizes ordered min <= avg <= max, within what a peer accepts as one reply.
+    bool valid() const;
+};
+
+// Where each chunk of a file starts and ends. Fixed-size chunking is
+// described by the chunk size alone; content-defined chunking keeps every
+// boundary.
+class ChunkLayout {
+public:
+    // Whole chunks are sent as one reply, which PeerSession caps at 16MB.
+    static constexpr uint32_t MAX_LENGTH = 8 * 1024 * 1024;
+
+    ChunkLayout() = default;
+    static ChunkLayout fixed(uint64_t fileSize, uint32_t chunkSize);
+    // Fails (returns an empty layout) on a zero length or one over MAX_LENGTH.
+    static ChunkLayout variable(const std::vector<uint32_t>& lengths);
+
+    bool isFixed() const { return starts.empty(); }
+    uint32_t chunkSize() const { return fixedSize; } // 0 when variable
+    uint64_t fileSize() const { return size; }
+    uint32_t count() const;
+    // offset(count()) is the file size.
+    uint64_t offset(uint32_t index) const;
+    uint32_t length(uint32_t index) const;
+    uint32_t maxLength() const;
+    std::vector<uint32_t> lengths() const;
+
+private:
+    uint64_t size = 0;
+    uint32_t fixedSize = 0;
+    std::vector<uint64_t> starts; // count() + 1 entries when variable
+};
+
+// FastCDC: a gear rolling hash over each byte, cutting where the hash's top
+// bits are zero. Below the average size a stricter mask makes cuts rarer and
+// above it a looser one makes them likelier, which keeps sizes close to the
+// average. Boundaries depend only on nearby content, so an insert or delete
+// moves the chunks around it and leaves the rest, and their hashes, as they
+// were.
+class Chunker {
+public:
+    explicit Chunker(const ChunkingParams& params);
+
+    // Length of the chunk that starts at `data`. `size` must reach maxSize
+    // unless the file ends sooner.
+    size_t cut(const uint8_t* data, size_t size) const;
+
+    // The boundaries of a whole file; callers hash the chunks themselves,
+    // with the file's algorithm.
+    static bool cutFile(const std::string& path, const ChunkingParams& params, std::vector<uint32_t>& lengths);
+
+private:
+    ChunkingParams params;
+    uint64_t maskSmall; // Before avgSize
+    uint64_t maskLarge; // From avgSize on
+};
+
+#endif // CHUNKER_H
@@ -0,0 +1,172 @@
+#include "download_manager.h"
+#include "logger.h"
+#include <algorithm>
+#include <thread>
+
+const char* jobStateName(JobState s) {
+    switch (s) {
+        case JobState::QUEUED: return "queued";
+        case JobState::RUNNING: return "running";
+        case JobState::PAUSED: return "paused";
+        case JobState::DONE: return "done";
+        case JobState::FAILED: return "failed";
+    }
+    return "unknown";
+}
+
+void DownloadControl::requestStop() {
+    stop = true;
+    std::lock_guard<std::mutex> lock(interruptMutex);
+    if (interrupt) interrupt();
+}
+
+void DownloadControl::setInterrupt(std::function<void()> fn) {
+    std::lock_guard<std::mutex> lock(interruptMutex);
+    interrupt = std::move(fn);
+}
+
+DownloadManager::DownloadManager(Runner r, size_t maxActive, size_t maxConnections, uint64_t bytesPerSecond)
+    : runner(std::move(r)), maxActive_(std::max<size_t>(1, maxActive)), budget_(maxConnections, bytesPerSecond) {
+}
+
+DownloadManager::~DownloadManager() {
+    std::unique_lock<std::mutex> lock(mutex);
+    shuttingDown = true;
+    for (auto& [id, job] : jobs) {
+        if (job->state == JobState::RUNNING) job->control->requestStop();
+    }
+    jobEnded.wait(lock, [&] { return running == 0; });
+}
+
+uint32_t DownloadManager::add(const DownloadSpec& spec, int priority) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& [id, job] : jobs) {
+        if (job->spec.outputName == spec.outputName && job->state != JobState::DONE && job->state != JobState::FAILED) return 0;
+    }
+    auto job = std::make_shared<Job>();
+    job->id = nextId++;
+    job->spec = spec;
+    job->priority = std::clamp(priority, MIN_PRIORITY, MAX_PRIORITY);
+    job->control = std::make_shared<DownloadControl>(job->id, budget_);
+    jobs[job->id] = job;
+    schedule();
+    return job->id;
+}
+
+bool DownloadManager::pause(uint32_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(id);
+    if (it == jobs.end()) return false;
+    Job& job = *it->second;
+    if (job.state == JobState::QUEUED) {
+        job.state = JobState::PAUSED;
+        return true;
+    }
+    if (job.state != JobState::RUNNING) return false;
+    job.resumeWhenStopped = false;
+    job.control->requestStop();
+    return true;
+}
+
+bool DownloadManager::resume(uint32_t id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(id);
+    if (it == jobs.end()) return false;
+    Job& job = *it->second;
+    if (job.state == JobState::RUNNING) {
+        // Still winding down from a pause: queue it again once it has stopped
+        if (!job.control->stopRequested()) return false;
+        job.resumeWhenStopped = true;
+        return true;
+    }
+    if (job.state != JobState::PAUSED && job.state != JobState::FAILED) return false;
+    job.state = JobState::QUEUED;
+    schedule();
+    return true;
+}
+
+bool DownloadManager::setPriority(uint32_t id, int priority) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(id);
+    if (it == jobs.end()) return false;
+    Job& job = *it->second;
+    job.priority = std::clamp(priority, MIN_PRIORITY, MAX_PRIORITY);
+    if (job.state == JobState::RUNNING) budget_.setWeight(id, (uint32_t)job.priority);
+    schedule();
+    return true;
+}
+
+std::vector<DownloadJobInfo> DownloadManager::list() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<DownloadJobInfo> out;
+    for (const auto& [id, job] : jobs) out.push_back(infoOf(*job));
+    return out;
+}
+
+bool DownloadManager::find(uint32_t id, DownloadJobInfo& out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(id);
+    if (it == jobs.end()) return false;
+    out = infoOf(*it->second);
+    return true;
+}
+
+DownloadJobInfo DownloadManager::infoOf(const Job& job) const {
+    DownloadJobInfo info;
+    info.id = job.id;
+    info.fileHash = job.spec.fileHash;
+    info.outputName = job.spec.outputName;
+    info.priority = job.priority;
+    info.state = job.state;
+    info.stopping = job.state == JobState::RUNNING && job.control->stopRequested();
+    info.chunksDone = job.control->chunksDone;
+    info.chunksTotal = job.control->chunksTotal;
+    info.bytes = job.control->bytes;
+    info.saved = job.control->saved;
+    Clock::duration run = job.state == JobState::RUNNING ? Clock::now() - job.started : job.lastRun;
+    info.seconds = std::chrono::duration<double>(run).count();
+    return info;
+}
+
+void DownloadManager::schedule() {
+    while (!shuttingDown && running < maxActive_) {
+        std::shared_ptr<Job> next;
+        for (const auto& [id, job] : jobs) {
+            // Ids grow with age, so the first of equal priority is the oldest
+            if (job->state == JobState::QUEUED && (!next || job->priority > next->priority)) next = job;
+        }
+        if (!next) return;
+
+        next->state = JobState::RUNNING;
+        next->started = Clock::now();
+        next->control->clearStop();
+        next->control->bytes = 0;
+        next->control->saved = 0;
+        budget_.addJob(next->id, (uint32_t)next->priority);
+        running++;
+        std::thread(&DownloadManager::run, this, next).detach();
+    }
+}
+
+void DownloadManager::run(std::shared_ptr<Job> job) {
+    Logger::log("Job " + std::to_string(job->id) + " started: " + job->spec.fileHash.hex() + " -> " + job->spec.outputName);
+    bool complete = runner(job->spec, *job->control);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    budget_.removeJob(job->id);
+    running--;
+    job->lastRun = Clock::now() - job->started;
+    // Later runs continue from the sidecar instead of checking the file again
+    job->spec.recheck = false;
+    if (complete) {
+        job->state = JobState::DONE;
+    } else if (job->control->stopRequested() && !shuttingDown) {
+        job->state = job->resumeWhenStopped ? JobState::QUEUED : JobState::PAUSED;
+    } else {
+        job->state = JobState::FAILED;
+    }
+    job->resumeWhenStopped = false;
+    Logger::log("Job " + std::to_string(job->id) + " " + jobStateName(job->state));
+    schedule();
+    jobEnded.notify_all();
+}
@@ -0,0 +1,163 @@
+#ifndef DOWNLOAD_MANAGER_H
+#define DOWNLOAD_MANAGER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+#include "transfer_budget.h"
+#include "digest.h"
+
+enum class JobState {
+    QUEUED,  // Waiting for a free download slot
+    RUNNING,
+    PAUSED,  // Stopped by the user; progress is in the resume sidecar
+    DONE,
+    FAILED   // Ran out of peers or could not start; can be resumed
+};
+
+const char* jobStateName(JobState s);
+
+// Job priorities: higher starts first and gets a bigger share of the
+// connection budget.
+constexpr int MIN_PRIORITY = 1;
+constexpr int MAX_PRIORITY = 10;
+constexpr int DEFAULT_PRIORITY = 5;
+
+// Shared between the manager and the download running a job: the stop
+// request going in, progress coming out.
+class DownloadControl {
+public:
+    DownloadControl(uint32_t jobId, TransferBudget& budget) : id(jobId), budget_(budget) {}
+
+    uint32_t jobId() const { return id; }
+    TransferBudget& budget() { return budget_; }
+
+    bool stopRequested() const { return stop; }
+    // Asks the download to save its progress and return, waking any worker
+    // blocked on a socket.
+    void requestStop();
+    void clearStop() { stop = false; }
+    // Set by the running download; null once it no longer has workers.
+    void setInterrupt(std::function<void()> fn);
+
+    void setProgress(uint32_t done, uint32_t total) {
+        chunksDone = done;
+        chunksTotal = total;
+    }
+    void addBytes(uint64_t n) { bytes += n; }
+    void addSaved(uint64_t n) { saved += n; }
+
+    std::atomic<uint32_t> chunksDone{0};
+    std::atomic<uint32_t> chunksTotal{0};
+    std::atomic<uint64_t> bytes{0}; // Payload received in the current run
+    std::atomic<uint64_t> saved{0}; // Copied from local files instead, in the current run
+
+private:
+    uint32_t id;
+    TransferBudget& budget_;
+    std::atomic<bool> stop{false};
+    std::mutex interruptMutex;
+    std::function<void()> interrupt;
+};
+
+// Receives a streaming download's bytes in file order, as they are verified.
+// Every run of a job streams from the start again; `offset` lets a sink skip
+// what it already passed on. A call without data ends the run. Returning
+// false detaches the sink, and the download goes on without it.
+using StreamSink = std::function<bool(uint64_t offset, const char* data, size_t size)>;
+
+// What a download job fetches.
+struct DownloadSpec {
+    Digest fileHash;
+    std::string outputName;        // The file, or the root directory of a bundle
+    bool recheck = false;          // Verify what the output holds instead of trusting the sidecar
+    std::vector<std::string> only; // Bundle files and directories to fetch; empty fetches all
+    StreamSink stream;             // Set for a streaming download
+    std::string basis;             // Older local version to copy matching chunks from
+};
+
+struct DownloadJobInfo {
+    uint32_t id;
+    Digest fileHash;
+    std::string outputName;
+    int priority;
+    JobState state;
+    bool stopping;       // Pause requested, download still winding down
+    uint32_t chunksDone;
+    uint32_t chunksTotal;
+    uint64_t bytes;      // Received in the current or last run
+    uint64_t saved;      // Copied locally rather than fetched, same run
+    double seconds;      // Length of the current or last run
+};
+
+// Runs downloads as background jobs. At most `maxActive` run at once, picked
+// by priority and then age; the rest wait in the queue. Running jobs share
+// one TransferBudget. Pausing stops a job's download, which leaves a resume
+// sidecar behind, so resuming simply queues the job again.
+class DownloadManager {
+public:
+    // Downloads one file or bundle until it is complete (returns true),
+    // fails, or `control` asks it to stop.
+    using Runner = std::function<bool(const DownloadSpec& spec, DownloadControl& control)>;
+
+    DownloadManager(Runner runner, size_t maxActive, size_t maxConnections, uint64_t bytesPerSecond);
+    // Stops running jobs and waits for them.
+    ~DownloadManager();
+
+    DownloadManager(const DownloadManager&) = delete;
+    DownloadManager& operator=(const DownloadManager&) = delete;
+
+    // Returns the new job's id, or 0 if an unfinished job already writes
+    // to the same output.
+    uint32_t add(const DownloadSpec& spec, int priority = DEFAULT_PRIORITY);
+    // A queued job is parked; a running one is stopped and parked once its
+    // download has saved its progress. False for finished or unknown jobs.
+    bool pause(uint32_t id);
+    // Queues a paused or failed job again.
+    bool resume(uint32_t id);
+    bool setPriority(uint32_t id, int priority);
+
+    std::vector<DownloadJobInfo> list() const;
+    bool find(uint32_t id, DownloadJobInfo& out) const;
+
+    size_t maxActive() const { return maxActive_; }
+    TransferBudget& budget() { return budget_; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Job {
+        uint32_t id;
+        DownloadSpec spec;
+        int priority;
+        JobState state = JobState::QUEUED;
+        bool resumeWhenStopped = false;
+        std::shared_ptr<DownloadControl> control;
+        Clock::time_point started;
+        Clock::duration lastRun{0};
+    };
+
+    void schedule(); // Caller holds the mutex
+    void run(std::shared_ptr<Job> job);
+    DownloadJobInfo infoOf(const Job& job) const;
+
+    Runner runner;
+    size_t maxActive_;
+    TransferBudget budget_;
+
+    mutable std::mutex mutex;
+    std::condition_variable jobEnded;
+    std::map<uint32_t, std::shared_ptr<Job>> jobs;
+    uint32_t nextId = 1;
+    size_t running = 0;
+    bool shuttingDown = false;
+};
+
+#endif // DOWNLOAD_MANAGER_H
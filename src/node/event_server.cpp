@@ -0,0 +1,361 @@
+#include "event_server.h"
+#include "logger.h"
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#endif
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1u << 28)
+#endif
+
+// Stop reading from a connection while this much reply data is queued,
+// resume once it drains below the low watermark.
+constexpr size_t OUT_HIGH_WATERMARK = 4 * 1024 * 1024;
+constexpr size_t OUT_LOW_WATERMARK = 1024 * 1024;
+constexpr int MAX_EVENTS = 64;
+
+EventServer::EventServer(SocketType sock, int threads, Handler h, ServeStats* st)
+    : listenSock(sock), ioThreads(threads > 0 ? threads : 1), handler(std::move(h)), stats(st), running(false) {
+}
+
+EventServer::~EventServer() {
+    stop();
+}
+
+#ifdef __linux__
+
+static bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+// Closes the descriptors of workers whose threads never started.
+static void closeWorkerFds(int epfd, int wakeFd) {
+    if (wakeFd != -1) close(wakeFd);
+    if (epfd != -1) close(epfd);
+}
+
+bool EventServer::start() {
+    // Everything that can fail comes before the listener is made
+    // non-blocking, so a failed start leaves it as the fallback loop needs it
+    for (int i = 0; i < ioThreads; ++i) {
+        auto w = std::make_unique<Worker>();
+        w->epfd = epoll_create1(EPOLL_CLOEXEC);
+        w->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        workers.push_back(std::move(w));
+        if (workers.back()->epfd == -1 || workers.back()->wakeFd == -1) {
+            Logger::error("Failed to create epoll instance");
+            for (auto& created : workers) closeWorkerFds(created->epfd, created->wakeFd);
+            workers.clear();
+            return false;
+        }
+    }
+    if (!setNonBlocking(listenSock)) {
+        Logger::error("Failed to make peer listen socket non-blocking");
+        for (auto& created : workers) closeWorkerFds(created->epfd, created->wakeFd);
+        workers.clear();
+        return false;
+    }
+
+    for (auto& w : workers) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = w->wakeFd;
+        epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->wakeFd, &ev);
+
+        // Every worker waits on the listener; EPOLLEXCLUSIVE wakes only one.
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.fd = listenSock;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, listenSock, &ev) == -1) {
+            ev.events = EPOLLIN;
+            epoll_ctl(w->epfd, EPOLL_CTL_ADD, listenSock, &ev);
+        }
+    }
+
+    running = true;
+    for (auto& w : workers) {
+        Worker* wp = w.get();
+        w->thread = std::thread([this, wp]() { workerLoop(*wp); });
+    }
+    Logger::log("Event server started with " + std::to_string(ioThreads) + " I/O threads");
+    return true;
+}
+
+void EventServer::stop() {
+    if (!running.exchange(false)) return;
+    for (auto& w : workers) {
+        uint64_t one = 1;
+        ssize_t n = write(w->wakeFd, &one, sizeof(one));
+        (void)n;
+    }
+    for (auto& w : workers) {
+        if (w->thread.joinable()) w->thread.join();
+        for (auto& [fd, conn] : w->conns) close(fd);
+        w->conns.clear();
+        close(w->wakeFd);
+        close(w->epfd);
+    }
+    workers.clear();
+}
+
+void EventServer::workerLoop(Worker& w) {
+    epoll_event events[MAX_EVENTS];
+    while (running) {
+        int n = epoll_wait(w.epfd, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            Logger::error("epoll_wait failed: " + std::string(strerror(errno)));
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == w.wakeFd) continue;
+            if (fd == listenSock) {
+                acceptAll(w);
+                continue;
+            }
+
+            auto it = w.conns.find(fd);
+            if (it == w.conns.end()) continue;
+            Connection& c = *it->second;
+
+            uint32_t evs = events[i].events;
+            bool wasPaused = c.readPaused;
+            bool ok = !(evs & EPOLLERR);
+            if (ok && (evs & EPOLLOUT)) ok = onWritable(w, c);
+            // Draining below the low watermark re-enables reads; frames may already be buffered.
+            bool resumed = wasPaused && !c.readPaused;
+            if (ok && (evs & EPOLLHUP) && c.readPaused) ok = false;
+            if (ok && ((evs & (EPOLLIN | EPOLLHUP)) || resumed)) ok = onReadable(w, c);
+            if (!ok) closeConnection(w, fd);
+        }
+    }
+}
+
+void EventServer::acceptAll(Worker& w) {
+    while (true) {
+        sockaddr_in addr{};
+        socklen_t len = sizeof(addr);
+        int fd = accept4(listenSock, (sockaddr*)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK && running) {
+                Logger::error("Accept failed: " + std::string(strerror(errno)));
+            }
+            return;
+        }
+
+        char ipStr[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &addr.sin_addr, ipStr, INET_ADDRSTRLEN);
+
+        auto conn = std::make_unique<Connection>();
+        conn->fd = fd;
+        conn->ip = ipStr;
+        conn->inBuf.resize(sizeof(PacketHeader));
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(w.epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            close(fd);
+            continue;
+        }
+        w.conns[fd] = std::move(conn);
+    }
+}
+
+bool EventServer::onReadable(Worker& w, Connection& c) {
+    while (!c.readPaused) {
+        size_t have = c.inBuf.size() - c.inNeeded;
+        ssize_t n = recv(c.fd, c.inBuf.data() + have, c.inNeeded, 0);
+        if (n == 0) return false;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        c.inNeeded -= (size_t)n;
+        if (c.inNeeded > 0) continue;
+
+        if (c.state == ReadState::HEADER) {
+            memcpy(&c.header, c.inBuf.data(), sizeof(PacketHeader));
+            if (c.header.length > MAX_REQUEST_BODY) {
+                Logger::error("Oversized request from " + c.ip);
+                return false;
+            }
+            c.state = ReadState::BODY;
+            c.inBuf.assign(c.header.length, 0);
+            c.inNeeded = c.header.length;
+            if (c.inNeeded > 0) continue;
+        }
+
+        if (!dispatch(c)) return false;
+        c.state = ReadState::HEADER;
+        c.inBuf.assign(sizeof(PacketHeader), 0);
+        c.inNeeded = sizeof(PacketHeader);
+
+        if (!onWritable(w, c)) return false;
+    }
+    return true;
+}
+
+bool EventServer::dispatch(Connection& c) {
+    PeerReply reply;
+    if (!handler(c.header, c.inBuf, c.ip, c.session, reply)) return false;
+    if (!c.session.cancels.empty()) applyCancels(c);
+    if (reply.totalSize() > 0) {
+        stats->copiedBytes += reply.bodySize();
+        stats->zeroCopyBytes += reply.fileLength;
+        c.outBytes += reply.totalSize();
+        c.outQueue.push_back(std::move(reply));
+    }
+    return true;
+}
+
+// Drops the payload of queued SEND_BLOCK replies the peer cancelled. The
+// reply at the front may already be partly on the wire and is left alone.
+void EventServer::applyCancels(Connection& c) {
+    for (const std::string& key : c.session.cancels) {
+        auto it = c.outQueue.begin();
+        if (it != c.outQueue.end() && c.outOffset > 0) ++it;
+        for (; it != c.outQueue.end(); ++it) {
+            if (it->cancelKey != key) continue;
+            size_t before = it->totalSize();
+            stats->copiedBytes -= it->bodySize();
+            stats->zeroCopyBytes -= it->fileLength;
+            it->head.resize(it->keepOnCancel);
+            it->setBody(nullptr);
+            it->file.reset();
+            it->fileLength = 0;
+            it->cancelKey.clear();
+            c.outBytes -= before - it->totalSize();
+            stats->cancelledReplies++;
+            if (it->totalSize() == 0) c.outQueue.erase(it);
+            break;
+        }
+    }
+    c.session.cancels.clear();
+}
+
+bool EventServer::onWritable(Worker& w, Connection& c) {
+    bool ok = true;
+    while (ok && !c.outQueue.empty()) {
+        size_t before = c.outBytes;
+        ok = (c.outOffset < c.outQueue.front().inlineSize()) ? sendInline(c) : sendFileRange(c);
+        if (c.outBytes == before) break; // Socket buffer full
+    }
+    if (ok) updateInterest(w, c);
+    return ok;
+}
+
+// Advances the queue past `sent` bytes of the front reply and beyond.
+static void consumeReplies(std::deque<PeerReply>& queue, size_t& offset, size_t sent) {
+    while (!queue.empty()) {
+        size_t left = queue.front().totalSize() - offset;
+        if (sent < left) {
+            offset += sent;
+            return;
+        }
+        sent -= left;
+        queue.pop_front();
+        offset = 0;
+    }
+}
+
+// Gathers the in-memory parts of queued replies into one sendmsg. A reply
+// with a file range ends the batch, since its payload must follow its header.
+bool EventServer::sendInline(Connection& c) {
+    iovec iov[32];
+    int cnt = 0;
+    size_t skip = c.outOffset;
+    for (auto it = c.outQueue.begin(); it != c.outQueue.end() && cnt < 31; ++it) {
+        IoSlice parts[2] = { { it->head.data(), it->head.size() }, { it->bodyData(), it->bodySize() } };
+        for (const IoSlice& part : parts) {
+            if (skip >= part.size) {
+                skip -= part.size;
+                continue;
+            }
+            iov[cnt].iov_base = (char*)part.data + skip;
+            iov[cnt].iov_len = part.size - skip;
+            skip = 0;
+            ++cnt;
+        }
+        if (it->fileLength > 0) break;
+    }
+
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = cnt;
+    ssize_t n;
+    do {
+        n = sendmsg(c.fd, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+
+    c.outBytes -= (size_t)n;
+    consumeReplies(c.outQueue, c.outOffset, (size_t)n);
+    return true;
+}
+
+bool EventServer::sendFileRange(Connection& c) {
+    PeerReply& r = c.outQueue.front();
+    size_t done = c.outOffset - r.inlineSize();
+    size_t left = r.fileLength - done;
+
+    long long n = SocketUtils::sendFile(c.fd, r.file->fd(), r.fileOffset + done, left);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+    if (n <= 0) {
+        if (n < 0 && errno != EINVAL && errno != ENOSYS) return false;
+        // sendfile cannot serve this descriptor: copy the rest through user space.
+        std::vector<char> rest(left);
+        if (!FileUtils::readAt(r.file->fd(), rest.data(), left, r.fileOffset + done)) return false;
+        stats->zeroCopyBytes -= left;
+        stats->copiedBytes += left;
+        r.head.clear();
+        r.setBody(std::make_shared<const std::vector<char>>(std::move(rest)));
+        r.file.reset();
+        r.fileLength = 0;
+        c.outOffset = 0;
+        return true;
+    }
+
+    c.outBytes -= (size_t)n;
+    consumeReplies(c.outQueue, c.outOffset, (size_t)n);
+    return true;
+}
+
+void EventServer::updateInterest(Worker& w, Connection& c) {
+    if (c.outBytes >= OUT_HIGH_WATERMARK) c.readPaused = true;
+    else if (c.outBytes <= OUT_LOW_WATERMARK) c.readPaused = false;
+
+    epoll_event ev{};
+    ev.events = 0;
+    if (!c.readPaused) ev.events |= EPOLLIN;
+    if (!c.outQueue.empty()) ev.events |= EPOLLOUT;
+    ev.data.fd = c.fd;
+    epoll_ctl(w.epfd, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+void EventServer::closeConnection(Worker& w, int fd) {
+    epoll_ctl(w.epfd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    w.conns.erase(fd);
+}
+
+#else // !__linux__
+
+bool EventServer::start() {
+    Logger::error("Event server requires epoll (Linux)");
+    return false;
+}
+
+void EventServer::stop() {
+    running = false;
+}
+
+#endif
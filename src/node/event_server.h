@@ -0,0 +1,80 @@
+#ifndef EVENT_SERVER_H
+#define EVENT_SERVER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include "socket_utils.h"
+#include "protocol.h"
+#include "peer_reply.h"
+
+// Non-blocking, epoll-driven server for peer connections.
+// A fixed pool of I/O threads each own an epoll instance and a share of the
+// connections. Every connection runs a small state machine that reassembles
+// PacketHeader frames and hands complete requests to the handler.
+// Linux only; start() returns false elsewhere so the caller can fall back.
+class EventServer {
+public:
+    // Returns false to drop the connection. An empty reply sends nothing.
+    using Handler = std::function<bool(const PacketHeader& header,
+                                       const std::vector<char>& body,
+                                       const std::string& clientIp,
+                                       ServeSession& session,
+                                       PeerReply& reply)>;
+
+    EventServer(SocketType listenSock, int ioThreads, Handler handler, ServeStats* stats);
+    ~EventServer();
+
+    bool start();
+    void stop();
+
+private:
+    enum class ReadState { HEADER, BODY };
+
+    struct Connection {
+        int fd;
+        std::string ip;
+        ReadState state = ReadState::HEADER;
+        PacketHeader header{};
+        std::vector<char> inBuf;        // Bytes of the frame being assembled
+        size_t inNeeded = sizeof(PacketHeader);
+        std::deque<PeerReply> outQueue;
+        size_t outOffset = 0;           // Sent bytes of outQueue.front()
+        size_t outBytes = 0;            // Total unsent bytes
+        bool readPaused = false;        // Back-pressure: EPOLLIN disabled
+        ServeSession session;
+    };
+
+    struct Worker {
+        int epfd = -1;
+        int wakeFd = -1;
+        std::thread thread;
+        std::unordered_map<int, std::unique_ptr<Connection>> conns;
+    };
+
+    void workerLoop(Worker& w);
+    void acceptAll(Worker& w);
+    bool onReadable(Worker& w, Connection& c);
+    bool onWritable(Worker& w, Connection& c);
+    bool sendInline(Connection& c);
+    bool sendFileRange(Connection& c);
+    bool dispatch(Connection& c);
+    void applyCancels(Connection& c);
+    void updateInterest(Worker& w, Connection& c);
+    void closeConnection(Worker& w, int fd);
+
+    SocketType listenSock;
+    int ioThreads;
+    Handler handler;
+    ServeStats* stats;
+    std::atomic<bool> running;
+    std::vector<std::unique_ptr<Worker>> workers;
+};
+
+#endif // EVENT_SERVER_H
@@ -0,0 +1,46 @@
+#include "file_cache.h"
+
+FileCache::FileCache(size_t cap) : capacity(cap > 0 ? cap : 1) {
+}
+
+std::shared_ptr<FileHandle> FileCache::acquire(const Digest& fileHash, uint32_t part, const std::string& path) {
+    Key key{fileHash, part};
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end() && it->second.path == path) {
+            lru.splice(lru.begin(), lru, it->second.lruPos);
+            ++hits_;
+            return it->second.handle;
+        }
+    }
+
+    // Open outside the lock so a slow filesystem does not stall other readers.
+    ++misses_;
+    std::shared_ptr<FileHandle> handle = FileUtils::openRead(path);
+    if (!handle) return nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+        if (it->second.path == path) return it->second.handle; // Lost the race
+        lru.erase(it->second.lruPos);
+        entries.erase(it);
+    }
+
+    lru.push_front(key);
+    entries[key] = Entry{path, handle, lru.begin()};
+    while (entries.size() > capacity) {
+        entries.erase(lru.back());
+        lru.pop_back();
+    }
+    return handle;
+}
+
+void FileCache::invalidate(const Digest& fileHash, uint32_t part) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(Key{fileHash, part});
+    if (it == entries.end()) return;
+    lru.erase(it->second.lruPos);
+    entries.erase(it);
+}
@@ -0,0 +1,52 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include "file_utils.h"
+#include "digest.h"
+
+// LRU cache of open read-only descriptors, keyed by file hash and, for the
+// files of a bundle, the file's index plus one (0 for a single file).
+// Handles are shared between server threads, which only read through
+// FileUtils::readAt. An evicted descriptor stays open until the last
+// reader releases it, so positional reads never race with eviction.
+class FileCache {
+public:
+    explicit FileCache(size_t capacity);
+
+    // Returns the cached descriptor, opening `path` on a miss.
+    std::shared_ptr<FileHandle> acquire(const Digest& fileHash, uint32_t part, const std::string& path);
+    void invalidate(const Digest& fileHash, uint32_t part = 0);
+
+    uint64_t hits() const { return hits_; }
+    uint64_t misses() const { return misses_; }
+
+private:
+    struct Key {
+        Digest fileHash;
+        uint32_t part;
+        bool operator==(const Key& other) const { return part == other.part && fileHash == other.fileHash; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& k) const { return std::hash<Digest>()(k.fileHash) ^ k.part; }
+    };
+    struct Entry {
+        std::string path;
+        std::shared_ptr<FileHandle> handle;
+        std::list<Key>::iterator lruPos;
+    };
+
+    size_t capacity;
+    std::mutex mutex;
+    std::list<Key> lru; // Most recently used first
+    std::unordered_map<Key, Entry, KeyHash> entries;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+};
+
+#endif // FILE_CACHE_H
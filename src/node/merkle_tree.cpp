@@ -0,0 +1,139 @@
+#include "merkle_tree.h"
+#include "sha256.h"
+#include <algorithm>
+#include <cstring>
+
+// Tag hashed in front of a Merkle identity, so it can never equal the plain
+// SHA-256 of some file.
+constexpr char MERKLE_TAG[8] = { 'P', 'W', 'M', 'E', 'R', 'K', 'L', '1' };
+
+static Digest parent(const Digest& left, const Digest& right) {
+    uint8_t pair[2 * Digest::SIZE];
+    memcpy(pair, left.data(), Digest::SIZE);
+    memcpy(pair + Digest::SIZE, right.data(), Digest::SIZE);
+    return SHA256::digest(pair, sizeof(pair));
+}
+
+static std::vector<Digest> levelUp(const std::vector<Digest>& level) {
+    std::vector<Digest> up;
+    up.reserve((level.size() + 1) / 2);
+    for (size_t i = 0; i + 1 < level.size(); i += 2) up.push_back(parent(level[i], level[i + 1]));
+    if (level.size() % 2) up.push_back(level.back());
+    return up;
+}
+
+// Every span but the last is full, so its subtree pairs up exactly as it
+// does inside the whole tree.
+static Digest subtreeRoot(const Digest* leaves, size_t count) {
+    std::vector<Digest> level(leaves, leaves + count);
+    while (level.size() > 1) level = levelUp(level);
+    return level.empty() ? Digest() : level[0];
+}
+
+MerkleTree::MerkleTree(const std::vector<Digest>& hashes) : leaves((uint32_t)hashes.size()) {
+    std::vector<Digest> spanRoots;
+    for (uint32_t s = 0; s < spanCount(leaves); ++s) {
+        spanRoots.push_back(subtreeRoot(hashes.data() + (size_t)s * SPAN, spanLength(leaves, s)));
+    }
+    if (spanRoots.empty()) return;
+    levels.assign(1, std::move(spanRoots));
+    while (levels.back().size() > 1) levels.push_back(levelUp(levels.back()));
+}
+
+std::vector<Digest> MerkleTree::proof(uint32_t span) const {
+    std::vector<Digest> siblings;
+    size_t index = span;
+    for (size_t l = 0; l + 1 < levels.size(); ++l, index /= 2) {
+        size_t sibling = index ^ 1;
+        if (sibling < levels[l].size()) siblings.push_back(levels[l][sibling]);
+    }
+    return siblings;
+}
+
+uint32_t MerkleTree::spanLength(uint32_t leafCount, uint32_t span) {
+    uint64_t start = (uint64_t)span * SPAN;
+    return start >= leafCount ? 0 : (uint32_t)std::min<uint64_t>(SPAN, leafCount - start);
+}
+
+Digest MerkleTree::identity(uint64_t fileSize, uint32_t chunkSize, const Digest& root, HashAlgorithm algorithm) {
+    uint8_t buf[sizeof(MERKLE_TAG) + sizeof(fileSize) + sizeof(chunkSize) + Digest::SIZE + sizeof(algorithm)];
+    uint8_t* p = buf;
+    memcpy(p, MERKLE_TAG, sizeof(MERKLE_TAG));
+    p += sizeof(MERKLE_TAG);
+    memcpy(p, &fileSize, sizeof(fileSize));
+    p += sizeof(fileSize);
+    memcpy(p, &chunkSize, sizeof(chunkSize));
+    p += sizeof(chunkSize);
+    memcpy(p, root.data(), Digest::SIZE);
+    p += Digest::SIZE;
+    // SHA-256 leaves add nothing, so identities from before BLAKE3 still hold
+    if (algorithm != HashAlgorithm::SHA256) *p++ = (uint8_t)algorithm;
+    return SHA256::digest(buf, (size_t)(p - buf));
+}
+
+bool MerkleTree::verify(const Digest& root, uint32_t leafCount, uint32_t span, const std::vector<Digest>& hashes,
+                        const std::vector<Digest>& proof) {
+    uint32_t length = spanLength(leafCount, span);
+    if (length == 0 || hashes.size() != length) return false;
+    Digest node = subtreeRoot(hashes.data(), hashes.size());
+    size_t used = 0;
+    size_t index = span;
+    // Climbs the levels above the span roots; the last node of an odd-sized
+    // level has no sibling and moves up as it is
+    for (size_t width = spanCount(leafCount); width > 1; width = (width + 1) / 2, index /= 2) {
+        size_t sibling = index ^ 1;
+        if (sibling >= width) continue;
+        if (used == proof.size()) return false;
+        node = index % 2 ? parent(proof[used], node) : parent(node, proof[used]);
+        ++used;
+    }
+    return used == proof.size() && node == root;
+}
+
+MerkleHashes::MerkleHashes(const Digest& root, uint32_t leafCount, size_t maxSpans, FetchFn fetch)
+    : root_(root), leafCount_(leafCount), maxSpans(std::max<size_t>(maxSpans, 1)), fetch(std::move(fetch)) {}
+
+bool MerkleHashes::get(uint32_t index, Digest& out) {
+    if (index >= leafCount_) return false;
+    uint32_t span = index / MerkleTree::SPAN;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = spans.find(span);
+    if (it == spans.end()) {
+        Entry entry;
+        if (!fetch(span, entry.hashes, entry.proof) ||
+            !MerkleTree::verify(root_, leafCount_, span, entry.hashes, entry.proof)) {
+            return false;
+        }
+        ++fetched;
+        if (spans.size() >= maxSpans) {
+            spans.erase(recent.back());
+            recent.pop_back();
+        }
+        recent.push_front(span);
+        entry.position = recent.begin();
+        it = spans.emplace(span, std::move(entry)).first;
+    } else {
+        recent.splice(recent.begin(), recent, it->second.position);
+    }
+    out = it->second.hashes[index % MerkleTree::SPAN];
+    return true;
+}
+
+bool MerkleHashes::cached(uint32_t index) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return spans.count(index / MerkleTree::SPAN) > 0;
+}
+
+bool MerkleHashes::span(uint32_t span, std::vector<Digest>& hashes, std::vector<Digest>& proof) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = spans.find(span);
+    if (it == spans.end()) return false;
+    hashes = it->second.hashes;
+    proof = it->second.proof;
+    return true;
+}
+
+uint64_t MerkleHashes::spansFetched() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return fetched;
+}
@@ -0,0 +1,92 @@
+#ifndef MERKLE_TREE_H
+#define MERKLE_TREE_H
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include "digest.h"
+#include "hasher.h"
+
+// A binary hash tree over a file's chunk hashes. The leaves are the chunk
+// hashes, a parent is SHA-256(left || right), and a node left without a
+// sibling moves up a level unchanged. Leaves are grouped into spans of SPAN
+// consecutive chunks, each a subtree of its own: a downloader fetches one
+// span's hashes with the few sibling hashes that link the span to the root,
+// and so never needs, or has to trust, the whole list.
+//
+// The seeder keeps only the levels from the span roots up; the leaves stay
+// in the file's chunk hash list.
+class MerkleTree {
+public:
+    static constexpr uint32_t SPAN = 1024;
+
+    MerkleTree() = default;
+    explicit MerkleTree(const std::vector<Digest>& leaves);
+
+    const Digest& root() const { return levels.back()[0]; }
+    uint32_t leafCount() const { return leaves; }
+    // Siblings linking span `span` to the root, lowest level first.
+    std::vector<Digest> proof(uint32_t span) const;
+
+    static uint32_t spanCount(uint32_t leafCount) { return (leafCount + SPAN - 1) / SPAN; }
+    // Chunks in span `span` of a tree of `leafCount` leaves.
+    static uint32_t spanLength(uint32_t leafCount, uint32_t span);
+    // What a Merkle file is known by: the root bound to the file size, chunk
+    // size and the algorithm of the leaves, so that no other tree shape or
+    // chunk hash can claim the same identity.
+    static Digest identity(uint64_t fileSize, uint32_t chunkSize, const Digest& root,
+                           HashAlgorithm algorithm = HashAlgorithm::SHA256);
+    // True if `hashes` are all of span `span` of the tree with `root` and
+    // `leafCount` leaves, as `proof` shows.
+    static bool verify(const Digest& root, uint32_t leafCount, uint32_t span, const std::vector<Digest>& hashes,
+                       const std::vector<Digest>& proof);
+
+private:
+    uint32_t leaves = 0;
+    std::vector<std::vector<Digest>> levels{{Digest()}}; // Span roots first, the root last
+};
+
+// A downloader's view of a Merkle file: the root, and the most recently used
+// spans of chunk hashes with their proofs. Missing spans are fetched when a
+// chunk needs its hash and checked against the root before use, so memory
+// stays at `maxSpans` spans however large the file. Thread-safe.
+class MerkleHashes {
+public:
+    // Asks peers for span `span`. False if none sent one.
+    using FetchFn = std::function<bool(uint32_t span, std::vector<Digest>& hashes, std::vector<Digest>& proof)>;
+
+    MerkleHashes(const Digest& root, uint32_t leafCount, size_t maxSpans, FetchFn fetch);
+
+    const Digest& root() const { return root_; }
+    uint32_t leafCount() const { return leafCount_; }
+    // The hash of chunk `index`, fetching its span if needed. False if no
+    // peer sent a span that checks out.
+    bool get(uint32_t index, Digest& out);
+    // True if chunk `index`'s hash is at hand without fetching.
+    bool cached(uint32_t index) const;
+    // A cached span and its proof, for passing on to other peers.
+    bool span(uint32_t span, std::vector<Digest>& hashes, std::vector<Digest>& proof) const;
+    uint64_t spansFetched() const;
+
+private:
+    struct Entry {
+        std::vector<Digest> hashes;
+        std::vector<Digest> proof;
+        std::list<uint32_t>::iterator position;
+    };
+
+    Digest root_;
+    uint32_t leafCount_;
+    size_t maxSpans;
+    FetchFn fetch;
+    mutable std::mutex mutex; // Also held while fetching, so a span is fetched once
+    std::unordered_map<uint32_t, Entry> spans;
+    std::list<uint32_t> recent; // Most recently used first
+    uint64_t fetched = 0;
+};
+
+#endif // MERKLE_TREE_H
@@ -0,0 +1,86 @@
+#include "output_file.h"
+#include "logger.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+
+#ifdef _WIN32
+    #include <io.h>
+    #include <sys/stat.h>
+#else
+    #include <unistd.h>
+    #include <sys/stat.h>
+#endif
+
+std::unique_ptr<OutputFile> OutputFile::open(const std::string& path, uint64_t fileSize) {
+#ifdef _WIN32
+    int fd = _open(path.c_str(), _O_RDWR | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+    if (fd < 0) return nullptr;
+    if (_chsize_s(fd, (__int64)fileSize) != 0) {
+        _close(fd);
+        return nullptr;
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return nullptr;
+
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    // Leftovers past the end would otherwise survive in the finished file
+    if (ok && (uint64_t)st.st_size > fileSize) ok = ftruncate(fd, (off_t)fileSize) == 0;
+#ifdef __linux__
+    // Reserve real blocks; keeps existing data, only fills the holes
+    if (ok && fileSize > 0 && fallocate(fd, 0, 0, (off_t)fileSize) != 0) {
+        if (errno != EOPNOTSUPP && errno != ENOSYS) {
+            Logger::error("Cannot preallocate " + path + ": " + strerror(errno));
+            ok = false;
+        }
+    }
+#endif
+    // Sparse fallback where blocks could not be reserved
+    if (ok && (fstat(fd, &st) != 0 || (uint64_t)st.st_size < fileSize)) ok = ftruncate(fd, (off_t)fileSize) == 0;
+    if (!ok) {
+        close(fd);
+        return nullptr;
+    }
+#endif
+    return std::unique_ptr<OutputFile>(new OutputFile(path, fd));
+}
+
+OutputFile::~OutputFile() {
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+bool OutputFile::writeAt(uint64_t offset, const void* data, size_t size) {
+    const char* ptr = static_cast<const char*>(data);
+    size_t total = 0;
+#ifdef _WIN32
+    std::lock_guard<std::mutex> lock(seekMutex);
+#endif
+    while (total < size) {
+#ifdef _WIN32
+        if (_lseeki64(fd, (__int64)(offset + total), SEEK_SET) < 0) return false;
+        int n = _write(fd, ptr + total, (unsigned int)(size - total));
+#else
+        ssize_t n = pwrite(fd, ptr + total, size - total, (off_t)(offset + total));
+        if (n < 0 && errno == EINTR) continue;
+#endif
+        if (n <= 0) return false;
+        total += (size_t)n;
+    }
+    return true;
+}
+
+bool OutputFile::sync() {
+#ifdef _WIN32
+    return _commit(fd) == 0;
+#elif defined(__linux__)
+    return fdatasync(fd) == 0;
+#else
+    return fsync(fd) == 0;
+#endif
+}
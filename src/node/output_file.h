@@ -0,0 +1,40 @@
+#ifndef OUTPUT_FILE_H
+#define OUTPUT_FILE_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+// A download's output file, opened once for the whole download. The full
+// size is reserved up front (fallocate where the filesystem supports it, a
+// sparse resize otherwise), so chunks land in place instead of extending the
+// file out of order. Chunks are written with pwrite at their own offsets and
+// need no lock; sync() makes everything written so far durable and is meant
+// to be called in batches, not per chunk.
+class OutputFile {
+public:
+    // Opens or creates `path` without truncating data already in it (resumed
+    // downloads), and sizes it to `fileSize`. Returns nullptr on failure.
+    static std::unique_ptr<OutputFile> open(const std::string& path, uint64_t fileSize);
+    ~OutputFile();
+
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+
+    bool writeAt(uint64_t offset, const void* data, size_t size);
+    bool sync();
+
+    const std::string& path() const { return path_; }
+
+private:
+    OutputFile(const std::string& path, int fd) : path_(path), fd(fd) {}
+
+    std::string path_;
+    int fd;
+#ifdef _WIN32
+    std::mutex seekMutex; // No pwrite: seek and write must not interleave
+#endif
+};
+
+#endif // OUTPUT_FILE_H
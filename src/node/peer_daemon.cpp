@@ -2,13 +2,24 @@
 #include "ipc_server.h"
 #include "socket_utils.h"
 #include "logger.h"
+#include "sha256.h"
+#include "blake3.h"
+#include "hasher.h"
 #include <iostream>
 #include <string>
 #include <thread>
 #include <chrono>
+#include <cstdio>
+#ifndef _WIN32
+#include <csignal>
+#endif
 
 int main(int argc, char* argv[]) {
     if (!SocketUtils::init()) return 1;
+#ifndef _WIN32
+    // Peers may hang up mid-pipeline; a failed send must not kill the daemon.
+    signal(SIGPIPE, SIG_IGN);
+#endif
 
     // Default configuration (or from argv)
     // Daemon usually runs on fixed ports or from config
@@ -17,12 +28,89 @@ int main(int argc, char* argv[]) {
     // Let's assume we start the daemon with: ./peer_daemon <MyP2PPort> <ControlPort>
     
     if (argc < 3) {
-        std::cout << "Usage: peer_daemon <P2P_PORT> <CONTROL_PORT>" << std::endl;
+        std::cout << "Usage: peer_daemon <P2P_PORT> <CONTROL_PORT> [--serve=threads|epoll] [--io-threads=N] [--pipeline=N] [--block-size=KB] [--endgame=N] [--hash-threads=N]"
+                  << " [--max-downloads=N] [--max-connections=N] [--max-rate=KB] [--ban-threshold=N] [--stream-window=N]"
+                  << " [--chunking=fixed|cdc[:MIN,AVG,MAX KB]] [--merkle] [--hash=sha256|blake3]"
+                  << " [--seed-index=PATH] [--zero-copy] [--fd-cache=N] [--chunk-cache=MB] [--cache-policy=lru|slru]" << std::endl;
         return 1;
     }
     
     int p2pPort = std::stoi(argv[1]);
     int controlPort = std::stoi(argv[2]);
+
+    NodeOptions options;
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--serve=epoll") {
+            options.serveMode = ServeMode::EPOLL;
+        } else if (arg == "--serve=threads") {
+            options.serveMode = ServeMode::THREADS;
+        } else if (arg.rfind("--io-threads=", 0) == 0) {
+            options.ioThreads = std::stoi(arg.substr(13));
+        } else if (arg == "--zero-copy") {
+            options.zeroCopy = true;
+        } else if (arg.rfind("--fd-cache=", 0) == 0) {
+            options.fdCacheSize = std::stoi(arg.substr(11));
+        } else if (arg.rfind("--chunk-cache=", 0) == 0) {
+            options.chunkCacheBytes = (size_t)std::stoul(arg.substr(14)) * 1024 * 1024;
+        } else if (arg == "--cache-policy=lru") {
+            options.cachePolicy = CachePolicy::LRU;
+        } else if (arg == "--cache-policy=slru") {
+            options.cachePolicy = CachePolicy::SLRU;
+        } else if (arg.rfind("--pipeline=", 0) == 0) {
+            options.pipelineDepth = std::stoi(arg.substr(11));
+        } else if (arg.rfind("--block-size=", 0) == 0) {
+            options.blockSize = (size_t)std::stoul(arg.substr(13)) * 1024;
+        } else if (arg.rfind("--endgame=", 0) == 0) {
+            options.endgameChunks = std::stoi(arg.substr(10));
+        } else if (arg.rfind("--hash-threads=", 0) == 0) {
+            options.hashThreads = std::stoi(arg.substr(15));
+        } else if (arg.rfind("--max-downloads=", 0) == 0) {
+            options.maxDownloads = std::stoi(arg.substr(16));
+        } else if (arg.rfind("--max-connections=", 0) == 0) {
+            options.maxConnections = std::stoi(arg.substr(18));
+        } else if (arg.rfind("--max-rate=", 0) == 0) {
+            options.maxDownloadRate = (uint64_t)std::stoull(arg.substr(11)) * 1024;
+        } else if (arg.rfind("--ban-threshold=", 0) == 0) {
+            options.banThreshold = std::stoi(arg.substr(16));
+        } else if (arg.rfind("--stream-window=", 0) == 0) {
+            options.streamWindow = std::stoi(arg.substr(16));
+        } else if (arg.rfind("--seed-index=", 0) == 0) {
+            options.seedIndex = arg.substr(13);
+        } else if (arg == "--merkle") {
+            options.merkle = true;
+        } else if (arg.rfind("--hash=", 0) == 0) {
+            if (!Hasher::parse(arg.substr(7), options.hash)) {
+                std::cout << "Expected --hash=sha256 or --hash=blake3" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--chunking=fixed") {
+            options.chunking.contentDefined = false;
+        } else if (arg.rfind("--chunking=cdc", 0) == 0) {
+            options.chunking.contentDefined = true;
+            if (arg.size() > 14) {
+                unsigned minKb = 0, avgKb = 0, maxKb = 0;
+                if (arg[14] != ':' || sscanf(arg.c_str() + 15, "%u,%u,%u", &minKb, &avgKb, &maxKb) != 3) {
+                    std::cout << "Expected --chunking=cdc:MIN,AVG,MAX in KB" << std::endl;
+                    return 1;
+                }
+                options.chunking.minSize = minKb * 1024;
+                options.chunking.avgSize = avgKb * 1024;
+                options.chunking.maxSize = maxKb * 1024;
+            }
+            if (!options.chunking.valid()) {
+                std::cout << "Chunk sizes must satisfy 4 <= MIN <= AVG <= MAX <= 8192 KB, MIN < MAX" << std::endl;
+                return 1;
+            }
+        } else {
+            std::cout << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (options.merkle && options.chunking.contentDefined) {
+        std::cout << "--merkle needs fixed-size chunks" << std::endl;
+        return 1;
+    }
     
     // Auto-calculate control port if not fixed? 
     // Simple: Fixed 9999 for single instance.
@@ -32,7 +120,10 @@ int main(int argc, char* argv[]) {
     int tPort = 8080;
     
     Logger::log("Starting Peer Daemon...");
-    PeerNode node(tIp, tPort, p2pPort);
+    Logger::log(std::string("SHA-256 backend: ") + SHA256::backendName(SHA256::backend()));
+    Logger::log(std::string("BLAKE3 backend: ") + Blake3::backendName(Blake3::backend()));
+    Logger::log(std::string("Seeding with ") + Hasher::name(options.hash));
+    PeerNode node(tIp, tPort, p2pPort, options);
     node.start();
     
     IPCServer ipc(controlPort, &node);
@@ -1,18 +1,133 @@
 #include "peer_node.h"
+#include "event_server.h"
+#include "peer_session.h"
+#include "piece_picker.h"
+#include "peer_rate.h"
+#include "resume_file.h"
+#include "output_file.h"
+#include "chunk_pipeline.h"
+#include "download_manager.h"
+#include "peer_reputation.h"
+#include "chunk_bitfield.h"
+#include "bundle.h"
 #include "logger.h"
 #include "sha256.h"
+#include "hasher.h"
 #include <fstream>
 #include <iostream>
 #include <filesystem>
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <cerrno>
+#include <sstream>
+#include <iomanip>
+#include <map>
+#include <random>
+#include <condition_variable>
 
 namespace fs = std::filesystem;
 
 constexpr size_t CHUNK_SIZE = 512 * 1024; // 512KB
+// Smallest block a download splits chunks into (--block-size)
+constexpr size_t MIN_BLOCK_SIZE = 16 * 1024;
 
-PeerNode::PeerNode(const std::string& tIp, int tPort, int mPort) 
-    : trackerIp(tIp), trackerPort(tPort), myPort(mPort), running(false) {
+// Largest bundle manifest a download accepts, about 2M files' worth.
+constexpr uint32_t MAX_MANIFEST_SIZE = 256 * 1024 * 1024;
+// Download workers: sessions opened per download, and how long an idle
+// worker waits for its peer to acquire chunks that are still missing.
+constexpr size_t MAX_DOWNLOAD_PEERS = 64;
+constexpr int MAX_IDLE_POLLS = 10;
+constexpr auto AVAILABILITY_POLL = std::chrono::milliseconds(500);
+// A peer with requests outstanding that delivers nothing for this long is dropped.
+constexpr auto STALL_TIMEOUT = std::chrono::seconds(10);
+// Failed chunks are retried after a backoff, whole and from one peer, up to
+// MAX_CHUNK_ATTEMPTS times. Peers that cannot be reached are retried the same way.
+constexpr auto CHUNK_RETRY_BASE = std::chrono::milliseconds(250);
+constexpr auto CHUNK_RETRY_MAX = std::chrono::seconds(8);
+constexpr uint32_t MAX_CHUNK_ATTEMPTS = 5;
+constexpr auto CONNECT_RETRY_BASE = std::chrono::milliseconds(500);
+constexpr auto CONNECT_RETRY_MAX = std::chrono::seconds(8);
+constexpr uint32_t MAX_CONNECT_ATTEMPTS = 5;
+constexpr auto RETRY_POLL = std::chrono::milliseconds(100);
+// How often a download syncs its output and rewrites the resume sidecar.
+constexpr auto RESUME_INTERVAL = std::chrono::seconds(2);
+// Chunks that may wait for verification (per verify thread) and for the disk.
+constexpr size_t VERIFY_QUEUE_PER_THREAD = 2;
+constexpr size_t WRITE_QUEUE_CHUNKS = 16;
+// Spans of Merkle chunk hashes a download keeps, 32 KB each plus proofs.
+constexpr size_t MERKLE_CACHE_SPANS = 64;
+
+static void appendBytes(std::vector<char>& out, const void* data, size_t size) {
+    const char* b = static_cast<const char*>(data);
+    out.insert(out.end(), b, b + size);
+}
+
+PeerNode::PeerNode(const std::string& tIp, int tPort, int mPort, const NodeOptions& opts) 
+    : trackerIp(tIp), trackerPort(tPort), myPort(mPort), options(opts), running(false),
+      reputation((uint32_t)std::max(0, opts.banThreshold)), fileCache((size_t)std::max(1, opts.fdCacheSize)),
+      chunkCache(opts.chunkCacheBytes, opts.cachePolicy) {
+    downloadManager = std::make_unique<DownloadManager>(
+        [this](const DownloadSpec& spec, DownloadControl& control) { return downloadFile(spec, &control); },
+        (size_t)std::max(1, opts.maxDownloads), (size_t)std::max(0, opts.maxConnections), opts.maxDownloadRate);
+}
+
+std::string PeerNode::getStats() {
+    std::stringstream ss;
+    ss << "Serving: " << (options.zeroCopy ? "zero-copy" : "copy")
+       << (eventServer ? " (epoll)" : " (threads)") << "\n";
+    ss << "  Bytes served zero-copy: " << serveStats.zeroCopyBytes.load() << "\n";
+    ss << "  Bytes served copied:    " << serveStats.copiedBytes.load() << "\n";
+    ss << "  Open-file cache hits/misses: " << fileCache.hits() << "/" << fileCache.misses() << "\n";
+    ss << "  Chunk cache hits/misses: " << chunkCache.hits() << "/" << chunkCache.misses()
+       << " (" << chunkCache.sizeBytes() << " bytes, " << chunkCache.evictions() << " evictions)\n";
+    ss << "  Replies cancelled: " << serveStats.cancelledReplies.load() << "\n";
+    ChunkStoreStats store = chunkStore.stats();
+    ss << "Chunk store: " << store.files << " files\n";
+    ss << "  Unique chunks: " << store.uniqueChunks << " (" << store.uniqueBytes << " bytes)\n";
+    ss << "  Referenced chunks: " << store.referencedChunks << " (" << store.referencedBytes << " bytes)\n";
+    ss << "  Dedup ratio: " << std::fixed << std::setprecision(2) << store.dedupRatio() << "\n";
+    ss << "Downloading:\n";
+    ss << "  Endgames entered: " << downloadStats.endgames.load() << "\n";
+    ss << "  Duplicate block requests: " << downloadStats.duplicateRequests.load() << "\n";
+    ss << "  Cancels sent: " << downloadStats.cancelsSent.load() << "\n";
+    ss << "  Wasted bytes: " << downloadStats.wastedBytes.load() << "\n";
+    ss << "  Chunks reused locally: " << downloadStats.reusedChunks.load()
+       << " (" << downloadStats.reusedBytes.load() << " bytes)\n";
+    TransferBudget& budget = downloadManager->budget();
+    ss << "  Connections in use: " << budget.connectionsInUse();
+    if (budget.maxConnections()) ss << "/" << budget.maxConnections();
+    ss << "\n  Bandwidth cap: ";
+    if (budget.bytesPerSecond()) ss << budget.bytesPerSecond() / 1024 << " KB/s";
+    else ss << "none";
+
+    for (const auto& [peer, r] : reputation.snapshot()) {
+        ss << "\n  Peer " << peer << ": " << r.corrupt << " corrupt, " << r.suspect << " suspect, "
+           << r.failed << " failed" << (r.banned ? " (banned)" : "");
+    }
+
+    std::lock_guard<std::mutex> lock(peerRatesMutex);
+    for (const auto& [hash, pipeline] : pipelines) {
+        PipelineStats p = pipeline->stats();
+        ss << "\nPipeline of " << hash.hex().substr(0, 16) << "...:"
+           << "\n  Verify queue: " << p.verifyDepth << "/" << p.verifyCapacity << " (peak " << p.verifyPeak << ")"
+           << "\n  Write queue:  " << p.writeDepth << "/" << p.writeCapacity << " (peak " << p.writePeak << ")"
+           << "\n  Chunks verified/corrupt/written: " << p.verified << "/" << p.corrupt << "/" << p.written
+           << "\n  Buffers allocated/reused: " << p.buffersAllocated << "/" << p.buffersReused;
+    }
+    for (const auto& [hash, rates] : peerRates) {
+        ss << "\nPeers of " << hash.hex().substr(0, 16) << "...:";
+        for (const auto& rate : rates) {
+            PeerRateSnapshot p = rate->snapshot();
+            ss << "\n  " << p.ip << ":" << p.port << " " << peerStateName(p.state)
+               << std::fixed << std::setprecision(2)
+               << " " << p.throughput / (1024 * 1024) << " MB/s"
+               << " rtt " << p.minRttMs << "/" << p.srttMs << " ms"
+               << " window " << p.depth
+               << " bytes " << p.bytes;
+        }
+    }
+    return ss.str();
 }
 
 void PeerNode::setTracker(const std::string& ip, int port) {
@@ -22,7 +137,9 @@ void PeerNode::setTracker(const std::string& ip, int port) {
 }
 
 PeerNode::~PeerNode() {
+    downloadManager.reset();
     running = false;
+    if (eventServer) eventServer->stop();
     SocketUtils::closeSocket(serverSocket);
     if(serverThread.joinable()) serverThread.join();
 }
@@ -47,8 +164,22 @@ void PeerNode::start() {
 
     registerToTracker();
 
-    serverThread = std::thread(&PeerNode::serverLoop, this);
+    if (options.serveMode == ServeMode::EPOLL) {
+        eventServer = std::make_unique<EventServer>(serverSocket, options.ioThreads,
+            [this](const PacketHeader& h, const std::vector<char>& body, const std::string& ip,
+                   ServeSession& session, PeerReply& reply) {
+                return handlePeerRequest(h, body, ip, session, reply);
+            }, &serveStats);
+        if (!eventServer->start()) {
+            Logger::error("Falling back to thread-per-connection serving");
+            eventServer.reset();
+        }
+    }
+    if (!eventServer) {
+        serverThread = std::thread(&PeerNode::serverLoop, this);
+    }
     std::thread(&PeerNode::keepAliveLoop, this).detach();
+    if (!options.seedIndex.empty()) loadSeedIndex();
     
     Logger::log("Peer started on port " + std::to_string(myPort));
 }
@@ -90,89 +221,280 @@ void PeerNode::registerToTracker() {
     Logger::log("Registered with tracker");
 }
 
-void PeerNode::advertiseFile(const std::string& hash, uint64_t size, const std::string& name) {
-    SocketType sock = SocketUtils::createSocket();
-    if (!SocketUtils::connectToServer(sock, trackerIp, trackerPort)) {
-        Logger::error("Failed to connect to tracker to advertise");
-        SocketUtils::closeSocket(sock);
-        return;
-    }
-
-    {
-        PacketHeader regPkt;
-        regPkt.type = PacketType::REGISTER;
-        regPkt.length = sizeof(uint16_t);
-        uint16_t p = (uint16_t)myPort;
-        SocketUtils::sendAll(sock, &regPkt, sizeof(regPkt));
-        SocketUtils::sendAll(sock, &p, sizeof(p));
-    }
-
+static void sendAdvertise(SocketType sock, const Digest& hash, uint64_t size, const std::string& name) {
     PacketHeader pkt;
     pkt.type = PacketType::ADVERTISE_FILE;
     
-    std::vector<uint8_t> rawHash(32);
-    for (size_t i = 0; i < 32; ++i) {
-        std::string byteString = hash.substr(i * 2, 2);
-        rawHash[i] = (uint8_t)strtol(byteString.c_str(), NULL, 16);
-    }
-    
     uint32_t nameLen = (uint32_t)name.size();
     pkt.length = 32 + sizeof(size) + sizeof(nameLen) + nameLen;
     
     SocketUtils::sendAll(sock, &pkt, sizeof(pkt));
-    SocketUtils::sendAll(sock, rawHash.data(), 32);
+    SocketUtils::sendAll(sock, hash.data(), Digest::SIZE);
     SocketUtils::sendAll(sock, &size, sizeof(size));
     SocketUtils::sendAll(sock, &nameLen, sizeof(nameLen));
     SocketUtils::sendAll(sock, name.data(), nameLen);
-    
+}
+
+// Opens a tracker session that advertisements may follow. INVALID_SOCKET if
+// the tracker cannot be reached.
+static SocketType openTrackerSession(const std::string& trackerIp, int trackerPort, int myPort) {
+    SocketType sock = SocketUtils::createSocket();
+    if (!SocketUtils::connectToServer(sock, trackerIp, trackerPort)) {
+        Logger::error("Failed to connect to tracker to advertise");
+        SocketUtils::closeSocket(sock);
+        return INVALID_SOCKET;
+    }
+
+    PacketHeader regPkt;
+    regPkt.type = PacketType::REGISTER;
+    regPkt.length = sizeof(uint16_t);
+    uint16_t p = (uint16_t)myPort;
+    SocketUtils::sendAll(sock, &regPkt, sizeof(regPkt));
+    SocketUtils::sendAll(sock, &p, sizeof(p));
+    return sock;
+}
+
+void PeerNode::advertiseFile(const Digest& hash, uint64_t size, const std::string& name) {
+    SocketType sock = openTrackerSession(trackerIp, trackerPort, myPort);
+    if (sock == INVALID_SOCKET) return;
+    sendAdvertise(sock, hash, size, name);
     SocketUtils::closeSocket(sock);
     Logger::log("Advertised file " + name);
 }
 
+void PeerNode::advertiseFiles(const std::vector<std::shared_ptr<const FileMetadata>>& files) {
+    SocketType sock = openTrackerSession(trackerIp, trackerPort, myPort);
+    if (sock == INVALID_SOCKET) return;
+    for (const auto& meta : files) sendAdvertise(sock, meta->fileHash, meta->fileSize, meta->fileName);
+    SocketUtils::closeSocket(sock);
+    Logger::log("Advertised " + std::to_string(files.size()) + " files");
+}
+
 void PeerNode::seedFile(const std::string& filepath) {
     if (!fs::exists(filepath)) {
         Logger::error("File not found: " + filepath);
         return;
     }
+    if (fs::is_directory(filepath)) {
+        seedBundle(filepath);
+        return;
+    }
     
-    uint64_t fileSize = fs::file_size(filepath);
     std::string fileName = fs::path(filepath).filename().string();
-    std::string fileHash = SHA256::hashFile(filepath); 
-    
-    Logger::log("Hashing complete: " + fileHash);
+    // Taken before hashing, so a write during it makes the entry stale
+    auto stamp = std::make_shared<FileStamp>();
+    if (!FileStamp::of(filepath, *stamp)) stamp = nullptr;
+    if (stamp) {
+        if (std::shared_ptr<const FileMetadata> known = findSeeded(filepath, *stamp)) {
+            Logger::log("Unchanged since hashed, not rehashing: " + filepath);
+            advertiseFile(known->fileHash, known->fileSize, known->fileName);
+            return;
+        }
+    }
+    auto progress = std::make_shared<SeedProgress>();
+    progress->path = filepath;
+    {
+        std::lock_guard<std::mutex> lock(seedingMutex);
+        seeding.push_back(progress);
+    }
+    SeedHashResult hashed;
+    bool ok = SeedHasher::hashFile(filepath, options.chunking, CHUNK_SIZE, options.hash, hashThreadCount(), hashed,
+                                   progress.get());
+    {
+        std::lock_guard<std::mutex> lock(seedingMutex);
+        seeding.remove(progress);
+    }
+    if (!ok) {
+        Logger::error("Cannot read " + filepath);
+        return;
+    }
+
+    uint64_t fileSize = hashed.layout.fileSize();
+    Digest fileHash = hashed.fileHash;
+    double seconds = progress->seconds();
+    std::stringstream rate;
+    rate << std::fixed << std::setprecision(1) << (seconds > 0 ? fileSize / seconds / (1024 * 1024) : 0);
+    Logger::log("Hashed " + std::to_string(hashed.chunkHashes.size()) +
+                (options.chunking.contentDefined ? " content-defined" : "") + " chunks with " +
+                Hasher::name(options.hash) + " at " + rate.str() +
+                " MB/s: " + fileHash.hex());
+
+    // Under a Merkle identity peers fetch the chunk hashes a span at a time,
+    // with proofs, instead of as one list
+    std::shared_ptr<const MerkleTree> tree;
+    if (options.merkle && hashed.layout.isFixed() && hashed.layout.count() > 0) {
+        tree = std::make_shared<const MerkleTree>(hashed.chunkHashes);
+        fileHash = MerkleTree::identity(fileSize, CHUNK_SIZE, tree->root(), options.hash);
+        Logger::log("Merkle root " + tree->root().hex() + ", file identity " + fileHash.hex());
+    }
 
     FileMetadata meta;
     meta.fileName = fileName;
     meta.fileSize = fileSize;
     meta.fileHash = fileHash;
     meta.fullPath = filepath;
-    
-    // Chunking logic & Hashing
-    uint32_t totalChunks = (uint32_t)((fileSize + CHUNK_SIZE - 1) / CHUNK_SIZE);
-    Logger::log("Calculating hashes for " + std::to_string(totalChunks) + " chunks...");
-    
-    std::ifstream file(filepath, std::ios::binary);
-    std::vector<char> buffer(CHUNK_SIZE);
-    
-    for(uint32_t i=0; i<totalChunks; ++i) {
-        size_t toRead = CHUNK_SIZE;
-        if (i * CHUNK_SIZE + CHUNK_SIZE > fileSize) {
-            toRead = fileSize - (i * CHUNK_SIZE);
+    meta.layout = hashed.layout;
+    meta.chunkHashes = std::move(hashed.chunkHashes);
+    meta.hash = options.hash;
+    meta.merkle = tree;
+    meta.stamp = stamp;
+
+    auto entry = std::make_shared<const FileMetadata>(std::move(meta));
+    {
+        std::lock_guard<std::mutex> lock(dataMutex);
+        knownFiles[fileHash] = entry;
+    }
+    fileCache.invalidate(fileHash);
+    chunkStore.addFile(fileHash, entry->chunkHashes, entry->layout.lengths());
+    saveSeedIndex();
+
+    advertiseFile(fileHash, fileSize, fileName);
+}
+
+std::shared_ptr<const FileMetadata> PeerNode::findSeeded(const std::string& path, const FileStamp& stamp) {
+    std::lock_guard<std::mutex> lock(dataMutex);
+    for (const auto& [hash, meta] : knownFiles) {
+        if (meta->stamp && *meta->stamp == stamp && meta->fullPath == path) return meta;
+    }
+    return nullptr;
+}
+
+void PeerNode::loadSeedIndex() {
+    auto started = std::chrono::steady_clock::now();
+    std::vector<SeedIndexEntry> entries;
+    size_t stale = 0;
+    if (!SeedIndex::load(options.seedIndex, entries, stale)) {
+        if (fs::exists(options.seedIndex)) Logger::error("Ignoring unreadable seed index " + options.seedIndex);
+        return;
+    }
+
+    std::vector<std::shared_ptr<const FileMetadata>> loaded;
+    for (SeedIndexEntry& e : entries) {
+        // Files hashed under other chunking, identity or hash settings are
+        // hashed again when next seeded
+        const ChunkingParams& c = options.chunking;
+        bool sameChunks = e.chunking.contentDefined
+            ? c.contentDefined && e.chunking.minSize == c.minSize && e.chunking.avgSize == c.avgSize &&
+              e.chunking.maxSize == c.maxSize
+            : !c.contentDefined && e.layout.chunkSize() == CHUNK_SIZE;
+        bool merkle = options.merkle && e.layout.isFixed() && e.layout.count() > 0;
+        if (!sameChunks || e.merkle != merkle || e.hash != options.hash) {
+            ++stale;
+            continue;
         }
-        file.read(buffer.data(), toRead);
-        
-        // Hash buffer
-        std::string chunkData(buffer.data(), toRead);
-        std::string chunkHash = SHA256::hash(chunkData);
-        meta.chunkHashes.push_back(chunkHash);
+
+        FileMetadata meta;
+        meta.fileName = fs::path(e.path).filename().string();
+        meta.fileSize = e.stamp.size;
+        meta.fileHash = e.fileHash;
+        meta.fullPath = e.path;
+        meta.layout = e.layout;
+        meta.chunkHashes = std::move(e.chunkHashes);
+        meta.hash = e.hash;
+        meta.stamp = std::make_shared<const FileStamp>(e.stamp);
+        if (merkle) {
+            auto tree = std::make_shared<const MerkleTree>(meta.chunkHashes);
+            if (MerkleTree::identity(meta.fileSize, CHUNK_SIZE, tree->root(), meta.hash) != meta.fileHash) {
+                ++stale;
+                continue;
+            }
+            meta.merkle = tree;
+        }
+
+        auto entry = std::make_shared<const FileMetadata>(std::move(meta));
+        {
+            std::lock_guard<std::mutex> lock(dataMutex);
+            knownFiles[entry->fileHash] = entry;
+        }
+        chunkStore.addFile(entry->fileHash, entry->chunkHashes, entry->layout.lengths());
+        loaded.push_back(entry);
     }
-    
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::stringstream took;
+    took << std::fixed << std::setprecision(2) << seconds;
+    Logger::log("Seed index: serving " + std::to_string(loaded.size()) + " files without rehashing, " +
+                std::to_string(stale) + " stale, in " + took.str() + " s");
+    if (!loaded.empty()) advertiseFiles(loaded);
+    if (stale > 0) saveSeedIndex();
+}
+
+void PeerNode::saveSeedIndex() {
+    if (options.seedIndex.empty()) return;
+    // The snapshot is taken under the lock too, so a later one always wins
+    std::lock_guard<std::mutex> indexLock(seedIndexMutex);
+    std::vector<std::shared_ptr<const FileMetadata>> seeded;
     {
         std::lock_guard<std::mutex> lock(dataMutex);
-        knownFiles[fileHash] = meta;
+        for (const auto& [hash, meta] : knownFiles) {
+            if (meta->stamp) seeded.push_back(meta);
+        }
+    }
+    std::vector<SeedIndexEntry> entries;
+    entries.reserve(seeded.size());
+    for (const auto& meta : seeded) {
+        SeedIndexEntry e;
+        e.path = meta->fullPath;
+        e.stamp = *meta->stamp;
+        e.chunking = options.chunking;
+        e.merkle = meta->merkle != nullptr;
+        e.hash = meta->hash;
+        e.fileHash = meta->fileHash;
+        e.layout = meta->layout;
+        e.chunkHashes = meta->chunkHashes;
+        entries.push_back(std::move(e));
     }
+    if (!SeedIndex::save(options.seedIndex, entries)) {
+        Logger::error("Cannot write seed index " + options.seedIndex);
+    }
+}
 
-    advertiseFile(fileHash, fileSize, fileName);
+std::vector<std::shared_ptr<const SeedProgress>> PeerNode::seedsInProgress() {
+    std::lock_guard<std::mutex> lock(seedingMutex);
+    return std::vector<std::shared_ptr<const SeedProgress>>(seeding.begin(), seeding.end());
+}
+
+size_t PeerNode::hashThreadCount() const {
+    return options.hashThreads > 0 ? (size_t)options.hashThreads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+void PeerNode::seedBundle(const std::string& root) {
+    auto manifest = std::make_shared<BundleManifest>();
+    manifest->chunkSize = CHUNK_SIZE;
+    if (!Bundle::scan(root, *manifest)) {
+        Logger::error("Cannot list " + root);
+        return;
+    }
+    uint64_t totalSize = manifest->totalSize();
+    if (totalSize == 0) {
+        Logger::error("Nothing to seed in " + root);
+        return;
+    }
+    Logger::log("Hashing bundle of " + std::to_string(manifest->files.size()) + " files, " +
+                std::to_string(totalSize) + " bytes...");
+    if (!Bundle::hashChunks(root, *manifest)) return;
+
+    FileMetadata meta;
+    fs::path name = fs::path(root).lexically_normal();
+    if (!name.has_filename()) name = name.parent_path(); // "dir/"
+    meta.fileName = name.filename().string();
+    meta.fileSize = totalSize;
+    meta.fileHash = SHA256::digest(Bundle::encode(*manifest));
+    meta.chunkHashes = manifest->chunkHashes;
+    meta.layout = ChunkLayout::fixed(totalSize, CHUNK_SIZE); // Bundles always use fixed chunks
+    meta.fullPath = root;
+    meta.bundle = manifest;
+    Logger::log("Bundle hash: " + meta.fileHash.hex());
+
+    Digest fileHash = meta.fileHash;
+    std::string fileName = meta.fileName;
+    {
+        std::lock_guard<std::mutex> lock(dataMutex);
+        knownFiles[fileHash] = std::make_shared<const FileMetadata>(std::move(meta));
+    }
+    chunkStore.addFile(fileHash, manifest->chunkHashes, ChunkLayout::fixed(totalSize, CHUNK_SIZE).lengths());
+    // One announce for the whole tree
+    advertiseFile(fileHash, totalSize, fileName);
 }
 
 // Helper struct for internal use
@@ -199,7 +521,7 @@ struct TrackerResp {
 // I'll handle that in the next tool call sequence or just do valid C++ now?
 // I'll assume I update header.
 
-TrackerResp getPeersInternal(const std::string& trackerIp, int trackerPort, const std::string& hash) {
+TrackerResp getPeersInternal(const std::string& trackerIp, int trackerPort, const Digest& hash) {
     TrackerResp result;
     result.fileSize = 0;
     
@@ -212,15 +534,9 @@ TrackerResp getPeersInternal(const std::string& trackerIp, int trackerPort, cons
     PacketHeader req;
     req.type = PacketType::REQUEST_PEERS;
     req.length = 32;
-    
-     std::vector<uint8_t> rawHash(32);
-    for (size_t i = 0; i < 32; ++i) {
-        std::string byteString = hash.substr(i * 2, 2);
-        rawHash[i] = (uint8_t)strtol(byteString.c_str(), NULL, 16);
-    }
 
     SocketUtils::sendAll(sock, &req, sizeof(req));
-    SocketUtils::sendAll(sock, rawHash.data(), 32);
+    SocketUtils::sendAll(sock, hash.data(), Digest::SIZE);
 
     PacketHeader resp;
     if (SocketUtils::recvAll(sock, &resp, sizeof(resp)) && resp.type == PacketType::RESPONSE_PEERS) {
@@ -250,7 +566,7 @@ TrackerResp getPeersInternal(const std::string& trackerIp, int trackerPort, cons
     return result;
 }
 
-std::vector<PeerConnection> PeerNode::getPeersForFile(const std::string& hash) {
+std::vector<PeerConnection> PeerNode::getPeersForFile(const Digest& hash) {
     // Legacy wrapper if needed, or I update header.
     // I will update header in a separate tool call.
     return getPeersInternal(trackerIp, trackerPort, hash).peers;
@@ -267,306 +583,1373 @@ void PeerNode::serverLoop() {
         }
 
         std::thread([this, client, clientIp]() {
+            // Sessions are persistent: serve requests until the peer hangs up.
+            ServeSession session;
             PacketHeader header;
-            if (SocketUtils::recvAll(client, &header, sizeof(header))) {
-                if (header.type == PacketType::REQUEST_CHUNK) {
-                    char rawHash[32];
-                    uint32_t index;
-                    SocketUtils::recvAll(client, rawHash, 32);
-                    SocketUtils::recvAll(client, &index, sizeof(index));
-
-                    std::string hashStr;
-                    for(int i=0; i<32; i++) {
-                        char buf[3];
-                        sprintf(buf, "%02x", (unsigned char)rawHash[i]);
-                        hashStr += buf;
-                    }
-
-                    std::vector<char> buffer;
-                    bool success = false;
-                    {
-                        std::lock_guard<std::mutex> lock(dataMutex);
-                        if (knownFiles.count(hashStr)) {
-                             success = loadChunk(knownFiles[hashStr], index, buffer);
-                        }
-                    }
-
-                    if (success) {
-                        PacketHeader resp;
-                        resp.type = PacketType::SEND_CHUNK;
-                        resp.length = 32 + sizeof(index) + sizeof(uint32_t) + buffer.size();
-                        uint32_t dataSize = (uint32_t)buffer.size();
-                        SocketUtils::sendAll(client, &resp, sizeof(resp));
-                        SocketUtils::sendAll(client, rawHash, 32);
-                        SocketUtils::sendAll(client, &index, sizeof(index));
-                        SocketUtils::sendAll(client, &dataSize, sizeof(dataSize)); // Redundant but explicit
-                        SocketUtils::sendAll(client, buffer.data(), buffer.size());
-                        Logger::log("Sent chunk " + std::to_string(index) + " to " + clientIp);
-                    }
-                }
-                else if (header.type == PacketType::REQUEST_METADATA) {
-                    char rawHash[32];
-                    SocketUtils::recvAll(client, rawHash, 32);
-                    
-                    std::string hashStr;
-                    for(int i=0; i<32; i++) {
-                        char buf[3];
-                        sprintf(buf, "%02x", (unsigned char)rawHash[i]);
-                        hashStr += buf;
-                    }
-                    
-                    std::vector<std::string> hashes;
-                    {
-                        std::lock_guard<std::mutex> lock(dataMutex);
-                        if (knownFiles.count(hashStr)) {
-                            hashes = knownFiles[hashStr].chunkHashes;
-                        }
-                    }
-                    
-                    if (!hashes.empty()) {
-                         PacketHeader resp;
-                         resp.type = PacketType::RESPONSE_METADATA;
-                         // Count (4) + Count * 32
-                         uint32_t count = (uint32_t)hashes.size();
-                         resp.length = sizeof(count) + (count * 32);
-                         
-                         SocketUtils::sendAll(client, &resp, sizeof(resp));
-                         SocketUtils::sendAll(client, &count, sizeof(count));
-                         
-                         for(const auto& h : hashes) {
-                             // Convert hex string back to 32 bytes
-                             std::vector<uint8_t> rh(32);
-                             for (size_t k = 0; k < 32; ++k) {
-                                std::string bs = h.substr(k * 2, 2);
-                                rh[k] = (uint8_t)strtol(bs.c_str(), NULL, 16);
-                             }
-                             SocketUtils::sendAll(client, rh.data(), 32);
-                         }
-                         Logger::log("Sent metadata to " + clientIp);
-                    }
+            while (SocketUtils::recvAll(client, &header, sizeof(header)) && header.length <= MAX_REQUEST_BODY) {
+                std::vector<char> body(header.length);
+                PeerReply reply;
+                if (!SocketUtils::recvAll(client, body.data(), body.size()) ||
+                    !handlePeerRequest(header, body, clientIp, session, reply) ||
+                    !sendReply(client, reply)) {
+                    break;
                 }
+                session.cancels.clear(); // Replies go out synchronously, nothing is left to cancel
             }
             SocketUtils::closeSocket(client);
         }).detach();
     }
 }
 
-bool PeerNode::loadChunk(const FileMetadata& meta, uint32_t index, std::vector<char>& buffer) {
-    std::ifstream file(meta.fullPath, std::ios::binary);
-    if (!file.is_open()) return false;
-    file.seekg(index * CHUNK_SIZE);
-    if (file.fail()) return false;
-    size_t toRead = CHUNK_SIZE;
-    if (index * CHUNK_SIZE + CHUNK_SIZE > meta.fileSize) {
-        toRead = meta.fileSize - (index * CHUNK_SIZE);
+bool PeerNode::sendReply(SocketType client, const PeerReply& reply) {
+    IoSlice slices[2] = { { reply.head.data(), reply.head.size() }, { reply.bodyData(), reply.bodySize() } };
+    if (!SocketUtils::sendAllv(client, slices, 2)) return false;
+    serveStats.copiedBytes += reply.bodySize();
+
+    uint64_t offset = reply.fileOffset;
+    size_t left = reply.fileLength;
+    while (left > 0) {
+        long long n = SocketUtils::sendFile(client, reply.file->fd(), offset, left);
+        if (n > 0) {
+            serveStats.zeroCopyBytes += (uint64_t)n;
+            offset += (uint64_t)n;
+            left -= (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno != EINVAL && errno != ENOSYS) return false;
+
+        // sendfile cannot serve this descriptor: copy the rest through user space.
+        std::vector<char> rest(left);
+        if (!FileUtils::readAt(reply.file->fd(), rest.data(), left, offset) ||
+            !SocketUtils::sendAll(client, rest.data(), left)) {
+            return false;
+        }
+        serveStats.copiedBytes += left;
+        break;
+    }
+    return true;
+}
+
+// Pushes HAVE for chunks of partial files acquired since they were last
+// announced on this connection.
+static void appendHaves(ServeSession& session, std::vector<char>& out) {
+    for (auto& a : session.announced) {
+        if (a.have->countSet() == a.sentCount) continue;
+        for (uint32_t i = 0; i < a.have->size(); ++i) {
+            if (a.sent[i] || !a.have->has(i)) continue;
+            a.sent[i] = true;
+            ++a.sentCount;
+
+            PacketHeader pkt;
+            pkt.type = PacketType::HAVE;
+            pkt.length = 32 + sizeof(i);
+            appendBytes(out, &pkt, sizeof(pkt));
+            appendBytes(out, a.fileHash.data(), Digest::SIZE);
+            appendBytes(out, &i, sizeof(i));
+        }
     }
+}
+
+bool PeerNode::handlePeerRequest(const PacketHeader& header, const std::vector<char>& body,
+                                 const std::string& clientIp, ServeSession& session, PeerReply& reply) {
+    if (header.type == PacketType::BITFIELD) {
+        // [Hash 32] [Count u32] [Bits...]: answer with what we hold of that file
+        if (body.size() < 32 + sizeof(uint32_t)) return false;
+        const char* rawHash = body.data();
+
+        Digest fileHash = Digest::fromBytes(rawHash);
+
+        std::shared_ptr<const FileMetadata> meta = findFile(fileHash);
+        uint32_t count = meta ? meta->layout.count() : 0;
+        std::vector<bool> bits(count, meta && !meta->have);
+        if (meta && meta->have) {
+            // Snapshot once so the bitfield and later HAVEs agree
+            for (uint32_t i = 0; i < count; ++i) bits[i] = meta->have->has(i);
+            ServeSession::Announced* a = nullptr;
+            for (auto& existing : session.announced) {
+                if (existing.fileHash == fileHash) a = &existing;
+            }
+            if (!a) {
+                session.announced.emplace_back();
+                a = &session.announced.back();
+                a->fileHash = fileHash;
+                a->have = meta->have;
+            }
+            a->sent = bits;
+            a->sentCount = (uint32_t)std::count(bits.begin(), bits.end(), true);
+        }
+        appendHaves(session, reply.head);
+
+        std::vector<uint8_t> packed((count + 7) / 8, 0);
+        for (uint32_t i = 0; i < count; ++i) {
+            if (bits[i]) packed[i / 8] |= (uint8_t)(0x80 >> (i % 8));
+        }
+
+        PacketHeader resp;
+        resp.type = PacketType::BITFIELD;
+        resp.length = (uint32_t)(32 + sizeof(count) + packed.size());
+        appendBytes(reply.head, &resp, sizeof(resp));
+        appendBytes(reply.head, rawHash, 32);
+        appendBytes(reply.head, &count, sizeof(count));
+        appendBytes(reply.head, packed.data(), packed.size());
+        return true;
+    }
+
+    appendHaves(session, reply.head);
+
+    if (header.type == PacketType::REQUEST_CHUNK || header.type == PacketType::REQUEST_BLOCK) {
+        // [Hash 32] [Index u32], plus [Offset u32] [Length u32] for a block
+        bool isBlock = header.type == PacketType::REQUEST_BLOCK;
+        if (body.size() < 32 + (isBlock ? 3 : 1) * sizeof(uint32_t)) return false;
+        const char* rawHash = body.data();
+        uint32_t index;
+        memcpy(&index, body.data() + 32, sizeof(index));
+        uint32_t blockOffset = 0;
+        uint32_t blockLength = UINT32_MAX; // The whole chunk
+        if (isBlock) {
+            memcpy(&blockOffset, body.data() + 36, sizeof(blockOffset));
+            memcpy(&blockLength, body.data() + 40, sizeof(blockLength));
+        }
+
+        Digest fileHash = Digest::fromBytes(rawHash);
+
+        ChunkBuffer buffer;
+        std::shared_ptr<FileHandle> file;
+        size_t length = 0;
+        bool success = false;
+        // Disk I/O runs without dataMutex; the pinned metadata stays valid
+        // even if the file is re-seeded meanwhile.
+        std::shared_ptr<const FileMetadata> meta = findFile(fileHash);
+        if (meta && index < meta->layout.count()) {
+            size_t chunkLength = meta->layout.length(index);
+            if (blockOffset >= chunkLength || blockLength == 0) meta = nullptr;
+            else length = std::min<size_t>(blockLength, chunkLength - blockOffset);
+        } else {
+            meta = nullptr;
+        }
+        // Zero-copy already serves from the kernel page cache, so it bypasses
+        // the hot-chunk cache.
+        // A block spanning two bundle files is copied instead.
+        uint64_t fileOffset = 0;
+        auto serveFrom = [&](const FileMetadata& source, uint32_t sourceIndex) {
+            if (options.zeroCopy) {
+                file = openRange(source, source.layout.offset(sourceIndex) + blockOffset, length, fileOffset);
+                if (file) return true;
+            }
+            buffer = loadChunkCached(source, sourceIndex);
+            return buffer != nullptr && blockOffset + length <= buffer->size();
+        };
+        if (meta) {
+            // Our own copy if it is on disk, otherwise any other file with
+            // the same chunk
+            bool held = !meta->have || meta->have->has(index);
+            success = held && serveFrom(*meta, index);
+            if (!success && index < meta->chunkHashes.size()) {
+                for (const auto& [source, sourceIndex] : chunkHolders(meta->chunkHashes[index], meta->fileHash)) {
+                    if ((success = serveFrom(*source, sourceIndex))) break;
+                }
+            }
+        }
+        if (!success) {
+            // Tell the requester so it can move the chunk to another peer
+            // without tearing down its pipelined session.
+            PacketHeader resp;
+            resp.type = PacketType::RESPONSE_ERROR;
+            resp.length = 32 + sizeof(index) + (isBlock ? sizeof(blockOffset) : 0);
+            appendBytes(reply.head, &resp, sizeof(resp));
+            appendBytes(reply.head, rawHash, 32);
+            appendBytes(reply.head, &index, sizeof(index));
+            if (isBlock) appendBytes(reply.head, &blockOffset, sizeof(blockOffset));
+            return true;
+        }
+
+        if (isBlock) {
+            reply.cancelKey.assign(body.data(), 32 + 2 * sizeof(uint32_t));
+            reply.keepOnCancel = reply.head.size();
+        }
+        PacketHeader resp;
+        resp.type = isBlock ? PacketType::SEND_BLOCK : PacketType::SEND_CHUNK;
+        resp.length = 32 + sizeof(index) + (isBlock ? sizeof(blockOffset) : 0) + sizeof(uint32_t) + length;
+        uint32_t dataSize = (uint32_t)length;
+        appendBytes(reply.head, &resp, sizeof(resp));
+        appendBytes(reply.head, rawHash, 32);
+        appendBytes(reply.head, &index, sizeof(index));
+        if (isBlock) appendBytes(reply.head, &blockOffset, sizeof(blockOffset));
+        appendBytes(reply.head, &dataSize, sizeof(dataSize)); // Redundant but explicit
+        if (file) {
+            reply.file = std::move(file);
+            reply.fileOffset = fileOffset;
+            reply.fileLength = length;
+        } else {
+            reply.setBody(std::move(buffer), blockOffset, length);
+        }
+        if (!isBlock) Logger::log("Sent chunk " + std::to_string(index) + " to " + clientIp);
+        return true;
+    }
+    else if (header.type == PacketType::CANCEL) {
+        // [Hash 32] [Index u32] [Offset u32]; only a reply still queued can be dropped
+        if (body.size() < 32 + 2 * sizeof(uint32_t)) return false;
+        session.cancels.emplace_back(body.data(), 32 + 2 * sizeof(uint32_t));
+        return true;
+    }
+    else if (header.type == PacketType::REQUEST_METADATA) {
+        if (body.size() < 32) return false;
+        const char* rawHash = body.data();
+
+        Digest fileHash = Digest::fromBytes(rawHash);
+        
+        std::shared_ptr<const FileMetadata> meta = findFile(fileHash);
+        if (!meta || meta->chunkHashes.empty()) return false;
+        const std::vector<Digest>& hashes = meta->chunkHashes;
+
+        PacketHeader resp;
+        resp.type = PacketType::RESPONSE_METADATA;
+        // Count (4) + Count * 32, then Count * 4 chunk lengths if cut by content,
+        // then the hash algorithm (1) unless it is SHA-256
+        uint32_t count = (uint32_t)hashes.size();
+        std::vector<uint32_t> lengths;
+        if (!meta->layout.isFixed()) lengths = meta->layout.lengths();
+        bool tagged = meta->hash != HashAlgorithm::SHA256;
+        resp.length = (uint32_t)(sizeof(count) + (count * 32) + lengths.size() * sizeof(uint32_t) +
+                                 (tagged ? sizeof(meta->hash) : 0));
+
+        appendBytes(reply.head, &resp, sizeof(resp));
+        appendBytes(reply.head, &count, sizeof(count));
+        for (const Digest& h : hashes) appendBytes(reply.head, h.data(), Digest::SIZE);
+        appendBytes(reply.head, lengths.data(), lengths.size() * sizeof(uint32_t));
+        if (tagged) appendBytes(reply.head, &meta->hash, sizeof(meta->hash));
+        Logger::log("Sent metadata to " + clientIp);
+        return true;
+    }
+    else if (header.type == PacketType::REQUEST_MANIFEST) {
+        if (body.size() < 32) return false;
+        const char* rawHash = body.data();
+
+        Digest fileHash = Digest::fromBytes(rawHash);
+
+        std::shared_ptr<const FileMetadata> meta = findFile(fileHash);
+        PacketHeader resp;
+        if (!meta || !meta->bundle) {
+            // Lets the downloader tell a plain file from a bundle
+            resp.type = PacketType::RESPONSE_ERROR;
+            resp.length = 0;
+            appendBytes(reply.head, &resp, sizeof(resp));
+            return true;
+        }
+        std::string manifest = Bundle::encode(*meta->bundle);
+        resp.type = PacketType::RESPONSE_MANIFEST;
+        resp.length = (uint32_t)manifest.size();
+        appendBytes(reply.head, &resp, sizeof(resp));
+        appendBytes(reply.head, manifest.data(), manifest.size());
+        Logger::log("Sent bundle manifest to " + clientIp);
+        return true;
+    }
+    else if (header.type == PacketType::REQUEST_TREE) {
+        if (body.size() < 32) return false;
+        std::shared_ptr<const FileMetadata> meta = findFile(Digest::fromBytes(body.data()));
+        PacketHeader resp;
+        const Digest* root = !meta ? nullptr
+                           : meta->merkle ? &meta->merkle->root()
+                           : meta->merkleHashes ? &meta->merkleHashes->root() : nullptr;
+        if (!root) {
+            // Not a Merkle file: the downloader fetches the flat list instead
+            resp.type = PacketType::RESPONSE_ERROR;
+            resp.length = 0;
+            appendBytes(reply.head, &resp, sizeof(resp));
+            return true;
+        }
+        uint64_t fileSize = meta->fileSize;
+        uint32_t chunkSize = meta->layout.chunkSize();
+        bool tagged = meta->hash != HashAlgorithm::SHA256;
+        resp.type = PacketType::RESPONSE_TREE;
+        resp.length = sizeof(fileSize) + sizeof(chunkSize) + Digest::SIZE + (tagged ? sizeof(meta->hash) : 0);
+        appendBytes(reply.head, &resp, sizeof(resp));
+        appendBytes(reply.head, &fileSize, sizeof(fileSize));
+        appendBytes(reply.head, &chunkSize, sizeof(chunkSize));
+        appendBytes(reply.head, root->data(), Digest::SIZE);
+        if (tagged) appendBytes(reply.head, &meta->hash, sizeof(meta->hash));
+        return true;
+    }
+    else if (header.type == PacketType::REQUEST_HASHES) {
+        // [Hash 32] [Span u32]
+        if (body.size() < 32 + sizeof(uint32_t)) return false;
+        std::shared_ptr<const FileMetadata> meta = findFile(Digest::fromBytes(body.data()));
+        uint32_t span;
+        memcpy(&span, body.data() + 32, sizeof(span));
+        std::vector<Digest> hashes;
+        std::vector<Digest> proof;
+        bool found = false;
+        if (meta && meta->merkle && span < MerkleTree::spanCount(meta->merkle->leafCount())) {
+            auto first = meta->chunkHashes.begin() + (size_t)span * MerkleTree::SPAN;
+            hashes.assign(first, first + MerkleTree::spanLength(meta->merkle->leafCount(), span));
+            proof = meta->merkle->proof(span);
+            found = true;
+        } else if (meta && meta->merkleHashes) {
+            // A downloader passes on the spans it still has
+            found = meta->merkleHashes->span(span, hashes, proof);
+        }
+        PacketHeader resp;
+        if (!found) {
+            resp.type = PacketType::RESPONSE_ERROR;
+            resp.length = 0;
+            appendBytes(reply.head, &resp, sizeof(resp));
+            return true;
+        }
+        uint32_t count = (uint32_t)hashes.size();
+        uint32_t proofCount = (uint32_t)proof.size();
+        resp.type = PacketType::RESPONSE_HASHES;
+        resp.length = (uint32_t)(2 * sizeof(uint32_t) + (count + proofCount) * Digest::SIZE);
+        appendBytes(reply.head, &resp, sizeof(resp));
+        appendBytes(reply.head, &count, sizeof(count));
+        appendBytes(reply.head, hashes.data(), count * Digest::SIZE);
+        appendBytes(reply.head, &proofCount, sizeof(proofCount));
+        appendBytes(reply.head, proof.data(), proofCount * Digest::SIZE);
+        return true;
+    }
+    return false;
+}
+
+std::shared_ptr<const FileMetadata> PeerNode::findFile(const Digest& fileHash) {
+    std::lock_guard<std::mutex> lock(dataMutex);
+    auto it = knownFiles.find(fileHash);
+    if (it == knownFiles.end()) return nullptr;
+    return it->second;
+}
+
+std::vector<std::pair<std::shared_ptr<const FileMetadata>, uint32_t>>
+PeerNode::chunkHolders(const Digest& chunkHash, const Digest& exclude) {
+    std::vector<std::pair<std::shared_ptr<const FileMetadata>, uint32_t>> holders;
+    for (const ChunkLocation& loc : chunkStore.locate(chunkHash)) {
+        if (loc.fileHash == exclude) continue;
+        std::shared_ptr<const FileMetadata> meta = findFile(loc.fileHash);
+        if (!meta || loc.index >= meta->chunkHashes.size() || meta->chunkHashes[loc.index] != chunkHash) continue;
+        if (meta->have && !meta->have->has(loc.index)) continue;
+        holders.emplace_back(std::move(meta), loc.index);
+    }
+    return holders;
+}
+
+ChunkBuffer PeerNode::loadChunkCached(const FileMetadata& meta, uint32_t index) {
+    ChunkBuffer cached = chunkCache.get(meta.fileHash, index);
+    if (cached) return cached;
+
+    std::vector<char> buffer;
+    if (!loadChunk(meta, index, buffer)) return nullptr;
+    ChunkBuffer loaded = std::make_shared<const std::vector<char>>(std::move(buffer));
+    chunkCache.put(meta.fileHash, index, loaded);
+    return loaded;
+}
+
+bool PeerNode::loadChunk(const FileMetadata& meta, uint32_t index, std::vector<char>& buffer) {
+    if (index >= meta.layout.count()) return false;
+    uint64_t offset = meta.layout.offset(index);
+    size_t toRead = meta.layout.length(index);
     buffer.resize(toRead);
-    file.read(buffer.data(), toRead);
+    if (!meta.bundle) {
+        std::shared_ptr<FileHandle> file = fileCache.acquire(meta.fileHash, 0, meta.fullPath);
+        return file && FileUtils::readAt(file->fd(), buffer.data(), toRead, offset);
+    }
+
+    // Gathered from every file the chunk spans
+    for (const BundleSegment& s : meta.bundle->locate(offset, toRead)) {
+        uint64_t fileOffset = 0;
+        std::shared_ptr<FileHandle> file = openRange(meta, offset + s.rangeOffset, s.length, fileOffset);
+        if (!file || !FileUtils::readAt(file->fd(), buffer.data() + s.rangeOffset, (size_t)s.length, fileOffset)) {
+            return false;
+        }
+    }
     return true;
 }
 
-void PeerNode::writeChunk(const std::string& outputName, uint32_t index, const std::vector<char>& data) {
-    std::fstream file;
-    // Open for reading/writing, create if not exists.
-    // std::ios::app ? No.
-    // Need to handle sparse files or pre-allocate.
-    // Simple way: open, seek, write.
-    
-    // We need a mutex for writing to the same file from multiple threads?
-    // Yes, file operations are racy if seeking/writing concurrently on same handle.
-    // I'll create a fresh handle per write. OS handles locking usually? No, user space position is racy.
-    // But per-thread handle?
-    // "write" is atomic usually? No.
-    // `pwrite` is atomic on POSIX. C++ fstreams are not thread safe.
-    // I need a mutex for the file OR open unique fstream per thread.
-    // Unique fstream is safe for different regions? Windows might lock it.
-    // Let's use a global file mutex for simplicity (slower but safe).
-    // I'll add a static mutex or per-file mutex. for now: static.
-    static std::mutex fileWriteMutex;
-    std::lock_guard<std::mutex> lock(fileWriteMutex);
-    
-    file.open(outputName, std::ios::binary | std::ios::in | std::ios::out);
-    if (!file.is_open()) {
-        file.open(outputName, std::ios::binary | std::ios::out); // Create
-        file.close();
-        file.open(outputName, std::ios::binary | std::ios::in | std::ios::out);
+std::shared_ptr<FileHandle> PeerNode::openRange(const FileMetadata& meta, uint64_t offset, uint64_t length,
+                                                uint64_t& fileOffset) {
+    if (!meta.bundle) {
+        fileOffset = offset;
+        return fileCache.acquire(meta.fileHash, 0, meta.fullPath);
+    }
+    std::vector<BundleSegment> segments = meta.bundle->locate(offset, length);
+    if (segments.size() != 1 || segments[0].length != length) return nullptr;
+    const BundleSegment& s = segments[0];
+    fileOffset = s.fileOffset;
+    // Each bundle file has its own descriptor in the cache
+    return fileCache.acquire(meta.fileHash, s.file + 1,
+                             (fs::path(meta.fullPath) / meta.bundle->files[s.file].path).string());
+}
+
+uint32_t PeerNode::recheckChunks(const std::string& path, const ChunkLayout& layout, HashAlgorithm algorithm,
+                                 const std::function<bool(uint32_t, Digest&)>& hashOf, const BundleManifest* bundle,
+                                 ChunkBitfield& have) {
+    uint32_t count = layout.count();
+    std::atomic<uint32_t> next{0};
+    std::atomic<uint32_t> valid{0};
+    auto verify = [&]() {
+        std::shared_ptr<FileHandle> file = bundle ? nullptr : FileUtils::openRead(path);
+        if (!bundle && !file) return;
+        std::vector<char> buffer;
+        for (uint32_t i = next++; i < count; i = next++) {
+            uint64_t offset = layout.offset(i);
+            buffer.resize(layout.length(i));
+            bool read = bundle ? Bundle::readAt(path, *bundle, offset, buffer.data(), buffer.size())
+                               : FileUtils::readAt(file->fd(), buffer.data(), buffer.size(), offset);
+            Digest expected;
+            if (!read || !hashOf(i, expected)) continue;
+            if (Hasher::digest(algorithm, buffer.data(), buffer.size()) != expected) continue;
+            have.set(i);
+            ++valid;
+        }
+    };
+
+    // Each thread has its own descriptor, so this also holds on Windows where readAt seeks.
+    unsigned threads = std::max(1u, std::min(std::thread::hardware_concurrency(), count));
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; ++t) pool.emplace_back(verify);
+    for (auto& t : pool) t.join();
+    return valid;
+}
+
+uint64_t PeerNode::copyFromBasis(const std::string& basis, const ChunkLayout& layout, const std::vector<Digest>& chunkHashes,
+                                 HashAlgorithm algorithm, const std::vector<bool>& wanted, ChunkBitfield& have,
+                                 uint32_t& copied, const std::function<bool(uint64_t, const std::vector<char>&)>& write) {
+    copied = 0;
+    std::unordered_map<Digest, std::vector<uint32_t>> needed; // Chunk hash -> target chunks
+    for (uint32_t i = 0; i < layout.count(); ++i) {
+        if (wanted[i] && !have.has(i)) needed[chunkHashes[i]].push_back(i);
     }
-    file.seekp(index * CHUNK_SIZE);
-    file.write(data.data(), data.size());
+    std::error_code ec;
+    uint64_t basisSize = fs::file_size(basis, ec);
+    if (needed.empty() || ec || basisSize == 0) return 0;
+
+    // Cut the basis the way the target was cut, so unchanged stretches give
+    // the same chunks: at the same fixed size, or by content with this
+    // node's chunk sizes
+    ChunkLayout basisLayout = ChunkLayout::fixed(basisSize, layout.chunkSize());
+    if (!layout.isFixed()) {
+        std::vector<uint32_t> lengths;
+        if (!Chunker::cutFile(basis, options.chunking, lengths)) return 0;
+        basisLayout = ChunkLayout::variable(lengths);
+    }
+
+    uint32_t count = basisLayout.count();
+    std::atomic<uint32_t> next{0};
+    std::atomic<uint32_t> filled{0};
+    std::atomic<uint64_t> bytes{0};
+    auto scan = [&]() {
+        std::shared_ptr<FileHandle> file = FileUtils::openRead(basis);
+        if (!file) return;
+        std::vector<char> buffer;
+        for (uint32_t i = next++; i < count; i = next++) {
+            buffer.resize(basisLayout.length(i));
+            if (!FileUtils::readAt(file->fd(), buffer.data(), buffer.size(), basisLayout.offset(i))) continue;
+            auto it = needed.find(Hasher::digest(algorithm, buffer.data(), buffer.size()));
+            if (it == needed.end()) continue;
+            for (uint32_t target : it->second) {
+                // Identical basis chunks may race for a target; they write the same bytes
+                if (have.has(target) || !write(layout.offset(target), buffer)) continue;
+                if (have.set(target)) {
+                    ++filled;
+                    bytes += buffer.size();
+                }
+            }
+        }
+    };
+
+    unsigned threads = std::max(1u, std::min(std::thread::hardware_concurrency(), count));
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; ++t) pool.emplace_back(scan);
+    for (auto& t : pool) t.join();
+    copied = filled;
+    return bytes;
 }
 
-void PeerNode::downloadFile(const std::string& fileHash, const std::string& outputName) {
-    Logger::log("Starting download for " + fileHash);
+bool PeerNode::downloadFile(const DownloadSpec& spec, DownloadControl* control) {
+    auto begin = std::chrono::steady_clock::now();
+    const Digest& fileHash = spec.fileHash;
+    const std::string& outputName = spec.outputName;
+    Logger::log("Starting download for " + fileHash.hex());
     
     TrackerResp tr = getPeersInternal(trackerIp, trackerPort, fileHash);
     if (tr.peers.empty()) {
         Logger::error("No peers found.");
-        return;
+        return false;
     }
 
     uint64_t fileSize = tr.fileSize;
     if (fileSize == 0) {
         Logger::error("Invalid file size received.");
-        return;
+        return false;
     }
 
-    uint32_t totalChunks = (uint32_t)((fileSize + CHUNK_SIZE - 1) / CHUNK_SIZE);
-    Logger::log("File size: " + std::to_string(fileSize) + " bytes. Chunks: " + std::to_string(totalChunks));
+    Logger::log("File size: " + std::to_string(fileSize) + " bytes.");
 
-    // Fetch Metadata from a peer
-    std::vector<std::string> chunkHashes;
+    // A bundle's manifest carries its chunk hashes and is checked against the
+    // bundle hash itself. Peers that do not know it as a bundle say so; peers
+    // that predate bundles drop the connection.
+    std::shared_ptr<BundleManifest> bundle;
     for (const auto& p : tr.peers) {
-        chunkHashes = fetchMetadata(p, fileHash, totalChunks);
-        if (!chunkHashes.empty()) {
-             if(chunkHashes.size() == totalChunks) break;
-             else chunkHashes.clear(); // Mismatch?
+        std::string data;
+        bool isBundle = false;
+        if (!fetchManifest(p, fileHash, data, isBundle)) continue;
+        if (!isBundle) break;
+        auto manifest = std::make_shared<BundleManifest>();
+        if (SHA256::digest(data) == fileHash && Bundle::decode(data, *manifest) &&
+            manifest->chunkSize == CHUNK_SIZE && manifest->totalSize() == fileSize) {
+            bundle = manifest;
+            break;
+        }
+        Logger::error("Peer " + p.ip + ":" + std::to_string(p.port) + " sent a bad bundle manifest");
+    }
+    // What the chunk hashes were taken with: SHA-256 for bundles, otherwise
+    // as the seeder says.
+    HashAlgorithm algorithm = HashAlgorithm::SHA256;
+    // A Merkle identity commits to the file size, chunk size, tree root and
+    // hash algorithm.
+    // Chunk hashes then come a span at a time, with proofs, as chunks are
+    // verified, so the download starts without the whole list.
+    std::shared_ptr<MerkleHashes> merkle;
+    for (size_t i = 0; i < tr.peers.size() && !bundle; ++i) {
+        const PeerConnection& p = tr.peers[i];
+        uint64_t treeSize = 0;
+        uint32_t treeChunkSize = 0;
+        Digest root;
+        HashAlgorithm treeHash;
+        bool isMerkle = false;
+        if (!fetchTree(p, fileHash, treeSize, treeChunkSize, root, treeHash, isMerkle)) continue;
+        if (!isMerkle) break;
+        if (treeSize == fileSize && treeChunkSize == CHUNK_SIZE &&
+            MerkleTree::identity(treeSize, treeChunkSize, root, treeHash) == fileHash) {
+            algorithm = treeHash;
+            std::vector<PeerConnection> sources = tr.peers;
+            std::rotate(sources.begin(), sources.begin() + i, sources.end()); // The one that answered first
+            merkle = std::make_shared<MerkleHashes>(
+                root, ChunkLayout::fixed(fileSize, CHUNK_SIZE).count(), MERKLE_CACHE_SPANS,
+                [this, fileHash, sources](uint32_t span, std::vector<Digest>& hashes, std::vector<Digest>& proof) {
+                    for (const PeerConnection& source : sources) {
+                        if (reputation.banned(PeerReputation::keyOf(source.ip, source.port))) continue;
+                        if (fetchSpan(source, fileHash, span, hashes, proof)) return true;
+                    }
+                    Logger::error("No peer sent hash span " + std::to_string(span) + " of " + fileHash.hex());
+                    return false;
+                });
+            break;
         }
+        Logger::error("Peer " + p.ip + ":" + std::to_string(p.port) + " sent a bad Merkle root");
+    }
+    if (!spec.only.empty() && !bundle) {
+        Logger::error("Only bundles can be downloaded in part; " + fileHash.hex() + " is a single file.");
+        return false;
+    }
+    if (!spec.only.empty() && spec.stream) {
+        Logger::error("A streaming download takes the whole bundle.");
+        return false;
+    }
+    std::error_code basisError;
+    if (!spec.basis.empty() && (bundle || merkle || !fs::is_regular_file(spec.basis, basisError) ||
+                                fs::equivalent(spec.basis, outputName, basisError))) {
+        Logger::error("A basis must be an existing file other than the output; bundles and Merkle files take none.");
+        return false;
+    }
+
+    // A sidecar left by an interrupted run supplies the chunk hashes and
+    // boundaries and the chunks already verified on disk.
+    std::string resumePath = ResumeFile::pathFor(outputName);
+    ResumeState saved;
+    ChunkLayout layout;
+    std::vector<Digest> chunkHashes;
+    bool resumed = ResumeFile::load(resumePath, saved) && saved.fileHash == fileHash &&
+                   saved.fileSize == fileSize && saved.merkle == (merkle != nullptr) && fs::exists(outputName);
+    if (resumed) {
+        ChunkLayout savedLayout = saved.chunkSize == 0 ? ChunkLayout::variable(saved.chunkLengths)
+                                                       : ChunkLayout::fixed(fileSize, saved.chunkSize);
+        resumed = (saved.chunkSize == 0 || saved.chunkSize == CHUNK_SIZE) && savedLayout.fileSize() == fileSize &&
+                  (saved.merkle || saved.chunkHashes.size() == savedLayout.count()) &&
+                  (!bundle || saved.chunkHashes == bundle->chunkHashes) &&
+                  ((!bundle && !merkle) || saved.hash == algorithm);
+        if (resumed) {
+            layout = savedLayout;
+            chunkHashes = saved.chunkHashes;
+            algorithm = saved.hash;
+        }
+    }
+    if (bundle) {
+        layout = ChunkLayout::fixed(fileSize, CHUNK_SIZE);
+        chunkHashes = bundle->chunkHashes;
+    }
+    if (merkle) layout = ChunkLayout::fixed(fileSize, CHUNK_SIZE);
+
+    // Fetch Metadata from a peer. It lists the chunk boundaries too when the
+    // seeder cut the file by content.
+    for (const auto& p : tr.peers) {
+        if (!chunkHashes.empty() || merkle) break;
+        std::vector<uint32_t> lengths;
+        chunkHashes = fetchMetadata(p, fileHash, lengths, algorithm);
+        layout = lengths.empty() ? ChunkLayout::fixed(fileSize, CHUNK_SIZE) : ChunkLayout::variable(lengths);
+        if (layout.fileSize() != fileSize || chunkHashes.size() != layout.count()) chunkHashes.clear(); // Mismatch
     }
     
-    if (chunkHashes.empty()) {
+    if (chunkHashes.empty() && !merkle) {
         Logger::error("Could not fetch metadata from any peer. Cannot verify chunks.");
         // Should we abort? Yes, for integrity goal.
-        return; 
+        return false;
+    }
+    uint32_t totalChunks = layout.count();
+    if (merkle) {
+        Logger::log("Merkle root " + merkle->root().hex() + " checks out; fetching chunk hashes as needed.");
+    } else {
+        Logger::log("Received " + std::to_string(chunkHashes.size()) + " " + Hasher::name(algorithm) +
+                    " chunk hashes" + (layout.isFixed() ? "." : " of content-defined chunks."));
+    }
+    // The expected hash of chunk `index`, from the list or the Merkle tree
+    auto hashOf = [&](uint32_t index, Digest& out) {
+        if (merkle) return merkle->get(index, out);
+        out = chunkHashes[index];
+        return true;
+    };
+
+    // Chunks this download has to fetch: all of them, or those overlapping the
+    // selected bundle files. A chunk is only served to others once every file
+    // it spans is selected, since the rest of it is never written.
+    std::vector<bool> selected;
+    std::vector<bool> wanted(totalChunks, true);
+    std::vector<bool> servable(totalChunks, true);
+    if (bundle) {
+        selected = bundle->select(spec.only);
+        if (std::find(selected.begin(), selected.end(), true) == selected.end()) {
+            Logger::error("No files in bundle " + fileHash.hex() + " match the selection.");
+            return false;
+        }
+        for (uint32_t i = 0; i < totalChunks; ++i) {
+            bool any = false;
+            bool all = true;
+            for (const BundleSegment& seg : bundle->locate(layout.offset(i), layout.length(i))) {
+                any = any || selected[seg.file];
+                all = all && selected[seg.file];
+            }
+            wanted[i] = any;
+            servable[i] = all;
+        }
+        Logger::log("Bundle of " + std::to_string(bundle->files.size()) + " files, " +
+                    std::to_string(std::count(selected.begin(), selected.end(), true)) + " selected.");
+    }
+    uint32_t wantedChunks = (uint32_t)std::count(wanted.begin(), wanted.end(), true);
+
+    auto have = std::make_shared<ChunkBitfield>(totalChunks);
+    if (spec.recheck && fs::exists(outputName)) {
+        uint32_t valid = recheckChunks(outputName, layout, algorithm, hashOf, bundle.get(), *have);
+        Logger::log("Recheck found " + std::to_string(valid) + " of " + std::to_string(totalChunks) + " chunks valid.");
+    } else if (resumed) {
+        std::vector<bool> bits = ChunkBitfield::fromBytes(saved.haveBits.data(), totalChunks);
+        for (uint32_t i = 0; i < totalChunks; ++i) {
+            if (bits[i]) have->set(i);
+        }
+        Logger::log("Resuming with " + std::to_string(have->countSet()) + " of " + std::to_string(totalChunks) + " chunks.");
+    }
+    // Opened once for the whole download and shared by every worker
+    std::unique_ptr<OutputFile> output;
+    std::unique_ptr<BundleOutput> bundleOutput;
+    if (bundle) bundleOutput = BundleOutput::open(outputName, bundle, selected);
+    else output = OutputFile::open(outputName, fileSize);
+    if (!output && !bundleOutput) {
+        Logger::error("Cannot open output " + outputName);
+        return false;
+    }
+    auto writeOutput = [&](uint64_t offset, const std::vector<char>& data) {
+        return output ? output->writeAt(offset, data.data(), data.size())
+                      : bundleOutput->writeAt(offset, data.data(), data.size());
+    };
+
+    // With a basis, only chunks that changed since that version are fetched
+    if (!spec.basis.empty()) {
+        uint32_t copied = 0;
+        uint64_t saved = copyFromBasis(spec.basis, layout, chunkHashes, algorithm, wanted, *have, copied, writeOutput);
+        downloadStats.reusedChunks += copied;
+        downloadStats.reusedBytes += saved;
+        if (control) control->addSaved(saved);
+        Logger::log("Basis " + spec.basis + " supplied " + std::to_string(copied) + " of " +
+                    std::to_string(wantedChunks) + " chunks, " + std::to_string(saved) + " bytes saved.");
+    }
+
+    // Chunks this node already holds as part of other files are copied
+    // instead of fetched; the copies are checked like any download. Merkle
+    // files skip this, as it would need every chunk hash up front.
+    uint32_t reused = 0;
+    if (!chunkHashes.empty()) {
+        std::vector<char> buffer;
+        for (uint32_t i = 0; i < totalChunks; ++i) {
+            if (have->has(i) || !wanted[i]) continue;
+            for (const auto& [source, sourceIndex] : chunkHolders(chunkHashes[i], fileHash)) {
+                if (!loadChunk(*source, sourceIndex, buffer)) continue;
+                if (Hasher::digest(algorithm, buffer.data(), buffer.size()) != chunkHashes[i]) continue;
+                if (writeOutput(layout.offset(i), buffer)) {
+                    have->set(i);
+                    ++reused;
+                    downloadStats.reusedBytes += buffer.size();
+                    if (control) control->addSaved(buffer.size());
+                }
+                break;
+            }
+        }
+    }
+    if (reused) {
+        downloadStats.reusedChunks += reused;
+        Logger::log("Reused " + std::to_string(reused) + " chunks held locally.");
+    }
+
+    // What other leechers are offered; the same bitfield unless part of a
+    // bundle was left out.
+    std::shared_ptr<ChunkBitfield> serving = have;
+    if (wantedChunks < totalChunks || std::find(servable.begin(), servable.end(), false) != servable.end()) {
+        serving = std::make_shared<ChunkBitfield>(totalChunks);
+        for (uint32_t i = 0; i < totalChunks; ++i) {
+            if (have->has(i) && servable[i]) serving->set(i);
+        }
+    }
+
+
+    // Persists the verified chunks. The data is synced first, so the sidecar
+    // never lists a chunk that a crash could lose.
+    ResumeState resume;
+    resume.fileHash = fileHash;
+    resume.fileSize = fileSize;
+    resume.chunkSize = layout.chunkSize();
+    if (!layout.isFixed()) resume.chunkLengths = layout.lengths();
+    resume.chunkHashes = chunkHashes;
+    resume.merkle = merkle != nullptr;
+    resume.hash = algorithm;
+    std::mutex resumeMutex;
+    auto lastSave = std::chrono::steady_clock::now();
+    auto saveResume = [&]() {
+        resume.haveBits = have->toBytes();
+        if (!(output ? output->sync() : bundleOutput->sync())) return;
+        if (!ResumeFile::save(resumePath, resume)) Logger::error("Failed to write " + resumePath);
+        lastSave = std::chrono::steady_clock::now();
+    };
+    saveResume();
+
+    // Register the partial file so this node serves the chunks it already
+    // holds to other leechers while the download runs.
+    {
+        auto meta = std::make_shared<FileMetadata>();
+        fs::path name = fs::path(outputName).lexically_normal();
+        if (!name.has_filename()) name = name.parent_path();
+        meta->fileName = name.filename().string();
+        meta->fileSize = fileSize;
+        meta->fileHash = fileHash;
+        meta->chunkHashes = chunkHashes;
+        meta->hash = algorithm;
+        meta->layout = layout;
+        meta->fullPath = outputName;
+        meta->have = serving;
+        meta->bundle = bundle;
+        meta->merkleHashes = merkle;
+
+        bool registered = false;
+        {
+            // A paused run of this same download left its stale entry behind
+            std::lock_guard<std::mutex> lock(dataMutex);
+            auto it = knownFiles.find(fileHash);
+            if (it == knownFiles.end() || (it->second->have && it->second->fullPath == outputName)) {
+                knownFiles[fileHash] = meta;
+                registered = true;
+            }
+        }
+        if (registered) {
+            fileCache.invalidate(fileHash);
+            if (!chunkHashes.empty()) chunkStore.addFile(fileHash, chunkHashes, layout.lengths());
+            advertiseFile(fileHash, fileSize, meta->fileName);
+        }
     }
-    Logger::log("Received " + std::to_string(chunkHashes.size()) + " chunk hashes.");
 
     // Parallel Download
-    std::atomic<uint32_t> chunksDownloaded{0};
+    uint32_t haveWanted = 0;
+    for (uint32_t i = 0; i < totalChunks; ++i) {
+        if (have->has(i) && wanted[i]) ++haveWanted;
+    }
+    std::atomic<uint32_t> chunksDownloaded{haveWanted};
     std::vector<std::thread> workers;
+    TransferBudget* budget = control ? &control->budget() : nullptr;
+    uint32_t jobId = control ? control->jobId() : 0;
+    auto stopped = [&]() { return control && control->stopRequested(); };
+    if (control) control->setProgress(chunksDownloaded, wantedChunks);
     
-    // Simple work queue: atomic counter
-    std::atomic<uint32_t> nextChunk{0};
+    // Rarest-first work queue fed by every peer's BITFIELD/HAVE
+    uint32_t blockSize = (uint32_t)std::clamp<size_t>(options.blockSize, MIN_BLOCK_SIZE, CHUNK_SIZE);
+    PiecePicker picker(layout, blockSize);
+    picker.setEndgameThreshold((uint32_t)std::max(0, options.endgameChunks));
+    for (uint32_t i = 0; i < totalChunks; ++i) {
+        if (have->has(i) || !wanted[i]) picker.markDone(i);
+    }
+    std::atomic<bool> endgameLogged{false};
+
+    // Streaming: verified chunks wait in `reorder` until every earlier one
+    // has gone to the sink. The picker fetches in order and only within
+    // streamWindow chunks of the cursor, which bounds what waits here.
+    std::mutex streamMutex;
+    std::condition_variable streamReady;
+    std::map<uint32_t, std::vector<char>> reorder;
+    uint32_t streamCursor = 0;
+    bool streaming = (bool)spec.stream;
+    bool streamClosing = false;
+    std::thread streamer;
+    if (streaming) picker.setSequential((uint32_t)std::max(1, options.streamWindow));
+
+    // Chunks being assembled from blocks, possibly from several peers
+    std::mutex assemblyMutex;
+    std::map<uint32_t, std::vector<char>> assembly;
     
-    int numWorkers = 4; // Or number of peers? Let's use 4 threads.
-
-    for(int i=0; i<numWorkers; ++i) {
-        workers.emplace_back([&, i]() {
-            while(true) {
-                uint32_t chunkIdx = nextChunk.fetch_add(1);
-                if(chunkIdx >= totalChunks) break;
-                
-                // Try peers until success
-                bool success = false;
-                for(const auto& peer : tr.peers) {
-                    SocketType sock = SocketUtils::createSocket();
-                    if(SocketUtils::connectToServer(sock, peer.ip, peer.port)) {
-                        PacketHeader req;
-                        req.type = PacketType::REQUEST_CHUNK;
-                        req.length = 32 + sizeof(uint32_t);
-                        
-                        std::vector<uint8_t> rawHash(32);
-                        for (size_t k = 0; k < 32; ++k) {
-                             std::string byteString = fileHash.substr(k * 2, 2);
-                             rawHash[k] = (uint8_t)strtol(byteString.c_str(), NULL, 16);
-                        }
-                        
-                        SocketUtils::sendAll(sock, &req, sizeof(req));
-                        SocketUtils::sendAll(sock, rawHash.data(), 32);
-                        SocketUtils::sendAll(sock, &chunkIdx, sizeof(chunkIdx));
-
-                        PacketHeader resp;
-                        if(SocketUtils::recvAll(sock, &resp, sizeof(resp)) && resp.type == PacketType::SEND_CHUNK) {
-                            // Read payload
-                            // [Hash 32] [Index u32] [DataSize u32] [Data...]
-                            std::vector<char> skipHash(32);
-                            SocketUtils::recvAll(sock, skipHash.data(), 32);
-                            uint32_t idx;
-                            SocketUtils::recvAll(sock, &idx, sizeof(idx));
-                            uint32_t dSize;
-                            SocketUtils::recvAll(sock, &dSize, sizeof(dSize));
-                            
-                            std::vector<char> data(dSize);
-                            if(SocketUtils::recvAll(sock, data.data(), dSize)) {
-                                // VERIFY HASH
-                                std::string chunkS(data.data(), dSize);
-                                std::string calcd = SHA256::hash(chunkS);
-                                if (calcd == chunkHashes[chunkIdx]) {
-                                    writeChunk(outputName, chunkIdx, data);
-                                    success = true;
-                                    uint32_t val = chunksDownloaded.fetch_add(1) + 1;
-                                    
-                                    // Progress Bar Logic
-                                    // Avoid strict locking for speed, just print occasionally?
-                                    // Better: Mutex for cout to avoid tearing
-                                    {
-                                        static std::mutex consoleMutex;
-                                        std::lock_guard<std::mutex> lock(consoleMutex);
-                                        float progress = (float)val / totalChunks;
-                                        int barWidth = 50;
-                                        std::cout << "\r[";
-                                        int pos = barWidth * progress;
-                                        for (int b = 0; b < barWidth; ++b) {
-                                            if (b < pos) std::cout << "=";
-                                            else if (b == pos) std::cout << ">";
-                                            else std::cout << " ";
-                                        }
-                                        std::cout << "] " << int(progress * 100.0) << "% " << std::flush;
-                                    }
-                                    
-                                    // Logger::log("Thread " + std::to_string(i) + " downloaded/verified chunk " + std::to_string(chunkIdx));
-                                } else {
-                                     Logger::error("Hash Mismatch for chunk " + std::to_string(chunkIdx));
-                                     // success = false;
-                                }
-                            }
+    // One session per peer, banned peers aside. Tracker order says nothing
+    // about speed; shuffle so every leecher does not favour the same peers
+    // when there are too many.
+    tr.peers.erase(std::remove_if(tr.peers.begin(), tr.peers.end(), [&](const PeerConnection& p) {
+        return reputation.banned(PeerReputation::keyOf(p.ip, p.port));
+    }), tr.peers.end());
+    if (tr.peers.empty()) Logger::error("Every peer of " + fileHash.hex() + " is banned.");
+    std::shuffle(tr.peers.begin(), tr.peers.end(), std::mt19937(std::random_device()()));
+    size_t peerCount = std::min<size_t>(tr.peers.size(), MAX_DOWNLOAD_PEERS);
+    size_t maxDepth = (size_t)std::max(1, options.pipelineDepth);
+    std::vector<std::shared_ptr<PeerRate>> rates;
+    std::vector<std::unique_ptr<PeerSession>> sessions;
+    for (size_t i = 0; i < peerCount; ++i) {
+        rates.push_back(std::make_shared<PeerRate>(tr.peers[i].ip, tr.peers[i].port, maxDepth));
+        sessions.push_back(std::make_unique<PeerSession>(tr.peers[i]));
+    }
+    {
+        std::lock_guard<std::mutex> lock(peerRatesMutex);
+        peerRates[fileHash] = rates;
+    }
+    if (control) {
+        control->setInterrupt([&]() {
+            for (auto& s : sessions) s->interrupt();
+        });
+    }
+
+    // Missing chunks that occur more than once in the file, such as runs of
+    // zeros in a disk image. Only the first occurrence is fetched; writing it
+    // completes the others.
+    std::map<Digest, std::vector<uint32_t>> repeats;
+    if (!chunkHashes.empty()) {
+        std::vector<uint32_t> order;
+        for (uint32_t i = 0; i < totalChunks; ++i) {
+            if (wanted[i] && !have->has(i)) order.push_back(i);
+        }
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return chunkHashes[a] < chunkHashes[b];
+        });
+        for (size_t i = 0, j = 0; i < order.size(); i = j) {
+            for (j = i + 1; j < order.size() && chunkHashes[order[j]] == chunkHashes[order[i]]; ++j) {}
+            if (j - i > 1) repeats.emplace(chunkHashes[order[i]], std::vector<uint32_t>(order.begin() + i, order.begin() + j));
+        }
+    }
+    for (const auto& [hash, copies] : repeats) {
+        for (size_t k = 1; k < copies.size(); ++k) picker.markDone(copies[k]);
+    }
+
+    // Runs on the pipeline's writer thread, one chunk at a time.
+    auto onVerified = [&](uint32_t chunkIdx, const std::vector<char>& data) {
+        std::vector<uint32_t> completed{chunkIdx};
+        auto repeat = repeats.empty() ? repeats.end() : repeats.find(chunkHashes[chunkIdx]);
+        if (repeat != repeats.end()) {
+            for (uint32_t other : repeat->second) {
+                if (other != chunkIdx && !have->has(other)) completed.push_back(other);
+            }
+        }
+        for (uint32_t idx : completed) {
+            if (!writeOutput(layout.offset(idx), data)) {
+                Logger::error("Failed to write chunk " + std::to_string(idx) + " to " + outputName);
+                picker.chunkFailed(chunkIdx);
+                return;
+            }
+        }
+        downloadStats.reusedChunks += completed.size() - 1;
+        downloadStats.reusedBytes += (completed.size() - 1) * data.size();
+        for (uint32_t idx : completed) {
+            have->set(idx);
+            if (serving != have && servable[idx]) serving->set(idx);
+            picker.markDone(idx);
+        }
+        if (spec.stream) {
+            std::lock_guard<std::mutex> lock(streamMutex);
+            // The streamer may already have read them back from disk
+            for (uint32_t idx : completed) {
+                if (streaming && idx >= streamCursor) reorder.emplace(idx, data);
+            }
+            streamReady.notify_all();
+        }
+        {
+            // Batched: at most one data sync and sidecar write per RESUME_INTERVAL
+            std::lock_guard<std::mutex> lock(resumeMutex);
+            if (std::chrono::steady_clock::now() - lastSave >= RESUME_INTERVAL) saveResume();
+        }
+        if (picker.finished()) {
+            // Workers still waiting on slow peers have nothing left to wait for
+            for (auto& s : sessions) s->interrupt();
+        }
+        uint32_t val = chunksDownloaded.fetch_add((uint32_t)completed.size()) + (uint32_t)completed.size();
+        if (control) control->setProgress(val, wantedChunks);
+        
+        // Progress Bar Logic
+        // Avoid strict locking for speed, just print occasionally?
+        // Better: Mutex for cout to avoid tearing
+        // Jobs run side by side and report progress through `jobs` instead
+        if (!control) {
+            static std::mutex consoleMutex;
+            std::lock_guard<std::mutex> lock(consoleMutex);
+            float progress = (float)val / wantedChunks;
+            int barWidth = 50;
+            std::cout << "\r[";
+            int pos = barWidth * progress;
+            for (int b = 0; b < barWidth; ++b) {
+                if (b < pos) std::cout << "=";
+                else if (b == pos) std::cout << ">";
+                else std::cout << " ";
+            }
+            std::cout << "] " << int(progress * 100.0) << "% " << std::flush;
+        }
+    };
+
+    // Whole chunks are hashed and written off the network threads, so a
+    // socket keeps receiving while earlier chunks are checked and stored.
+    size_t verifyThreads = hashThreadCount();
+    auto pipeline = std::make_shared<ChunkPipeline>(
+        verifyThreads, verifyThreads * VERIFY_QUEUE_PER_THREAD, WRITE_QUEUE_CHUNKS,
+        [&](uint32_t chunkIdx, const std::vector<char>& data) {
+            Digest expected;
+            return hashOf(chunkIdx, expected) && Hasher::digest(algorithm, data.data(), data.size()) == expected;
+        },
+        [&](uint32_t chunkIdx) {
+            // Retried later, whole and from one peer; that peer is to blame if it fails again
+            uint32_t attempt = picker.failureCount(chunkIdx) + 1;
+            auto delay = PeerReputation::backoff(attempt, CHUNK_RETRY_BASE, CHUNK_RETRY_MAX);
+            std::vector<int> contributors = picker.chunkFailed(chunkIdx, delay);
+            // Without its hash the chunk could not be checked, which is no one's fault
+            bool unchecked = merkle && !merkle->cached(chunkIdx);
+            Logger::error((unchecked ? "No hash yet for chunk " : "Hash Mismatch for chunk ") +
+                          std::to_string(chunkIdx) + " (attempt " + std::to_string(attempt) + ")");
+            for (int contributor : unchecked ? std::vector<int>() : contributors) {
+                std::string key = PeerReputation::keyOf(tr.peers[contributor].ip, tr.peers[contributor].port);
+                if (contributors.size() > 1) {
+                    reputation.onSuspect(key);
+                } else if (reputation.onCorrupt(key)) {
+                    Logger::error("Banning peer " + key + " for sending corrupt chunks");
+                }
+            }
+            if (attempt >= MAX_CHUNK_ATTEMPTS) {
+                Logger::error("Giving up on chunk " + std::to_string(chunkIdx) + " after " +
+                              std::to_string(attempt) + " corrupt copies");
+                picker.giveUp(chunkIdx);
+            }
+        },
+        onVerified);
+    {
+        std::lock_guard<std::mutex> lock(peerRatesMutex);
+        pipelines[fileHash] = pipeline;
+    }
+
+    // Hands chunks to the sink in file order, reading those verified by an
+    // earlier run back from disk, until the download ends or the sink quits.
+    if (streaming) streamer = std::thread([&]() {
+        std::shared_ptr<FileHandle> file = bundle ? nullptr : FileUtils::openRead(outputName);
+        std::vector<char> data;
+        uint32_t next = 0;
+        while (next < totalChunks) {
+            bool fromDisk = false;
+            {
+                std::unique_lock<std::mutex> lock(streamMutex);
+                streamReady.wait(lock, [&] { return reorder.count(next) || have->has(next) || streamClosing; });
+                auto it = reorder.find(next);
+                if (it != reorder.end()) {
+                    data.swap(it->second);
+                    reorder.erase(it);
+                } else if (have->has(next)) {
+                    fromDisk = true;
+                } else {
+                    break; // Ended with a gap
+                }
+            }
+            uint64_t offset = layout.offset(next);
+            if (fromDisk) {
+                data.resize(picker.chunkLength(next));
+                bool read = bundle ? Bundle::readAt(outputName, *bundle, offset, data.data(), data.size())
+                                   : file && FileUtils::readAt(file->fd(), data.data(), data.size(), offset);
+                if (!read) {
+                    Logger::error("Cannot read back chunk " + std::to_string(next) + " to stream it");
+                    break;
+                }
+            }
+            if (!spec.stream(offset, data.data(), data.size())) {
+                Logger::error("Stream consumer of " + fileHash.hex() + " went away; downloading on without it");
+                break;
+            }
+            if (next == 0) {
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+                Logger::log("Streaming " + fileHash.hex() + ": first bytes " + std::to_string(ms.count()) + " ms after start");
+            }
+            ++next;
+            {
+                std::lock_guard<std::mutex> lock(streamMutex);
+                streamCursor = next;
+            }
+            picker.setCursor(next);
+            pipeline->notifyProgress(); // Wakes workers waiting for room in the window
+        }
+        {
+            std::lock_guard<std::mutex> lock(streamMutex);
+            streaming = false;
+            reorder.clear();
+        }
+        picker.setSequential(0); // Whatever is left, rarest first
+        spec.stream(layout.offset(next), nullptr, 0);
+    });
+
+    // Copies a received block into its chunk's pooled buffer and hands the
+    // chunk to the pipeline once it is whole.
+    auto onBlock = [&](int peerId, const BlockRequest& req, const std::vector<char>& data) {
+        std::vector<char> chunk;
+        {
+            std::lock_guard<std::mutex> lock(assemblyMutex);
+            if (!picker.needsBlock(req)) {
+                // Another peer's copy won the race (endgame)
+                downloadStats.wastedBytes += data.size();
+                return false;
+            }
+            auto it = assembly.find(req.chunk);
+            if (it == assembly.end()) {
+                it = assembly.emplace(req.chunk, pipeline->acquireBuffer(picker.chunkLength(req.chunk))).first;
+            }
+            memcpy(it->second.data() + req.offset, data.data(), data.size());
+            if (!picker.blockDone(peerId, req)) return true;
+            chunk.swap(it->second);
+            assembly.erase(it);
+        }
+        return pipeline->submit(req.chunk, std::move(chunk));
+    };
+
+    // Learns what the peer holds. Peers that predate BITFIELD drop the
+    // connection instead; they are assumed to have every chunk and are sent
+    // whole-chunk requests.
+    auto exchange = [&](PeerSession& session, int peerId, bool& legacy) {
+        std::vector<bool> theirs;
+        legacy = false;
+        if (!session.exchangeBitfield(fileHash, totalChunks, serving->toBytes(), theirs)) {
+            if (!session.connect()) return false;
+            theirs.assign(totalChunks, true);
+            legacy = true;
+        }
+        picker.setPeerBitfield(peerId, theirs);
+        return true;
+    };
+
+    for(size_t i=0; i<peerCount; ++i) {
+        int peerId = (int)i;
+        workers.emplace_back([&, peerId]() {
+            // Keeps a persistent session with as many block requests in flight
+            // as the peer's bandwidth-delay product calls for, asking only for
+            // chunks this peer is known to have.
+            PeerSession& session = *sessions[peerId];
+            PeerRate& rate = *rates[peerId];
+            session.setRecvTimeout((int)std::chrono::duration_cast<std::chrono::milliseconds>(STALL_TIMEOUT).count());
+            ChunkResponse resp; // Reused, so its receive buffer is allocated once
+            std::string peerKey = PeerReputation::keyOf(tr.peers[peerId].ip, tr.peers[peerId].port);
+            bool legacy = false;
+            bool holdsSlot = false; // One of the job's connections from the budget
+            int idlePolls = 0;
+            // Sleeps in short steps so a finished or stopped download is not held up
+            auto backOff = [&](uint32_t failures) {
+                auto until = std::chrono::steady_clock::now() +
+                             PeerReputation::backoff(failures, CONNECT_RETRY_BASE, CONNECT_RETRY_MAX);
+                while (std::chrono::steady_clock::now() < until && !picker.finished() && !stopped()) {
+                    std::this_thread::sleep_for(RETRY_POLL);
+                }
+            };
+            while (!picker.finished() && !stopped()) {
+                if (reputation.banned(peerKey)) {
+                    for (const BlockRequest& r : session.takeOutstanding()) picker.releaseBlock(peerId, r);
+                    session.close();
+                    rate.setState(PeerState::BANNED);
+                    picker.removePeer(peerId);
+                    break;
+                }
+                if (holdsSlot && session.isOpen() && budget->shouldYield(jobId)) {
+                    // Over this job's share while another job waits for a connection
+                    for (const BlockRequest& r : session.takeOutstanding()) picker.releaseBlock(peerId, r);
+                    session.close();
+                    holdsSlot = false;
+                }
+                if (budget && !holdsSlot) {
+                    rate.setState(PeerState::CONNECTING);
+                    if (!budget->acquireConnection(jobId, [&]() { return picker.finished() || stopped(); })) break;
+                    holdsSlot = true;
+                }
+                if (!session.isOpen()) {
+                    rate.setState(PeerState::CONNECTING);
+                    if (!session.connect() || !exchange(session, peerId, legacy)) {
+                        session.close();
+                        // Retried with growing delays until it has failed too often in a row
+                        uint32_t failures = reputation.onFailure(peerKey);
+                        if (failures >= MAX_CONNECT_ATTEMPTS) {
+                            rate.setState(PeerState::FAILED);
+                            break;
                         }
+                        backOff(failures);
+                        continue;
+                    }
+                }
+
+                // Keep the pipeline full
+                bool broken = false;
+                BlockRequest req;
+                size_t depth = rate.targetDepth(blockSize);
+                if (session.outstanding() == 0) rate.touch();
+                while (session.outstanding() < depth && picker.pickBlock(peerId, req, legacy)) {
+                    bool sent = legacy ? session.sendChunkRequest(fileHash, req)
+                                       : session.sendBlockRequest(fileHash, req);
+                    if (!sent) {
+                        picker.releaseBlock(peerId, req);
+                        broken = true;
+                        break;
                     }
-                    SocketUtils::closeSocket(sock);
-                    if(success) break;
                 }
-                
-                if(!success) {
-                    Logger::error("Failed to download chunk " + std::to_string(chunkIdx));
-                    // Retry? For now, we leave it.
+                if (!broken && session.outstanding() == 0 && (pipeline->pending() > 0 || picker.waitingForRetry() ||
+                                                                picker.waitingForWindow())) {
+                    // What is left may all be waiting for verification, for
+                    // a retry, or for the stream consumer to make room; a
+                    // failed chunk goes back to the picker.
+                    rate.setState(PeerState::IDLE);
+                    pipeline->waitForProgress(RETRY_POLL);
+                    continue;
+                }
+                if (!broken && session.outstanding() == 0) {
+                    // Nothing we still need is on this peer; give it time to acquire more
+                    rate.setState(PeerState::IDLE);
+                    if (++idlePolls > MAX_IDLE_POLLS) break;
+                    std::this_thread::sleep_for(AVAILABILITY_POLL);
+                    if (!picker.finished() && !exchange(session, peerId, legacy)) session.close();
+                    continue;
+                }
+                idlePolls = 0;
+                rate.setState(PeerState::ACTIVE);
+
+                bool received = !broken && session.readChunkResponse(resp);
+                downloadStats.wastedBytes += session.takeWastedBytes();
+                if (!received) {
+                    for (const BlockRequest& r : session.takeOutstanding()) picker.releaseBlock(peerId, r);
+                    session.close();
+                    if (rate.stalled(STALL_TIMEOUT)) {
+                        // Hand its chunks to the other peers for the rest of the download
+                        Logger::error("Peer " + tr.peers[peerId].ip + ":" + std::to_string(tr.peers[peerId].port) +
+                                      " stalled, dropping it");
+                        rate.setState(PeerState::STALLED);
+                        picker.removePeer(peerId);
+                        if (holdsSlot) budget->releaseConnection(jobId);
+                        return;
+                    }
+                    if (picker.finished() || stopped()) break; // Interrupted on purpose
+                    uint32_t failures = reputation.onFailure(peerKey);
+                    if (failures >= MAX_CONNECT_ATTEMPTS) {
+                        rate.setState(PeerState::FAILED);
+                        break;
+                    }
+                    backOff(failures);
+                    continue;
+                }
+                rate.onDelivered(resp.data.size(), resp.latency);
+                if (control) control->addBytes(resp.data.size());
+                if (budget) budget->consume(resp.data.size());
+                for (uint32_t idx : session.takeHaves()) picker.peerHas(peerId, idx);
+
+                if (!resp.ok || resp.data.size() != resp.request.length) {
+                    if (resp.ok) reputation.onFailure(peerKey); // Truncated reply
+                    picker.peerLacks(peerId, resp.request.chunk);
+                    picker.releaseBlock(peerId, resp.request);
+                    continue;
+                }
+                reputation.onSuccess(peerKey);
+                onBlock(peerId, resp.request, resp.data);
+
+                // Endgame: withdraw requests another peer has already answered
+                if (!legacy && picker.inEndgame()) {
+                    if (!endgameLogged.exchange(true)) {
+                        downloadStats.endgames++;
+                        Logger::log("Entering endgame for " + fileHash.hex());
+                    }
+                    for (const BlockRequest& r : session.outstandingRequests()) {
+                        if (picker.needsBlock(r)) continue;
+                        if (!session.cancelRequest(fileHash, r)) break;
+                        downloadStats.cancelsSent++;
+                    }
                 }
             }
+            for (const BlockRequest& r : session.takeOutstanding()) picker.releaseBlock(peerId, r);
+            session.close();
+            if (holdsSlot) budget->releaseConnection(jobId);
+            if (rate.state() != PeerState::FAILED && rate.state() != PeerState::BANNED) rate.setState(PeerState::DONE);
         });
     }
 
     for(auto& w : workers) w.join();
-    
-    // Final clear line
-    std::cout << "\rDownload complete: 100% [" << std::string(50, '=') << "]" << std::endl;
-    Logger::log("Download finished.");
+    if (control) control->setInterrupt(nullptr);
+    pipeline->finish();
+    if (streamer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(streamMutex);
+            streamClosing = true;
+            streamReady.notify_all();
+        }
+        streamer.join();
+    }
+    downloadStats.duplicateRequests += picker.duplicateRequests();
+    for (auto& [idx, buf] : assembly) pipeline->releaseBuffer(std::move(buf));
+
+    if (merkle) Logger::log("Fetched " + std::to_string(merkle->spansFetched()) + " spans of chunk hashes.");
+    if (picker.finished()) {
+        ResumeFile::remove(resumePath);
+        // Final clear line
+        if (!control) std::cout << "\rDownload complete: 100% [" << std::string(50, '=') << "]" << std::endl;
+        Logger::log("Download finished.");
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(resumeMutex);
+        saveResume();
+    }
+    if (stopped()) {
+        Logger::log("Download of " + fileHash.hex() + " stopped with " + std::to_string(chunksDownloaded) + " of " +
+                    std::to_string(wantedChunks) + " chunks.");
+        return false;
+    }
+    for (uint32_t chunkIdx : picker.missing()) {
+        Logger::error("Failed to download chunk " + std::to_string(chunkIdx));
+    }
+    Logger::log("Download incomplete.");
+    return false;
 }
 
 // ... fetchMetadata implementation ...
 
-std::vector<std::string> PeerNode::fetchMetadata(const PeerConnection& peer, const std::string& fileHash, uint32_t chunkCount) {
-    std::vector<std::string> hashes;
+std::vector<Digest> PeerNode::fetchMetadata(const PeerConnection& peer, const Digest& fileHash,
+                                            std::vector<uint32_t>& lengths, HashAlgorithm& algorithm) {
+    std::vector<Digest> hashes;
+    lengths.clear();
+    algorithm = HashAlgorithm::SHA256;
     SocketType sock = SocketUtils::createSocket();
     if(SocketUtils::connectToServer(sock, peer.ip, peer.port)) {
         PacketHeader req;
         req.type = PacketType::REQUEST_METADATA;
         req.length = 32;
-        
-        std::vector<uint8_t> rawHash(32);
-        for (size_t k = 0; k < 32; ++k) {
-             std::string byteString = fileHash.substr(k * 2, 2);
-             rawHash[k] = (uint8_t)strtol(byteString.c_str(), NULL, 16);
-        }
         SocketUtils::sendAll(sock, &req, sizeof(req));
-        SocketUtils::sendAll(sock, rawHash.data(), 32);
+        SocketUtils::sendAll(sock, fileHash.data(), Digest::SIZE);
         
         PacketHeader resp;
-        if(SocketUtils::recvAll(sock, &resp, sizeof(resp)) && resp.type == PacketType::RESPONSE_METADATA) {
-            uint32_t count = 0;
-            SocketUtils::recvAll(sock, &count, sizeof(count));
-            
-            for(uint32_t i=0; i<count; ++i) {
-                std::vector<uint8_t> rh(32);
-                SocketUtils::recvAll(sock, rh.data(), 32);
-                
-                std::string hashStr;
-                for(int j=0; j<32; j++) {
-                    char buf[3];
-                    sprintf(buf, "%02x", (unsigned char)rh[j]);
-                    hashStr += buf;
-                }
-                hashes.push_back(hashStr);
+        uint32_t count = 0;
+        if (SocketUtils::recvAll(sock, &resp, sizeof(resp)) && resp.type == PacketType::RESPONSE_METADATA &&
+            SocketUtils::recvAll(sock, &count, sizeof(count)) &&
+            resp.length >= sizeof(count) + (uint64_t)count * Digest::SIZE) {
+            // Digests are plain bytes, so the whole list lands in place
+            hashes.resize(count);
+            if (!SocketUtils::recvAll(sock, hashes.data(), (size_t)count * Digest::SIZE)) hashes.clear();
+            // Boundaries of content-defined chunks follow the hashes, then
+            // the algorithm if it is not SHA-256
+            uint64_t rest = resp.length - sizeof(count) - (uint64_t)count * Digest::SIZE;
+            uint64_t lengthsSize = (uint64_t)count * sizeof(uint32_t);
+            bool tagged = rest == sizeof(algorithm) || rest == lengthsSize + sizeof(algorithm);
+            if (rest - (tagged ? sizeof(algorithm) : 0) == lengthsSize) {
+                lengths.resize(count);
+                if (!SocketUtils::recvAll(sock, lengths.data(), count * sizeof(uint32_t))) hashes.clear();
+            }
+            if (tagged &&
+                (!SocketUtils::recvAll(sock, &algorithm, sizeof(algorithm)) || algorithm != HashAlgorithm::BLAKE3)) {
+                hashes.clear();
             }
         }
     }
     SocketUtils::closeSocket(sock);
     return hashes;
 }
+
+bool PeerNode::fetchManifest(const PeerConnection& peer, const Digest& fileHash, std::string& manifest,
+                             bool& isBundle) {
+    bool answered = false;
+    isBundle = false;
+    SocketType sock = SocketUtils::createSocket();
+    if (SocketUtils::connectToServer(sock, peer.ip, peer.port)) {
+        PacketHeader req;
+        req.type = PacketType::REQUEST_MANIFEST;
+        req.length = 32;
+        SocketUtils::sendAll(sock, &req, sizeof(req));
+        SocketUtils::sendAll(sock, fileHash.data(), Digest::SIZE);
+
+        PacketHeader resp;
+        if (SocketUtils::recvAll(sock, &resp, sizeof(resp))) {
+            if (resp.type == PacketType::RESPONSE_ERROR) {
+                answered = true;
+            } else if (resp.type == PacketType::RESPONSE_MANIFEST && resp.length <= MAX_MANIFEST_SIZE) {
+                manifest.resize(resp.length);
+                answered = isBundle = SocketUtils::recvAll(sock, &manifest[0], resp.length);
+            }
+        }
+    }
+    SocketUtils::closeSocket(sock);
+    return answered;
+}
+
+bool PeerNode::fetchTree(const PeerConnection& peer, const Digest& fileHash, uint64_t& fileSize, uint32_t& chunkSize,
+                         Digest& root, HashAlgorithm& algorithm, bool& isMerkle) {
+    bool answered = false;
+    isMerkle = false;
+    algorithm = HashAlgorithm::SHA256;
+    SocketType sock = SocketUtils::createSocket();
+    if (SocketUtils::connectToServer(sock, peer.ip, peer.port)) {
+        PacketHeader req;
+        req.type = PacketType::REQUEST_TREE;
+        req.length = 32;
+        SocketUtils::sendAll(sock, &req, sizeof(req));
+        SocketUtils::sendAll(sock, fileHash.data(), Digest::SIZE);
+
+        PacketHeader resp;
+        if (SocketUtils::recvAll(sock, &resp, sizeof(resp))) {
+            if (resp.type == PacketType::RESPONSE_ERROR) {
+                answered = true;
+            } else if (resp.type == PacketType::RESPONSE_TREE &&
+                       (resp.length == sizeof(fileSize) + sizeof(chunkSize) + Digest::SIZE ||
+                        resp.length == sizeof(fileSize) + sizeof(chunkSize) + Digest::SIZE + sizeof(algorithm))) {
+                bool tagged = resp.length > sizeof(fileSize) + sizeof(chunkSize) + Digest::SIZE;
+                answered = isMerkle = SocketUtils::recvAll(sock, &fileSize, sizeof(fileSize)) &&
+                                      SocketUtils::recvAll(sock, &chunkSize, sizeof(chunkSize)) &&
+                                      SocketUtils::recvAll(sock, root.data(), Digest::SIZE) &&
+                                      (!tagged || SocketUtils::recvAll(sock, &algorithm, sizeof(algorithm)));
+            }
+        }
+    }
+    SocketUtils::closeSocket(sock);
+    return answered;
+}
+
+bool PeerNode::fetchSpan(const PeerConnection& peer, const Digest& fileHash, uint32_t span,
+                         std::vector<Digest>& hashes, std::vector<Digest>& proof) {
+    bool ok = false;
+    SocketType sock = SocketUtils::createSocket();
+    if (SocketUtils::connectToServer(sock, peer.ip, peer.port)) {
+        PacketHeader req;
+        req.type = PacketType::REQUEST_HASHES;
+        req.length = 32 + sizeof(span);
+        SocketUtils::sendAll(sock, &req, sizeof(req));
+        SocketUtils::sendAll(sock, fileHash.data(), Digest::SIZE);
+        SocketUtils::sendAll(sock, &span, sizeof(span));
+
+        // A span never holds more than SPAN hashes, nor a proof more than one per level
+        PacketHeader resp;
+        uint32_t count = 0;
+        uint32_t proofCount = 0;
+        if (SocketUtils::recvAll(sock, &resp, sizeof(resp)) && resp.type == PacketType::RESPONSE_HASHES &&
+            SocketUtils::recvAll(sock, &count, sizeof(count)) && count <= MerkleTree::SPAN) {
+            hashes.resize(count);
+            ok = SocketUtils::recvAll(sock, hashes.data(), (size_t)count * Digest::SIZE) &&
+                 SocketUtils::recvAll(sock, &proofCount, sizeof(proofCount)) && proofCount <= 32;
+            if (ok) {
+                proof.resize(proofCount);
+                ok = SocketUtils::recvAll(sock, proof.data(), (size_t)proofCount * Digest::SIZE);
+            }
+        }
+    }
+    SocketUtils::closeSocket(sock);
+    return ok;
+}
@@ -6,22 +6,52 @@
 #include <thread>
 #include <mutex>
 #include <map>
+#include <list>
 #include <atomic>
+#include <memory>
+#include <functional>
 #include "socket_utils.h"
 #include "protocol.h"
+#include "peer_reply.h"
+#include "file_cache.h"
+#include "chunk_cache.h"
+#include "peer_reputation.h"
+#include "chunk_store.h"
+#include "chunker.h"
+#include "seed_hasher.h"
+#include "merkle_tree.h"
+#include "seed_index.h"
+
+class EventServer;
+class ChunkBitfield;
+class PeerRate;
+class ChunkPipeline;
+class DownloadManager;
+class DownloadControl;
+struct DownloadSpec;
+struct BundleManifest;
 
 struct ChunkInfo {
     uint32_t index;
-    std::string hash;
+    Digest hash;
     bool present;
 };
 
 struct FileMetadata {
     std::string fileName;
     uint64_t fileSize;
-    std::string fileHash;
-    std::vector<std::string> chunkHashes; // NEW: Store per-chunk hashes
-    std::string fullPath;
+    Digest fileHash;
+    std::vector<Digest> chunkHashes; // NEW: Store per-chunk hashes
+    HashAlgorithm hash = HashAlgorithm::SHA256; // What fileHash and chunkHashes were taken with
+    ChunkLayout layout; // Where each chunk starts
+    std::string fullPath; // The file, or the root directory of a bundle
+    std::shared_ptr<ChunkBitfield> have; // Chunks on disk while downloading; null when complete
+    std::shared_ptr<const BundleManifest> bundle; // Null for a single file
+    // A file known by its Merkle identity: seeded, with the levels above
+    // `chunkHashes`, or being downloaded, with the spans fetched so far.
+    std::shared_ptr<const MerkleTree> merkle;
+    std::shared_ptr<MerkleHashes> merkleHashes;
+    std::shared_ptr<const FileStamp> stamp; // A seeded file as hashed; null for bundles and downloads
 };
 
 struct PeerConnection {
@@ -29,45 +59,167 @@ struct PeerConnection {
     uint16_t port;
 };
 
+// How incoming peer connections are served.
+enum class ServeMode {
+    THREADS, // One detached thread per accepted connection (legacy)
+    EPOLL    // Fixed pool of non-blocking I/O threads (see EventServer)
+};
+
+struct NodeOptions {
+    ServeMode serveMode = ServeMode::THREADS;
+    int ioThreads = 4;
+    int pipelineDepth = 32;  // Cap on the adaptive per-peer request window
+    size_t blockSize = 64 * 1024; // Download request size, 16KB up to a whole chunk
+    int endgameChunks = 8;   // Missing chunks at which endgame starts, 0 disables
+    int hashThreads = 0;     // Chunk hashing threads per download or seed, 0 = one per core
+    int maxDownloads = 3;    // Download jobs running at once; the rest queue
+    int maxConnections = 128; // Peer connections across all downloads, 0 = unlimited
+    uint64_t maxDownloadRate = 0; // Bytes per second across all downloads, 0 = unlimited
+    int banThreshold = 3;    // Corrupt chunks after which a peer is banned for the session, 0 never bans
+    int streamWindow = 16;   // Chunks a streaming download fetches ahead of its consumer
+    ChunkingParams chunking; // How seeded files are cut; bundles always use fixed chunks
+    bool merkle = false;     // Identify seeded files by Merkle root (fixed chunks only)
+    HashAlgorithm hash = HashAlgorithm::SHA256; // For seeded files' chunks and file hash; downloads follow the seeder
+    std::string seedIndex;   // Seeded files and their hashes, kept across restarts; empty disables
+    bool zeroCopy = false;   // Serve chunk payloads with sendfile
+    int fdCacheSize = 64;    // Seeded files kept open for reading
+    size_t chunkCacheBytes = 64 * 1024 * 1024; // Hot-chunk cache size, 0 disables
+    CachePolicy cachePolicy = CachePolicy::SLRU;
+};
+
+// Download-side counters across all downloads, to tune endgame.
+struct DownloadStats {
+    std::atomic<uint64_t> endgames{0};          // Downloads that entered endgame
+    std::atomic<uint64_t> duplicateRequests{0}; // Blocks requested from a second peer
+    std::atomic<uint64_t> cancelsSent{0};
+    std::atomic<uint64_t> wastedBytes{0};       // Block payloads received after another copy won
+    std::atomic<uint64_t> reusedChunks{0};      // Copied from local files instead of fetched
+    std::atomic<uint64_t> reusedBytes{0};
+};
+
 class PeerNode {
 public:
-    PeerNode(const std::string& trackerIp, int trackerPort, int myPort);
+    PeerNode(const std::string& trackerIp, int trackerPort, int myPort,
+             const NodeOptions& options = NodeOptions());
     ~PeerNode();
 
     void start();
+    // A directory is seeded as one bundle (see bundle.h). A file is read
+    // once, its chunks hashed in parallel; seedsInProgress() shows how far.
     void seedFile(const std::string& filepath);
-    void downloadFile(const std::string& fileHash, const std::string& outputName);
-    
+    std::vector<std::shared_ptr<const SeedProgress>> seedsInProgress();
+    // Continues from "<outputName>.resume" if an earlier run was interrupted.
+    // With `recheck`, chunks already in the output are verified against
+    // their hashes instead of trusting the sidecar. A bundle is written as a
+    // directory tree under `outputName`, limited to `only` if given. With a
+    // `stream` sink, chunks are fetched in order and passed on as they
+    // verify, besides being written. Under a
+    // `control` the download draws on its connection and bandwidth budget
+    // and returns early, progress saved, when asked to stop. True once
+    // everything asked for is complete.
+    bool downloadFile(const DownloadSpec& spec, DownloadControl* control = nullptr);
+    // Background download jobs, as used by the IPC commands
+    DownloadManager& downloads() { return *downloadManager; }
+
     // TUI Support
     void setTracker(const std::string& ip, int port);
+    std::string getStats();
 
 private:
     void serverLoop(); 
     void keepAliveLoop();
 
+    // Serves one framed peer request. Returns false if the connection should be dropped.
+    bool handlePeerRequest(const PacketHeader& header, const std::vector<char>& body,
+                           const std::string& clientIp, ServeSession& session, PeerReply& reply);
+    bool sendReply(SocketType client, const PeerReply& reply);
+
     // Tracker Ops
     void registerToTracker();
-    void advertiseFile(const std::string& hash, uint64_t size, const std::string& name);
-    std::vector<PeerConnection> getPeersForFile(const std::string& hash);
+    void advertiseFile(const Digest& hash, uint64_t size, const std::string& name);
+    // All of `files` in one tracker session.
+    void advertiseFiles(const std::vector<std::shared_ptr<const FileMetadata>>& files);
+    std::vector<PeerConnection> getPeersForFile(const Digest& hash);
 
     // File Ops
+    std::shared_ptr<const FileMetadata> findFile(const Digest& fileHash);
     void splitFileBuffered(const std::string& filepath, FileMetadata& meta); 
+    void seedBundle(const std::string& root);
+    // Serves the unchanged files of the seed index and announces them at
+    // once; entries for changed or missing files are dropped.
+    void loadSeedIndex();
+    void saveSeedIndex();
+    // The metadata of `path` if it is seeded and unchanged since hashed.
+    std::shared_ptr<const FileMetadata> findSeeded(const std::string& path, const FileStamp& stamp);
     bool loadChunk(const FileMetadata& meta, uint32_t index, std::vector<char>& buffer);
-    void writeChunk(const std::string& outputName, uint32_t index, const std::vector<char>& data);
+    ChunkBuffer loadChunkCached(const FileMetadata& meta, uint32_t index);
+    // Files other than `exclude` with chunk `chunkHash` on disk, and its index
+    // in each.
+    std::vector<std::pair<std::shared_ptr<const FileMetadata>, uint32_t>>
+    chunkHolders(const Digest& chunkHash, const Digest& exclude);
+    // The descriptor holding [offset, offset + length) of a seeded file or
+    // bundle, with `fileOffset` set to where the range starts in it. Null if
+    // the range spans several bundle files.
+    std::shared_ptr<FileHandle> openRange(const FileMetadata& meta, uint64_t offset, uint64_t length,
+                                          uint64_t& fileOffset);
+    // Verifies the chunks of an existing output file or bundle tree in
+    // parallel, setting `have` for the good ones. Returns how many were good.
+    uint32_t recheckChunks(const std::string& path, const ChunkLayout& layout, HashAlgorithm algorithm,
+                           const std::function<bool(uint32_t, Digest&)>& hashOf, const BundleManifest* bundle,
+                           ChunkBitfield& have);
+    // Hashes the chunks of `basis`, an older local version of the file, in
+    // parallel and passes those the download still needs to `write`, setting
+    // `have` for each target chunk filled. Returns the bytes copied.
+    uint64_t copyFromBasis(const std::string& basis, const ChunkLayout& layout, const std::vector<Digest>& chunkHashes,
+                           HashAlgorithm algorithm, const std::vector<bool>& wanted, ChunkBitfield& have,
+                           uint32_t& copied, const std::function<bool(uint64_t, const std::vector<char>&)>& write);
     
+    size_t hashThreadCount() const;
+
     // Helper
-    std::vector<std::string> fetchMetadata(const PeerConnection& peer, const std::string& fileHash, uint32_t chunkCount);
+    // The chunk hashes, plus each chunk's length if the file was cut by content
+    // and the algorithm they were taken with.
+    std::vector<Digest> fetchMetadata(const PeerConnection& peer, const Digest& fileHash,
+                                      std::vector<uint32_t>& lengths, HashAlgorithm& algorithm);
+    // False if the peer could not be asked. Otherwise `isBundle` says whether
+    // it knows `fileHash` as a bundle, and `manifest` holds the encoded form.
+    bool fetchManifest(const PeerConnection& peer, const Digest& fileHash, std::string& manifest, bool& isBundle);
+    // Like fetchManifest, for a file known by its Merkle identity.
+    bool fetchTree(const PeerConnection& peer, const Digest& fileHash, uint64_t& fileSize, uint32_t& chunkSize,
+                   Digest& root, HashAlgorithm& algorithm, bool& isMerkle);
+    bool fetchSpan(const PeerConnection& peer, const Digest& fileHash, uint32_t span, std::vector<Digest>& hashes,
+                   std::vector<Digest>& proof);
 
     std::string trackerIp;
     int trackerPort;
     int myPort;
+    NodeOptions options;
     SocketType serverSocket;
     
     std::atomic<bool> running;
     std::thread serverThread;
+    std::unique_ptr<EventServer> eventServer;
+    ServeStats serveStats;
+    DownloadStats downloadStats;
+    // Per-peer transfer estimates and verify/write pipeline of the latest
+    // download of each file; both under peerRatesMutex.
+    std::mutex peerRatesMutex;
+    std::map<Digest, std::vector<std::shared_ptr<PeerRate>>> peerRates;
+    std::map<Digest, std::shared_ptr<ChunkPipeline>> pipelines;
+    PeerReputation reputation;
 
+    // Guards the map only; entries are immutable and pinned by readers, so
+    // chunk reads happen without the lock.
     std::mutex dataMutex;
-    std::map<std::string, FileMetadata> knownFiles; // Hash -> Metadata
+    std::map<Digest, std::shared_ptr<const FileMetadata>> knownFiles; // Hash -> Metadata
+    FileCache fileCache;
+    ChunkCache chunkCache;
+    ChunkStore chunkStore; // Every known chunk by hash, across files
+    std::mutex seedingMutex;
+    std::list<std::shared_ptr<SeedProgress>> seeding; // Files being hashed by seedFile
+    std::mutex seedIndexMutex; // Serializes rewrites of the seed index
+    // Last, so running jobs are stopped before anything they use goes away
+    std::unique_ptr<DownloadManager> downloadManager;
 };
 
 #endif // PEER_NODE_H
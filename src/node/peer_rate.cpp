@@ -0,0 +1,98 @@
+#include "peer_rate.h"
+#include <algorithm>
+#include <cmath>
+
+// Window before the first rate sample, and the floor it never drops below.
+constexpr size_t INITIAL_DEPTH = 4;
+constexpr size_t MIN_DEPTH = 2;
+// Window = DEPTH_GAIN x bandwidth-delay product, so a peer that could go
+// faster gets the requests to show it.
+constexpr double DEPTH_GAIN = 2.0;
+// Delivery rate is sampled over windows of this length.
+constexpr auto RATE_WINDOW = std::chrono::milliseconds(100);
+// The minimum latency is re-learned this often, in case the path got slower.
+constexpr auto MIN_RTT_LIFETIME = std::chrono::seconds(10);
+
+PeerRate::PeerRate(const std::string& i, uint16_t p, size_t maxD)
+    : ip(i), port(p), maxDepth(std::max(maxD, MIN_DEPTH)), state_(PeerState::CONNECTING), bytes(0),
+      rate(0), minRtt(0), srtt(0), depth(std::min(INITIAL_DEPTH, std::max(maxD, MIN_DEPTH))),
+      windowStart(Clock::now()), windowBytes(0), minRttStamp(Clock::now()), lastActivity(Clock::now()) {
+}
+
+void PeerRate::setState(PeerState s) {
+    std::lock_guard<std::mutex> lock(mutex);
+    state_ = s;
+}
+
+PeerState PeerRate::state() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return state_;
+}
+
+void PeerRate::onDelivered(size_t n, Clock::duration latency, Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    bytes += n;
+    windowBytes += n;
+    lastActivity = now;
+
+    double sample = std::chrono::duration<double>(latency).count();
+    srtt = srtt == 0 ? sample : srtt + (sample - srtt) / 8;
+    if (minRtt == 0 || sample < minRtt || now - minRttStamp > MIN_RTT_LIFETIME) {
+        minRtt = sample;
+        minRttStamp = now;
+    }
+
+    double elapsed = std::chrono::duration<double>(now - windowStart).count();
+    if (now - windowStart >= RATE_WINDOW && elapsed > 0) {
+        double r = windowBytes / elapsed;
+        // Rise at once, decay slowly: a single slow window is usually noise
+        rate = r > rate ? r : rate * 0.8 + r * 0.2;
+        windowStart = now;
+        windowBytes = 0;
+    }
+}
+
+bool PeerRate::stalled(Clock::duration timeout, Clock::time_point now) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return now - lastActivity >= timeout;
+}
+
+void PeerRate::touch(Clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    lastActivity = now;
+    windowStart = now;
+    windowBytes = 0;
+}
+
+size_t PeerRate::targetDepth(uint32_t blockSize) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (rate > 0 && minRtt > 0 && blockSize > 0) {
+        double bdp = rate * minRtt / blockSize;
+        size_t target = (size_t)std::ceil(DEPTH_GAIN * bdp) + 1;
+        depth = std::min(maxDepth, std::max(MIN_DEPTH, target));
+    }
+    return depth;
+}
+
+double PeerRate::throughput() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return rate;
+}
+
+PeerRateSnapshot PeerRate::snapshot() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return PeerRateSnapshot{ip, port, state_, bytes, rate, minRtt * 1000, srtt * 1000, depth};
+}
+
+const char* peerStateName(PeerState s) {
+    switch (s) {
+        case PeerState::CONNECTING: return "connecting";
+        case PeerState::ACTIVE: return "active";
+        case PeerState::IDLE: return "idle";
+        case PeerState::STALLED: return "stalled";
+        case PeerState::FAILED: return "failed";
+        case PeerState::BANNED: return "banned";
+        case PeerState::DONE: return "done";
+    }
+    return "unknown";
+}
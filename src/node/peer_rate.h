@@ -0,0 +1,77 @@
+#ifndef PEER_RATE_H
+#define PEER_RATE_H
+
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+enum class PeerState {
+    CONNECTING,
+    ACTIVE,
+    IDLE,    // Has nothing we still need
+    STALLED, // Dropped: requests outstanding but nothing delivered in time
+    FAILED,  // Dropped: could not connect or kept breaking the connection
+    BANNED,  // Dropped: sent too many corrupt chunks
+    DONE
+};
+
+// Point-in-time view of one download peer, for `stats`.
+struct PeerRateSnapshot {
+    std::string ip;
+    uint16_t port;
+    PeerState state;
+    uint64_t bytes;
+    double throughput;  // Bytes/s, recent delivery rate
+    double minRttMs;    // Best request latency seen (network RTT estimate)
+    double srttMs;      // Smoothed request latency, including queueing at the peer
+    size_t depth;       // Current request window
+};
+
+// Transfer estimates for one peer of a download, and the request window
+// they imply. The window follows the bandwidth-delay product: recent
+// delivery rate times the minimum request latency, with headroom so the
+// rate can keep growing. Updated by the peer's download worker and read by
+// `stats` from other threads.
+class PeerRate {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    PeerRate(const std::string& ip, uint16_t port, size_t maxDepth);
+
+    void setState(PeerState s);
+    PeerState state() const;
+
+    // A reply of `bytes` payload arrived `latency` after its request was sent.
+    void onDelivered(size_t bytes, Clock::duration latency, Clock::time_point now = Clock::now());
+    // Requests are outstanding but nothing arrived within `timeout`.
+    bool stalled(Clock::duration timeout, Clock::time_point now = Clock::now()) const;
+    // Restarts the stall clock (new connection, new requests after idling).
+    void touch(Clock::time_point now = Clock::now());
+
+    // Requests to keep in flight for blocks of `blockSize` bytes.
+    size_t targetDepth(uint32_t blockSize);
+    double throughput() const;
+
+    PeerRateSnapshot snapshot() const;
+
+private:
+    mutable std::mutex mutex;
+    std::string ip;
+    uint16_t port;
+    size_t maxDepth;
+    PeerState state_;
+    uint64_t bytes;
+    double rate;          // Bytes/s
+    double minRtt;        // Seconds, 0 until the first sample
+    double srtt;          // Seconds
+    size_t depth;
+    Clock::time_point windowStart;
+    uint64_t windowBytes;
+    Clock::time_point minRttStamp;
+    Clock::time_point lastActivity;
+};
+
+const char* peerStateName(PeerState s);
+
+#endif // PEER_RATE_H
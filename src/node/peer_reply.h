@@ -0,0 +1,73 @@
+#ifndef PEER_REPLY_H
+#define PEER_REPLY_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include "file_utils.h"
+#include "digest.h"
+
+class ChunkBitfield;
+
+// Immutable chunk payload, shared by every reply (and cache) that holds it.
+using ChunkBuffer = std::shared_ptr<const std::vector<char>>;
+
+// One answer to a peer request, sent in order: `head` (packet header and
+// fixed fields), then `body`, then `fileLength` bytes of `file` starting at
+// `fileOffset`. The file range is the zero-copy payload; `body` is a payload
+// that went through user space, of which `bodyLength` bytes from
+// `bodyOffset` are sent (a block out of a cached chunk).
+// A SEND_BLOCK reply carries the block's identity in `cancelKey`; cancelling
+// it before it is sent keeps only the first `keepOnCancel` bytes of `head`
+// (the HAVEs queued ahead of it).
+struct PeerReply {
+    std::vector<char> head;
+    std::string cancelKey;
+    size_t keepOnCancel = 0;
+    ChunkBuffer body;
+    size_t bodyOffset = 0;
+    size_t bodyLength = 0;
+    std::shared_ptr<FileHandle> file;
+    uint64_t fileOffset = 0;
+    size_t fileLength = 0;
+
+    void setBody(ChunkBuffer buffer, size_t offset, size_t length) {
+        body = std::move(buffer);
+        bodyOffset = offset;
+        bodyLength = length;
+    }
+    void setBody(ChunkBuffer buffer) {
+        size_t length = buffer ? buffer->size() : 0;
+        setBody(std::move(buffer), 0, length);
+    }
+    const char* bodyData() const { return body ? body->data() + bodyOffset : nullptr; }
+    size_t bodySize() const { return body ? bodyLength : 0; }
+    size_t inlineSize() const { return head.size() + bodySize(); }
+    size_t totalSize() const { return inlineSize() + fileLength; }
+};
+
+// Per-connection serving state, owned by the transport. Remembers which
+// chunks of a partially downloaded file have been announced to the peer, so
+// newly acquired ones can be pushed as HAVE ahead of the next reply.
+struct ServeSession {
+    struct Announced {
+        Digest fileHash;
+        std::shared_ptr<const ChunkBitfield> have;
+        std::vector<bool> sent;
+        uint32_t sentCount = 0;
+    };
+    std::vector<Announced> announced;
+    // CANCEL requests not yet applied by the transport, as PeerReply::cancelKey.
+    std::vector<std::string> cancels;
+};
+
+// Payload bytes handed to the transport, by path.
+struct ServeStats {
+    std::atomic<uint64_t> zeroCopyBytes{0};
+    std::atomic<uint64_t> copiedBytes{0};
+    std::atomic<uint64_t> cancelledReplies{0}; // Dropped before sending (CANCEL)
+};
+
+#endif // PEER_REPLY_H
@@ -0,0 +1,52 @@
+#include "peer_reputation.h"
+
+PeerReputation::PeerReputation(uint32_t threshold) : banThreshold(threshold) {
+}
+
+std::string PeerReputation::keyOf(const std::string& ip, uint16_t port) {
+    return ip + ":" + std::to_string(port);
+}
+
+bool PeerReputation::onCorrupt(const std::string& peer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    PeerRecord& r = peers[peer];
+    r.corrupt++;
+    if (r.banned || banThreshold == 0 || r.corrupt < banThreshold) return false;
+    r.banned = true;
+    return true;
+}
+
+void PeerReputation::onSuspect(const std::string& peer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    peers[peer].suspect++;
+}
+
+uint32_t PeerReputation::onFailure(const std::string& peer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    PeerRecord& r = peers[peer];
+    r.failed++;
+    return ++r.consecutiveFailures;
+}
+
+void PeerReputation::onSuccess(const std::string& peer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = peers.find(peer);
+    if (it != peers.end()) it->second.consecutiveFailures = 0;
+}
+
+bool PeerReputation::banned(const std::string& peer) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = peers.find(peer);
+    return it != peers.end() && it->second.banned;
+}
+
+std::vector<std::pair<std::string, PeerRecord>> PeerReputation::snapshot() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::vector<std::pair<std::string, PeerRecord>>(peers.begin(), peers.end());
+}
+
+PeerReputation::Clock::duration PeerReputation::backoff(uint32_t attempt, Clock::duration base, Clock::duration cap) {
+    Clock::duration delay = base;
+    for (uint32_t i = 1; i < attempt && delay < cap; ++i) delay *= 2;
+    return delay < cap ? delay : cap;
+}
@@ -0,0 +1,52 @@
+#ifndef PEER_REPUTATION_H
+#define PEER_REPUTATION_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+struct PeerRecord {
+    uint32_t corrupt = 0;  // Chunks it alone supplied that failed verification
+    uint32_t suspect = 0;  // Failed chunks it supplied part of
+    uint32_t failed = 0;   // Connections and transfers that failed
+    uint32_t consecutiveFailures = 0; // Since its last good block
+    bool banned = false;
+};
+
+// How peers have behaved during this daemon session, across downloads,
+// keyed by "ip:port". A peer reaching the corruption threshold is banned
+// until the daemon restarts. Only unambiguous failures count towards it:
+// when several peers supplied blocks of a bad chunk, each is merely
+// suspected, and the picker retries the chunk from a single peer.
+class PeerReputation {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // 0 never bans.
+    explicit PeerReputation(uint32_t banThreshold);
+
+    static std::string keyOf(const std::string& ip, uint16_t port);
+
+    // Returns true if this got the peer banned.
+    bool onCorrupt(const std::string& peer);
+    void onSuspect(const std::string& peer);
+    // Returns the peer's consecutive failures, this one included.
+    uint32_t onFailure(const std::string& peer);
+    void onSuccess(const std::string& peer);
+
+    bool banned(const std::string& peer) const;
+    std::vector<std::pair<std::string, PeerRecord>> snapshot() const;
+
+    // base x 2^(attempt - 1), at most `cap`.
+    static Clock::duration backoff(uint32_t attempt, Clock::duration base, Clock::duration cap);
+
+private:
+    uint32_t banThreshold;
+    mutable std::mutex mutex;
+    std::map<std::string, PeerRecord> peers;
+};
+
+#endif // PEER_REPUTATION_H
@@ -0,0 +1,269 @@
+#include "peer_session.h"
+#include "peer_node.h"
+#include "chunk_bitfield.h"
+#include <cstring>
+
+// Largest SEND_CHUNK body we accept from a peer.
+constexpr uint32_t MAX_CHUNK_RESPONSE = 16 * 1024 * 1024;
+
+PeerSession::PeerSession(const PeerConnection& peer)
+    : peerIp(peer.ip), peerPort(peer.port), sock(INVALID_SOCKET), interrupted(false), recvTimeoutMs(0), cancelledCount(0), wastedBytes(0) {
+}
+
+PeerSession::~PeerSession() {
+    close();
+}
+
+bool PeerSession::connect() {
+    close();
+    SocketType s = SocketUtils::createSocket();
+    if (s == INVALID_SOCKET) return false;
+    if (!SocketUtils::connectToServer(s, peerIp, peerPort)) {
+        SocketUtils::closeSocket(s);
+        return false;
+    }
+    if (recvTimeoutMs > 0) SocketUtils::setRecvTimeout(s, recvTimeoutMs);
+
+    std::lock_guard<std::mutex> lock(sockMutex);
+    if (interrupted) {
+        SocketUtils::closeSocket(s);
+        return false;
+    }
+    sock = s;
+    return true;
+}
+
+void PeerSession::close() {
+    std::lock_guard<std::mutex> lock(sockMutex);
+    if (sock != INVALID_SOCKET) {
+        SocketUtils::closeSocket(sock);
+        sock = INVALID_SOCKET;
+    }
+    inFlight.clear();
+    cancelledCount = 0;
+}
+
+void PeerSession::interrupt() {
+    std::lock_guard<std::mutex> lock(sockMutex);
+    interrupted = true;
+    if (sock != INVALID_SOCKET) SocketUtils::shutdownSocket(sock);
+}
+
+bool PeerSession::sendRequest(PacketType type, const Digest& fileHash, const BlockRequest& block) {
+    if (!isOpen()) return false;
+
+    bool whole = type == PacketType::REQUEST_CHUNK;
+    PacketHeader req;
+    req.type = type;
+    req.length = 32 + (whole ? 1 : 3) * sizeof(uint32_t);
+
+    char frame[sizeof(PacketHeader) + 32 + 3 * sizeof(uint32_t)];
+    memcpy(frame, &req, sizeof(req));
+    memcpy(frame + sizeof(req), fileHash.data(), Digest::SIZE);
+    memcpy(frame + sizeof(req) + 32, &block.chunk, sizeof(block.chunk));
+    memcpy(frame + sizeof(req) + 36, &block.offset, sizeof(block.offset));
+    memcpy(frame + sizeof(req) + 40, &block.length, sizeof(block.length));
+    if (!SocketUtils::sendAll(sock, frame, sizeof(req) + req.length)) return false;
+
+    Request r;
+    r.fileHash = fileHash;
+    r.block = block;
+    r.wholeChunk = whole;
+    r.cancelled = false;
+    r.sentAt = std::chrono::steady_clock::now();
+    inFlight.push_back(r);
+    return true;
+}
+
+bool PeerSession::sendBlockRequest(const Digest& fileHash, const BlockRequest& req) {
+    return sendRequest(PacketType::REQUEST_BLOCK, fileHash, req);
+}
+
+bool PeerSession::sendChunkRequest(const Digest& fileHash, const BlockRequest& req) {
+    return sendRequest(PacketType::REQUEST_CHUNK, fileHash, req);
+}
+
+bool PeerSession::cancelRequest(const Digest& fileHash, const BlockRequest& block) {
+    for (auto& r : inFlight) {
+        if (r.cancelled || r.wholeChunk || r.block.chunk != block.chunk || r.block.offset != block.offset ||
+            r.fileHash != fileHash) {
+            continue;
+        }
+        // [Hash 32] [Index u32] [Offset u32]
+        PacketHeader req;
+        req.type = PacketType::CANCEL;
+        req.length = 32 + 2 * sizeof(uint32_t);
+        IoSlice slices[4] = {
+            { &req, sizeof(req) }, { fileHash.data(), Digest::SIZE }, { &block.chunk, sizeof(block.chunk) }, { &block.offset, sizeof(block.offset) }
+        };
+        if (!SocketUtils::sendAllv(sock, slices, 4)) return false;
+        r.cancelled = true;
+        ++cancelledCount;
+        return true;
+    }
+    return false;
+}
+
+bool PeerSession::exchangeBitfield(const Digest& fileHash, uint32_t chunkCount,
+                                   const std::vector<uint8_t>& mine, std::vector<bool>& theirs) {
+    if (!isOpen() || outstanding() > 0) return false;
+
+    PacketHeader req;
+    req.type = PacketType::BITFIELD;
+    req.length = (uint32_t)(32 + sizeof(chunkCount) + mine.size());
+    IoSlice slices[4] = {
+        { &req, sizeof(req) }, { fileHash.data(), Digest::SIZE }, { &chunkCount, sizeof(chunkCount) }, { mine.data(), mine.size() }
+    };
+    if (!SocketUtils::sendAllv(sock, slices, 4)) return false;
+
+    PacketHeader resp;
+    while (true) {
+        if (!SocketUtils::recvAll(sock, &resp, sizeof(resp))) return false;
+        if (resp.type == PacketType::HAVE) {
+            if (!readHave(resp)) return false;
+        } else if (resp.type == PacketType::SEND_BLOCK || resp.type == PacketType::RESPONSE_ERROR) {
+            // A cancelled block the peer had already started sending
+            ChunkResponse skipped;
+            bool wasCancelled;
+            if (!readReply(resp, skipped, wasCancelled) || !wasCancelled) return false;
+        } else {
+            break;
+        }
+    }
+    // Replies come in request order: cancelled requests still unanswered were dropped.
+    inFlight.clear();
+    cancelledCount = 0;
+    if (resp.type != PacketType::BITFIELD || resp.length < 32 + sizeof(uint32_t) ||
+        resp.length > MAX_CHUNK_RESPONSE) {
+        return false;
+    }
+
+    std::vector<uint8_t> payload(resp.length);
+    if (!SocketUtils::recvAll(sock, payload.data(), payload.size())) return false;
+    uint32_t count;
+    memcpy(&count, payload.data() + 32, sizeof(count));
+    theirs.clear();
+    if (memcmp(payload.data(), fileHash.data(), Digest::SIZE) != 0 || count != chunkCount ||
+        payload.size() < 32 + sizeof(count) + (count + 7) / 8) {
+        return true; // Peer does not know this file (count 0) or disagrees on it
+    }
+    theirs = ChunkBitfield::fromBytes(payload.data() + 32 + sizeof(count), count);
+    return true;
+}
+
+bool PeerSession::readHave(const PacketHeader& header) {
+    if (header.length != 32 + sizeof(uint32_t)) return false;
+    char hash[32];
+    uint32_t index;
+    if (!SocketUtils::recvAll(sock, hash, 32)) return false;
+    if (!SocketUtils::recvAll(sock, &index, sizeof(index))) return false;
+    haves.push_back(index);
+    return true;
+}
+
+std::vector<uint32_t> PeerSession::takeHaves() {
+    std::vector<uint32_t> out;
+    out.swap(haves);
+    return out;
+}
+
+bool PeerSession::readChunkResponse(ChunkResponse& out) {
+    while (isOpen() && outstanding() > 0) {
+        PacketHeader resp;
+        if (!SocketUtils::recvAll(sock, &resp, sizeof(resp))) return false;
+        if (resp.type == PacketType::HAVE) {
+            if (!readHave(resp)) return false;
+            continue;
+        }
+        bool wasCancelled;
+        if (!readReply(resp, out, wasCancelled)) return false;
+        if (!wasCancelled) return true;
+    }
+    return false;
+}
+
+// Reads one SEND_CHUNK, SEND_BLOCK or RESPONSE_ERROR and retires the request
+// it answers. Cancelled requests queued before it got no reply and are
+// retired too.
+bool PeerSession::readReply(const PacketHeader& resp, ChunkResponse& out, bool& wasCancelled) {
+    // [Hash 32] [Index u32] are common to every reply; blocks add [Offset u32].
+    if (resp.length < 32 + sizeof(uint32_t) || resp.length > MAX_CHUNK_RESPONSE) return false;
+    uint32_t index;
+    uint32_t offset = 0;
+    if (!SocketUtils::recvAll(sock, out.fileHash.data(), Digest::SIZE)) return false;
+    if (!SocketUtils::recvAll(sock, &index, sizeof(index))) return false;
+    uint32_t fixed = 32 + sizeof(index);
+    bool isBlock = resp.type == PacketType::SEND_BLOCK ||
+                   (resp.type == PacketType::RESPONSE_ERROR && resp.length >= fixed + sizeof(offset));
+    if (isBlock) {
+        if (resp.length < fixed + sizeof(offset)) return false;
+        if (!SocketUtils::recvAll(sock, &offset, sizeof(offset))) return false;
+        fixed += sizeof(offset);
+    }
+
+    if (resp.type == PacketType::SEND_CHUNK || resp.type == PacketType::SEND_BLOCK) {
+        // [DataSize u32] [Data...]
+        uint32_t dSize;
+        if (resp.length < fixed + sizeof(dSize)) return false;
+        if (!SocketUtils::recvAll(sock, &dSize, sizeof(dSize))) return false;
+        if (dSize != resp.length - fixed - sizeof(dSize)) return false;
+        out.data.resize(dSize);
+        if (!SocketUtils::recvAll(sock, out.data.data(), dSize)) return false;
+        out.ok = true;
+    } else if (resp.type == PacketType::RESPONSE_ERROR) {
+        if (resp.length != fixed) return false;
+        out.data.clear();
+        out.ok = false;
+    } else {
+        return false;
+    }
+
+    for (auto it = inFlight.begin(); it != inFlight.end(); ++it) {
+        if (it->block.chunk == index && it->wholeChunk != isBlock &&
+            (it->wholeChunk || it->block.offset == offset) &&
+            it->fileHash == out.fileHash) {
+            out.request = it->block;
+            out.latency = std::chrono::steady_clock::now() - it->sentAt;
+            wasCancelled = it->cancelled;
+            if (wasCancelled) {
+                wastedBytes += out.data.size();
+                --cancelledCount;
+            }
+            size_t pos = (size_t)(it - inFlight.begin());
+            inFlight.erase(it);
+            // Replies come in request order: cancelled requests ahead of this one were dropped.
+            for (size_t k = 0; k < pos;) {
+                if (!inFlight[k].cancelled) {
+                    ++k;
+                    continue;
+                }
+                inFlight.erase(inFlight.begin() + k);
+                --pos;
+                --cancelledCount;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<BlockRequest> PeerSession::outstandingRequests() const {
+    std::vector<BlockRequest> requests;
+    for (const auto& r : inFlight) {
+        if (!r.cancelled) requests.push_back(r.block);
+    }
+    return requests;
+}
+
+std::vector<BlockRequest> PeerSession::takeOutstanding() {
+    std::vector<BlockRequest> requests = outstandingRequests();
+    inFlight.clear();
+    cancelledCount = 0;
+    return requests;
+}
+
+uint64_t PeerSession::takeWastedBytes() {
+    uint64_t bytes = wastedBytes;
+    wastedBytes = 0;
+    return bytes;
+}
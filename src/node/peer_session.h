@@ -0,0 +1,103 @@
+#ifndef PEER_SESSION_H
+#define PEER_SESSION_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#include "socket_utils.h"
+#include "protocol.h"
+#include "piece_picker.h"
+#include "digest.h"
+
+struct PeerConnection;
+
+// A block (or the refusal to send one) as answered by a remote peer.
+struct ChunkResponse {
+    bool ok;                 // SEND_CHUNK/SEND_BLOCK (true) or RESPONSE_ERROR (false)
+    Digest fileHash;
+    BlockRequest request;    // The outstanding request this answers
+    std::chrono::steady_clock::duration latency; // Since the request was sent
+    std::vector<char> data;
+};
+
+// Long-lived connection to one peer. Requests are pipelined: up to the
+// caller's queue depth can be outstanding, and responses are matched back to
+// requests by the (file hash, chunk index, offset) carried in the reply.
+class PeerSession {
+public:
+    explicit PeerSession(const PeerConnection& peer);
+    ~PeerSession();
+
+    PeerSession(const PeerSession&) = delete;
+    PeerSession& operator=(const PeerSession&) = delete;
+
+    // Reads block for at most `ms` once connected (0 waits forever).
+    void setRecvTimeout(int ms) { recvTimeoutMs = ms; }
+    bool connect();
+    void close();
+    // Called from another thread: unblocks a pending read and refuses to
+    // reconnect, so the owning worker winds down.
+    void interrupt();
+    bool isOpen() const { return sock != INVALID_SOCKET; }
+
+    // Sends our BITFIELD for the file and reads the peer's. Only valid with
+    // no requests outstanding except cancelled ones. `theirs` is empty if the
+    // peer does not know the file.
+    bool exchangeBitfield(const Digest& fileHash, uint32_t chunkCount,
+                          const std::vector<uint8_t>& mine, std::vector<bool>& theirs);
+
+    // REQUEST_BLOCK for the range, or REQUEST_CHUNK for a whole chunk
+    // (peers that predate blocks).
+    bool sendBlockRequest(const Digest& fileHash, const BlockRequest& req);
+    bool sendChunkRequest(const Digest& fileHash, const BlockRequest& req);
+    // Sends CANCEL for an outstanding block request. The peer drops the
+    // reply if it has not started sending it; if it still arrives, it is
+    // discarded and counted as wasted.
+    bool cancelRequest(const Digest& fileHash, const BlockRequest& req);
+
+    // Blocks for the next response. Returns false on a broken connection or
+    // a response that matches no outstanding request. HAVE announcements
+    // received on the way are queued for takeHaves().
+    bool readChunkResponse(ChunkResponse& out);
+    std::vector<uint32_t> takeHaves();
+
+    // Outstanding requests, not counting cancelled ones.
+    size_t outstanding() const { return inFlight.size() - cancelledCount; }
+    std::vector<BlockRequest> outstandingRequests() const;
+    // Drops all outstanding requests, returning the ones not cancelled.
+    std::vector<BlockRequest> takeOutstanding();
+    // Payload bytes of cancelled requests that arrived anyway, since the last call.
+    uint64_t takeWastedBytes();
+
+    const std::string& ip() const { return peerIp; }
+    uint16_t port() const { return peerPort; }
+
+private:
+    bool readHave(const PacketHeader& header);
+    bool sendRequest(PacketType type, const Digest& fileHash, const BlockRequest& req);
+    bool readReply(const PacketHeader& header, ChunkResponse& out, bool& wasCancelled);
+
+    struct Request {
+        Digest fileHash;
+        BlockRequest block;
+        bool wholeChunk;
+        bool cancelled;
+        std::chrono::steady_clock::time_point sentAt;
+    };
+
+    std::string peerIp;
+    uint16_t peerPort;
+    SocketType sock;
+    std::mutex sockMutex;    // Orders sock changes against interrupt()
+    bool interrupted;
+    int recvTimeoutMs;
+    std::deque<Request> inFlight;
+    size_t cancelledCount;
+    std::vector<uint32_t> haves;
+    uint64_t wastedBytes;
+};
+
+#endif // PEER_SESSION_H
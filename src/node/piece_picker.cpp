@@ -0,0 +1,340 @@
+#include "piece_picker.h"
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+// Most peers a single block is requested from at once during endgame.
+constexpr size_t MAX_BLOCK_REQUESTERS = 3;
+
+PiecePicker::PiecePicker(uint64_t size, uint32_t cSize, uint32_t bSize)
+    : PiecePicker(ChunkLayout::fixed(size, cSize), bSize) {
+}
+
+PiecePicker::PiecePicker(const ChunkLayout& l, uint32_t bSize)
+    : layout(l), blockSize(std::max(1u, std::min(bSize ? bSize : l.maxLength(), l.maxLength()))),
+      total(l.count()), done(0), endgameThreshold(0), duplicates(0) {
+    avail.assign(total, 0);
+    state.assign(total, State::PENDING);
+    failures.assign(total, 0);
+    rank.resize(total);
+    byRank.resize(total);
+    std::iota(byRank.begin(), byRank.end(), 0);
+    std::shuffle(byRank.begin(), byRank.end(), std::mt19937(std::random_device()()));
+    for (uint32_t r = 0; r < total; ++r) rank[byRank[r]] = r;
+}
+
+void PiecePicker::setEndgameThreshold(uint32_t chunks) {
+    std::lock_guard<std::mutex> lock(mutex);
+    endgameThreshold = chunks;
+}
+
+void PiecePicker::setSequential(uint32_t chunks) {
+    std::lock_guard<std::mutex> lock(mutex);
+    window = chunks;
+}
+
+void PiecePicker::setCursor(uint32_t index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    cursor = std::min(index, total);
+}
+
+bool PiecePicker::waitingForWindow() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (window == 0) return false;
+    uint32_t end = (uint32_t)std::min<uint64_t>(total, (uint64_t)cursor + window);
+    bool beyond = false;
+    for (uint32_t i = end; i < total && !beyond; ++i) beyond = state[i] != State::DONE;
+    if (!beyond) return false;
+    // A chunk in the window that nobody has, or that was given up, blocks
+    // the stream for good
+    for (uint32_t i = cursor; i < end; ++i) {
+        if (state[i] != State::PENDING) continue;
+        auto d = deferred.find(i);
+        if (d != deferred.end() ? d->second == Clock::time_point::max() : avail[i] == 0) return false;
+    }
+    return true;
+}
+
+bool PiecePicker::inEndgame() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return endgameThreshold > 0 && total - done <= endgameThreshold;
+}
+
+uint32_t PiecePicker::chunkLength(uint32_t index) const {
+    return layout.length(index);
+}
+
+uint32_t PiecePicker::blockCount(uint32_t index) const {
+    return (chunkLength(index) + blockSize - 1) / blockSize;
+}
+
+void PiecePicker::setAvailability(uint32_t index, uint32_t value) {
+    if (state[index] == State::PENDING && avail[index] > 0) available.erase(keyOf(index));
+    avail[index] = value;
+    if (state[index] == State::PENDING && avail[index] > 0) available.insert(keyOf(index));
+}
+
+void PiecePicker::setPeerBitfield(int peer, const std::vector<bool>& have) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<bool>& bits = peers[peer];
+    if (bits.empty()) bits.assign(total, false);
+    for (uint32_t i = 0; i < total; ++i) {
+        bool h = i < have.size() && have[i];
+        if (h == bits[i]) continue;
+        bits[i] = h;
+        setAvailability(i, h ? avail[i] + 1 : avail[i] - 1);
+    }
+}
+
+void PiecePicker::peerHas(int peer, uint32_t index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = peers.find(peer);
+    if (index >= total || it == peers.end() || it->second[index]) return;
+    it->second[index] = true;
+    setAvailability(index, avail[index] + 1);
+}
+
+void PiecePicker::peerLacks(int peer, uint32_t index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = peers.find(peer);
+    if (index >= total || it == peers.end() || !it->second[index]) return;
+    it->second[index] = false;
+    setAvailability(index, avail[index] - 1);
+}
+
+void PiecePicker::removePeer(int peer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = peers.find(peer);
+    if (it == peers.end()) return;
+    for (uint32_t i = 0; i < total; ++i) {
+        if (it->second[i]) setAvailability(i, avail[i] - 1);
+    }
+    peers.erase(it);
+}
+
+BlockRequest PiecePicker::claim(int peer, uint32_t index, Partial& p, uint32_t first, uint32_t count) {
+    for (uint32_t b = first; b < first + count; ++b) {
+        p.blocks[b] = BlockState::IN_FLIGHT;
+        p.requesters[b].assign(1, peer);
+    }
+    p.blocksInFlight += count;
+    uint32_t offset = first * blockSize;
+    uint32_t end = std::min(chunkLength(index), (first + count) * blockSize);
+    return BlockRequest{index, offset, end - offset};
+}
+
+bool PiecePicker::pickBlock(int peer, BlockRequest& out, bool wholeChunk) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = peers.find(peer);
+    if (it == peers.end()) return false;
+    const std::vector<bool>& bits = it->second;
+
+    // Finish started chunks first, so partial buffers stay few.
+    if (!wholeChunk) {
+        for (auto& [index, p] : active) {
+            if (!bits[index]) continue;
+            for (uint32_t b = 0; b < p.blocks.size(); ++b) {
+                if (p.blocks[b] != BlockState::PENDING) continue;
+                out = claim(peer, index, p, b, 1);
+                return true;
+            }
+        }
+    }
+
+    Clock::time_point now = Clock::now();
+    if (window > 0) {
+        uint32_t end = (uint32_t)std::min<uint64_t>(total, (uint64_t)cursor + window);
+        for (uint32_t i = cursor; i < end; ++i) {
+            if (state[i] == State::PENDING && bits[i] && start(peer, i, wholeChunk, now, out)) return true;
+        }
+    } else {
+        for (uint64_t key : available) {
+            uint32_t candidate = byRank[(uint32_t)key];
+            if (bits[candidate] && start(peer, candidate, wholeChunk, now, out)) return true;
+        }
+    }
+
+    bool endgame = endgameThreshold > 0 && total - done <= endgameThreshold;
+    return endgame && !wholeChunk && pickDuplicate(peer, bits, out);
+}
+
+bool PiecePicker::start(int peer, uint32_t index, bool wholeChunk, Clock::time_point now, BlockRequest& out) {
+    auto d = deferred.find(index);
+    if (d != deferred.end()) {
+        if (d->second > now) return false;
+        deferred.erase(d);
+    }
+    available.erase(keyOf(index));
+    state[index] = State::ACTIVE;
+    Partial& p = active[index];
+    p.blocks.assign(blockCount(index), BlockState::PENDING);
+    p.requesters.assign(p.blocks.size(), std::vector<int>());
+    // A retry goes to one peer in one request
+    bool whole = wholeChunk || failures[index] > 0;
+    out = claim(peer, index, p, 0, whole ? (uint32_t)p.blocks.size() : 1);
+    return true;
+}
+
+// Endgame: the in-flight block with the fewest requesters that `peer` has
+// not been asked for yet.
+bool PiecePicker::pickDuplicate(int peer, const std::vector<bool>& bits, BlockRequest& out) {
+    Partial* best = nullptr;
+    uint32_t bestIndex = 0;
+    uint32_t bestBlock = 0;
+    for (auto& [index, p] : active) {
+        if (!bits[index]) continue;
+        for (uint32_t b = 0; b < p.blocks.size(); ++b) {
+            const std::vector<int>& r = p.requesters[b];
+            if (p.blocks[b] != BlockState::IN_FLIGHT || r.size() >= MAX_BLOCK_REQUESTERS ||
+                std::find(r.begin(), r.end(), peer) != r.end()) {
+                continue;
+            }
+            if (!best || r.size() < best->requesters[bestBlock].size()) {
+                best = &p;
+                bestIndex = index;
+                bestBlock = b;
+            }
+        }
+    }
+    if (!best) return false;
+
+    best->requesters[bestBlock].push_back(peer);
+    ++duplicates;
+    uint32_t offset = bestBlock * blockSize;
+    out = BlockRequest{bestIndex, offset, std::min(chunkLength(bestIndex) - offset, blockSize)};
+    return true;
+}
+
+void PiecePicker::resetChunk(uint32_t index) {
+    active.erase(index);
+    state[index] = State::PENDING;
+    if (avail[index] > 0) available.insert(keyOf(index));
+}
+
+void PiecePicker::blockRange(const Partial& p, const BlockRequest& req, uint32_t& first, uint32_t& last) const {
+    first = req.offset / blockSize;
+    last = std::min<uint32_t>((uint32_t)p.blocks.size(), (req.offset + req.length + blockSize - 1) / blockSize);
+}
+
+void PiecePicker::releaseBlock(int peer, const BlockRequest& req) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = active.find(req.chunk);
+    if (it == active.end()) return;
+    Partial& p = it->second;
+    uint32_t first, last;
+    blockRange(p, req, first, last);
+    for (uint32_t b = first; b < last; ++b) {
+        if (p.blocks[b] != BlockState::IN_FLIGHT) continue;
+        std::vector<int>& r = p.requesters[b];
+        r.erase(std::remove(r.begin(), r.end(), peer), r.end());
+        if (!r.empty()) continue;
+        p.blocks[b] = BlockState::PENDING;
+        --p.blocksInFlight;
+    }
+    // Nothing received yet: make the chunk available to whole-chunk peers again
+    if (p.blocksDone == 0 && p.blocksInFlight == 0) resetChunk(req.chunk);
+}
+
+bool PiecePicker::needsBlock(const BlockRequest& req) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = active.find(req.chunk);
+    if (it == active.end()) return false;
+    const Partial& p = it->second;
+    uint32_t first, last;
+    blockRange(p, req, first, last);
+    for (uint32_t b = first; b < last; ++b) {
+        if (p.blocks[b] != BlockState::DONE) return true;
+    }
+    return false;
+}
+
+bool PiecePicker::blockDone(int peer, const BlockRequest& req) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = active.find(req.chunk);
+    if (it == active.end()) return false;
+    Partial& p = it->second;
+    uint32_t before = p.blocksDone;
+    uint32_t first, last;
+    blockRange(p, req, first, last);
+    for (uint32_t b = first; b < last; ++b) {
+        if (p.blocks[b] == BlockState::DONE) continue;
+        if (p.blocks[b] == BlockState::IN_FLIGHT) --p.blocksInFlight;
+        p.blocks[b] = BlockState::DONE;
+        p.requesters[b].clear();
+        ++p.blocksDone;
+    }
+    if (std::find(p.contributors.begin(), p.contributors.end(), peer) == p.contributors.end()) {
+        p.contributors.push_back(peer);
+    }
+    // Only the copy that supplied the last missing block completes the chunk
+    return p.blocksDone > before && p.blocksDone == p.blocks.size();
+}
+
+void PiecePicker::markDone(uint32_t index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (index >= total || state[index] == State::DONE) return;
+    if (state[index] == State::PENDING && avail[index] > 0) available.erase(keyOf(index));
+    active.erase(index);
+    state[index] = State::DONE;
+    ++done;
+}
+
+std::vector<int> PiecePicker::chunkFailed(uint32_t index, Clock::duration retryDelay) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<int> contributors;
+    auto it = active.find(index);
+    if (it == active.end()) return contributors;
+    contributors = it->second.contributors;
+    ++failures[index];
+    if (retryDelay > Clock::duration::zero()) deferred[index] = Clock::now() + retryDelay;
+    resetChunk(index);
+    return contributors;
+}
+
+uint32_t PiecePicker::failureCount(uint32_t index) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return index < total ? failures[index] : 0;
+}
+
+void PiecePicker::giveUp(uint32_t index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (index < total && state[index] != State::DONE) deferred[index] = Clock::time_point::max();
+}
+
+bool PiecePicker::waitingForRetry() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    Clock::time_point now = Clock::now();
+    for (const auto& [index, at] : deferred) {
+        if (at > now && at != Clock::time_point::max()) return true;
+    }
+    return false;
+}
+
+bool PiecePicker::finished() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return done == total;
+}
+
+uint32_t PiecePicker::doneCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return done;
+}
+
+std::vector<uint32_t> PiecePicker::missing() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<uint32_t> out;
+    for (uint32_t i = 0; i < total; ++i) {
+        if (state[i] != State::DONE) out.push_back(i);
+    }
+    return out;
+}
+
+uint32_t PiecePicker::availability(uint32_t index) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return index < total ? avail[index] : 0;
+}
+
+uint64_t PiecePicker::duplicateRequests() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return duplicates;
+}
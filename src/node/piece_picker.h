@@ -0,0 +1,140 @@
+#ifndef PIECE_PICKER_H
+#define PIECE_PICKER_H
+
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include "chunker.h"
+
+// A byte range of one chunk, as requested from a peer.
+struct BlockRequest {
+    uint32_t chunk;
+    uint32_t offset;
+    uint32_t length;
+};
+
+// Decides which blocks to request from which peer during a download.
+// Tracks what every peer has (from BITFIELD/HAVE) and starts the rarest
+// chunk a peer can serve. Ties are broken by a per-download random order so
+// leechers of the same file do not all start on the same chunk. Started
+// chunks are finished first, with their blocks spread over every peer that
+// has them. A peer is never given a chunk it does not have.
+//
+// Once no more than the endgame threshold of chunks is missing, blocks that
+// are already in flight are handed out again to other peers, so one slow
+// peer cannot hold up the end of the download. The first copy to arrive
+// wins; the caller cancels the rest.
+//
+// A chunk that failed verification can be held back for a while before it
+// is tried again, and is then requested whole from a single peer, so a
+// second failure points at that peer alone.
+//
+// In sequential mode (streaming downloads) chunks are started in file order
+// instead, and only within a window ahead of the consumer's read cursor, so
+// what is verified but not yet consumed stays bounded.
+class PiecePicker {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    PiecePicker(uint64_t fileSize, uint32_t chunkSize, uint32_t blockSize);
+    PiecePicker(const ChunkLayout& layout, uint32_t blockSize);
+
+    // Starts chunks in order, at most `window` ahead of the cursor; 0 goes
+    // back to rarest first.
+    void setSequential(uint32_t window);
+    // First chunk the consumer has not received yet.
+    void setCursor(uint32_t index);
+    // Sequential mode: chunks past the window are missing and the window
+    // itself is only waiting for chunks in flight or for the consumer.
+    bool waitingForWindow() const;
+
+    // Missing chunks at which endgame starts; 0 disables it.
+    void setEndgameThreshold(uint32_t chunks);
+    bool inEndgame() const;
+
+    // Replaces what `peer` is known to have.
+    void setPeerBitfield(int peer, const std::vector<bool>& have);
+    void peerHas(int peer, uint32_t index);
+    // The peer failed to deliver `index`; do not ask it again.
+    void peerLacks(int peer, uint32_t index);
+    void removePeer(int peer);
+
+    // Claims the next block for `peer`. With `wholeChunk` only an unstarted
+    // chunk is claimed, in one request covering all of its blocks (for peers
+    // that cannot serve blocks). In endgame a block may already be in flight
+    // to other peers.
+    bool pickBlock(int peer, BlockRequest& out, bool wholeChunk = false);
+    // `peer` gives up its claim; the block is pending again once nobody has it in flight.
+    void releaseBlock(int peer, const BlockRequest& req);
+    // False once the block arrived from some peer, or its chunk is no longer
+    // being assembled: a copy received now is wasted.
+    bool needsBlock(const BlockRequest& req) const;
+    // Records a received block. Returns true once every block of the chunk is in.
+    bool blockDone(int peer, const BlockRequest& req);
+    // The assembled chunk verified and is on disk.
+    void markDone(uint32_t index);
+    // The assembled chunk failed verification: start it over, not before
+    // `retryDelay` has passed. Returns the peers that contributed blocks to it.
+    std::vector<int> chunkFailed(uint32_t index, Clock::duration retryDelay = Clock::duration::zero());
+    // Times the chunk has failed so far.
+    uint32_t failureCount(uint32_t index) const;
+    // Stops handing the chunk out at all; the download cannot finish.
+    void giveUp(uint32_t index);
+    // Some failed chunk is still waiting out its retry delay.
+    bool waitingForRetry() const;
+
+    uint32_t chunkCount() const { return total; }
+    uint32_t chunkLength(uint32_t index) const;
+    bool finished() const;
+    uint32_t doneCount() const;
+    std::vector<uint32_t> missing() const;
+    uint32_t availability(uint32_t index) const;
+    // Block requests handed out while another peer already had them in flight.
+    uint64_t duplicateRequests() const;
+
+private:
+    enum class State : uint8_t { PENDING, ACTIVE, DONE };
+    enum class BlockState : uint8_t { PENDING, IN_FLIGHT, DONE };
+
+    struct Partial {
+        std::vector<BlockState> blocks;
+        std::vector<std::vector<int>> requesters; // Peers each in-flight block is asked of
+        std::vector<int> contributors;
+        uint32_t blocksDone = 0;
+        uint32_t blocksInFlight = 0;
+    };
+
+    uint64_t keyOf(uint32_t index) const { return ((uint64_t)avail[index] << 32) | rank[index]; }
+    void setAvailability(uint32_t index, uint32_t value);
+    uint32_t blockCount(uint32_t index) const;
+    BlockRequest claim(int peer, uint32_t index, Partial& p, uint32_t first, uint32_t count);
+    // Starts `index` unless it is waiting out a retry delay.
+    bool start(int peer, uint32_t index, bool wholeChunk, Clock::time_point now, BlockRequest& out);
+    bool pickDuplicate(int peer, const std::vector<bool>& bits, BlockRequest& out);
+    void blockRange(const Partial& p, const BlockRequest& req, uint32_t& first, uint32_t& last) const;
+    void resetChunk(uint32_t index);
+
+    mutable std::mutex mutex;
+    ChunkLayout layout;
+    uint32_t blockSize;
+    uint32_t total;
+    uint32_t done;
+    uint32_t endgameThreshold;
+    uint64_t duplicates;
+    uint32_t window = 0; // Sequential mode when non-zero
+    uint32_t cursor = 0;
+    std::vector<uint32_t> avail;
+    std::vector<State> state;
+    std::vector<uint32_t> rank;     // Random tie-break order
+    std::vector<uint32_t> byRank;   // rank -> chunk index
+    std::set<uint64_t> available;   // Unstarted chunks with avail > 0, rarest first
+    std::map<uint32_t, Partial> active;
+    std::map<int, std::vector<bool>> peers;
+    std::vector<uint32_t> failures;
+    std::map<uint32_t, Clock::time_point> deferred; // Failed chunks not to start before then; max = given up
+};
+
+#endif // PIECE_PICKER_H
@@ -0,0 +1,87 @@
+#include "resume_file.h"
+#include "file_utils.h"
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+#include <cstring>
+
+constexpr char RESUME_MAGIC[8] = { 'P', 'W', 'R', 'E', 'S', 'U', 'M', '1' };
+constexpr char MERKLE_RESUME_MAGIC[8] = { 'P', 'W', 'R', 'E', 'S', 'U', 'M', 'T' };
+
+static uint32_t fixedChunkCount(uint64_t fileSize, uint32_t chunkSize) {
+    return chunkSize ? (uint32_t)((fileSize + chunkSize - 1) / chunkSize) : 0;
+}
+
+static void appendRaw(std::vector<char>& out, const void* data, size_t size) {
+    const char* b = static_cast<const char*>(data);
+    out.insert(out.end(), b, b + size);
+}
+
+std::string ResumeFile::pathFor(const std::string& outputName) {
+    return outputName + ".resume";
+}
+
+bool ResumeFile::save(const std::string& path, const ResumeState& state) {
+    uint32_t count = state.merkle ? fixedChunkCount(state.fileSize, state.chunkSize) : (uint32_t)state.chunkHashes.size();
+    if (state.haveBits.size() != (count + 7) / 8) return false;
+    if (state.chunkSize == 0 && (state.merkle || state.chunkLengths.size() != count)) return false;
+
+    std::vector<char> out;
+    out.reserve(sizeof(RESUME_MAGIC) + 16 + 32 * (count + 1) + state.haveBits.size());
+    appendRaw(out, state.merkle ? MERKLE_RESUME_MAGIC : RESUME_MAGIC, sizeof(RESUME_MAGIC));
+    appendRaw(out, &state.fileSize, sizeof(state.fileSize));
+    appendRaw(out, &state.chunkSize, sizeof(state.chunkSize));
+    appendRaw(out, &count, sizeof(count));
+    appendRaw(out, state.fileHash.data(), Digest::SIZE);
+    if (!state.merkle) {
+        for (const Digest& h : state.chunkHashes) appendRaw(out, h.data(), Digest::SIZE);
+    }
+    if (state.chunkSize == 0) appendRaw(out, state.chunkLengths.data(), count * sizeof(uint32_t));
+    appendRaw(out, state.haveBits.data(), state.haveBits.size());
+    if (state.hash != HashAlgorithm::SHA256) appendRaw(out, &state.hash, sizeof(state.hash));
+    return FileUtils::writeFileAtomic(path, out.data(), out.size());
+}
+
+bool ResumeFile::load(const std::string& path, ResumeState& out) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    size_t header = sizeof(RESUME_MAGIC) + sizeof(out.fileSize) + sizeof(out.chunkSize) + sizeof(uint32_t) + 32;
+    if (data.size() < header) return false;
+    out.merkle = memcmp(data.data(), MERKLE_RESUME_MAGIC, sizeof(MERKLE_RESUME_MAGIC)) == 0;
+    if (!out.merkle && memcmp(data.data(), RESUME_MAGIC, sizeof(RESUME_MAGIC)) != 0) return false;
+
+    const char* p = data.data() + sizeof(RESUME_MAGIC);
+    uint32_t count;
+    memcpy(&out.fileSize, p, sizeof(out.fileSize));
+    p += sizeof(out.fileSize);
+    memcpy(&out.chunkSize, p, sizeof(out.chunkSize));
+    p += sizeof(out.chunkSize);
+    memcpy(&count, p, sizeof(count));
+    p += sizeof(count);
+    if (out.merkle && (out.chunkSize == 0 || count != fixedChunkCount(out.fileSize, out.chunkSize))) return false;
+    size_t lengthsSize = out.chunkSize == 0 ? (size_t)count * sizeof(uint32_t) : 0;
+    size_t hashesSize = out.merkle ? 0 : (size_t)count * 32;
+    size_t size = header + hashesSize + lengthsSize + (count + 7) / 8;
+    if (data.size() != size && data.size() != size + 1) return false;
+    out.hash = HashAlgorithm::SHA256;
+    if (data.size() == size + 1) {
+        out.hash = (HashAlgorithm)data.back();
+        if (out.hash != HashAlgorithm::BLAKE3) return false;
+    }
+
+    out.fileHash = Digest::fromBytes(p);
+    p += 32;
+    out.chunkHashes.clear();
+    for (uint32_t i = 0; i < count && !out.merkle; ++i, p += 32) out.chunkHashes.push_back(Digest::fromBytes(p));
+    out.chunkLengths.assign(lengthsSize / sizeof(uint32_t), 0);
+    if (lengthsSize) memcpy(out.chunkLengths.data(), p, lengthsSize);
+    p += lengthsSize;
+    out.haveBits.assign(p, p + (count + 7) / 8);
+    return true;
+}
+
+void ResumeFile::remove(const std::string& path) {
+    std::remove(path.c_str());
+}
@@ -0,0 +1,39 @@
+#ifndef RESUME_FILE_H
+#define RESUME_FILE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "digest.h"
+#include "hasher.h"
+
+// What an interrupted download needs to continue: the chunk hashes it
+// fetched and which chunks are verified and on disk.
+struct ResumeState {
+    Digest fileHash;
+    uint64_t fileSize = 0;
+    uint32_t chunkSize = 0;             // 0 for content-defined chunks
+    std::vector<Digest> chunkHashes;    // Empty for a Merkle file
+    bool merkle = false;                // Chunk hashes come with proofs from peers as needed
+    std::vector<uint32_t> chunkLengths; // Content-defined chunks only
+    std::vector<uint8_t> haveBits;      // ChunkBitfield wire form
+    HashAlgorithm hash = HashAlgorithm::SHA256; // What the chunk hashes were taken with
+};
+
+// Sidecar file kept next to a download's output ("<output>.resume").
+// Layout: magic "PWRESUM1", fileSize u64, chunkSize u32, chunkCount u32,
+// fileHash 32 bytes, chunkCount x 32-byte chunk hashes, chunkCount x u32
+// chunk lengths if chunkSize is 0, then the bitfield, then one algorithm
+// byte unless the hash is SHA-256. A Merkle file uses
+// magic "PWRESUMT" and stores no hashes; its file hash commits to them.
+// Saved with FileUtils::writeFileAtomic, so a crash never leaves a torn one.
+class ResumeFile {
+public:
+    static std::string pathFor(const std::string& outputName);
+    // Fails on a missing, truncated or foreign file.
+    static bool load(const std::string& path, ResumeState& out);
+    static bool save(const std::string& path, const ResumeState& state);
+    static void remove(const std::string& path);
+};
+
+#endif // RESUME_FILE_H
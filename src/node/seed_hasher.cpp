@@ -0,0 +1,147 @@
+#include "seed_hasher.h"
+#include "chunk_pipeline.h"
+#include "file_utils.h"
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// A block read from the file: whole chunks only, a partial last one is
+// carried over. Freed once both the chunk and the file hasher are done.
+struct Block {
+    std::vector<uint8_t> data;
+    size_t size = 0; // Bytes of whole chunks at the front of `data`
+    size_t index = 0;
+    std::vector<uint32_t> lengths;
+    std::atomic<int> users{2};
+};
+
+} // namespace
+
+bool SeedHasher::hashFile(const std::string& path, const ChunkingParams& chunking, uint32_t chunkSize,
+                          HashAlgorithm algorithm, size_t threads, SeedHashResult& out, SeedProgress* progress) {
+    std::error_code ec;
+    uint64_t fileSize = std::filesystem::file_size(path, ec);
+    std::shared_ptr<FileHandle> file = FileUtils::openRead(path);
+    if (ec || !file) return false;
+    if (progress) progress->totalBytes = fileSize;
+
+    bool contentDefined = chunking.contentDefined;
+    size_t maxChunk = contentDefined ? chunking.maxSize : chunkSize;
+    if (maxChunk == 0) return false;
+    size_t blockSize = std::max(BLOCK_SIZE, 2 * maxChunk);
+    if (!contentDefined) blockSize -= blockSize % chunkSize; // Fixed chunks never straddle blocks
+    threads = std::max<size_t>(threads, 1);
+
+    // Enough buffers to keep every hasher busy while the next block is read
+    size_t bufferCount = threads + 2;
+    BoundedQueue<std::vector<uint8_t>> spare(bufferCount);
+    for (size_t i = 0; i < bufferCount; ++i) spare.push(std::vector<uint8_t>(blockSize));
+    BoundedQueue<std::shared_ptr<Block>> chunkQueue(bufferCount);
+    BoundedQueue<std::shared_ptr<Block>> fileQueue(bufferCount);
+
+    std::mutex mutex;
+    std::vector<std::vector<Digest>> blockHashes; // Per block, filled as their chunks are hashed
+
+    auto release = [&](const std::shared_ptr<Block>& block) {
+        if (--block->users > 0) return;
+        if (progress) progress->bytesDone += block->size;
+        spare.push(std::move(block->data));
+    };
+
+    std::vector<std::thread> hashers;
+    for (size_t t = 0; t < threads; ++t) {
+        hashers.emplace_back([&] {
+            std::shared_ptr<Block> block;
+            while (chunkQueue.pop(block)) {
+                std::vector<SHA256Input> inputs;
+                size_t pos = 0;
+                for (uint32_t length : block->lengths) {
+                    inputs.push_back(SHA256Input{block->data.data() + pos, length});
+                    pos += length;
+                }
+                std::vector<Digest> hashes = Hasher::digestMany(algorithm, inputs);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    blockHashes[block->index] = std::move(hashes);
+                }
+                release(block);
+            }
+        });
+    }
+    HashStream whole(algorithm);
+    std::thread fileHasher([&] {
+        std::shared_ptr<Block> block;
+        while (fileQueue.pop(block)) {
+            whole.update(block->data.data(), block->size);
+            release(block);
+        }
+    });
+
+    Chunker chunker(chunking);
+    std::vector<uint32_t> lengths;
+    bool ok = true;
+    uint64_t offset = 0; // File offset of the current buffer's first byte
+    size_t filled = 0;   // Bytes carried over to its front
+    std::vector<uint8_t> buffer;
+    spare.pop(buffer);
+    for (size_t index = 0;; ++index) {
+        size_t want = (size_t)std::min<uint64_t>(buffer.size() - filled, fileSize - offset - filled);
+        if (want > 0 && !FileUtils::readAt(file->fd(), buffer.data() + filled, want, offset + filled)) {
+            ok = false;
+            break;
+        }
+        filled += want;
+        bool last = offset + filled == fileSize;
+
+        auto block = std::make_shared<Block>();
+        block->index = index;
+        size_t pos = 0;
+        // A cut needs maxSize bytes ahead of it unless the file ends sooner
+        while (pos < filled && (last || filled - pos >= maxChunk)) {
+            size_t length = contentDefined ? chunker.cut(buffer.data() + pos, filled - pos)
+                                           : std::min<size_t>(chunkSize, filled - pos);
+            block->lengths.push_back((uint32_t)length);
+            pos += length;
+        }
+        lengths.insert(lengths.end(), block->lengths.begin(), block->lengths.end());
+
+        std::vector<uint8_t> next;
+        if (!last) {
+            spare.pop(next);
+            memcpy(next.data(), buffer.data() + pos, filled - pos);
+        }
+        block->size = pos;
+        block->data = std::move(buffer);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            blockHashes.emplace_back();
+        }
+        chunkQueue.push(block);
+        fileQueue.push(block);
+        if (last) break;
+
+        offset += pos;
+        filled -= pos;
+        buffer = std::move(next);
+    }
+
+    chunkQueue.close();
+    fileQueue.close();
+    for (std::thread& t : hashers) t.join();
+    fileHasher.join();
+    if (!ok) return false;
+
+    out.fileHash = whole.finish();
+    out.layout = contentDefined ? ChunkLayout::variable(lengths) : ChunkLayout::fixed(fileSize, chunkSize);
+    out.chunkHashes.clear();
+    out.chunkHashes.reserve(lengths.size());
+    for (const std::vector<Digest>& hashes : blockHashes) {
+        out.chunkHashes.insert(out.chunkHashes.end(), hashes.begin(), hashes.end());
+    }
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef SEED_HASHER_H
+#define SEED_HASHER_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include "digest.h"
+#include "chunker.h"
+#include "hasher.h"
+
+// How far along one file being hashed for seeding is, for the `seeds`
+// command. Updated by the hashing threads while it runs.
+struct SeedProgress {
+    std::string path;
+    uint64_t totalBytes = 0;
+    std::atomic<uint64_t> bytesDone{0}; // Read and hashed, both per chunk and into the file hash
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+    double seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    }
+};
+
+struct SeedHashResult {
+    Digest fileHash;
+    ChunkLayout layout;
+    std::vector<Digest> chunkHashes;
+};
+
+// Hashes a file for seeding in a single read. The calling thread reads large
+// blocks and cuts them into chunks; a pool of threads hashes the chunks of
+// each block, while one more thread feeds the same blocks, in order, into the
+// whole-file hash. A fixed number of block buffers bounds the memory used and
+// lets a slow stage hold back the reads.
+class SeedHasher {
+public:
+    // Bytes read at a time. Content-defined chunks that straddle the end of a
+    // block are carried over to the next one.
+    static constexpr size_t BLOCK_SIZE = 16 * 1024 * 1024;
+
+    // Cuts by `chunking` if it is content-defined, into `chunkSize` chunks
+    // otherwise, and hashes with `algorithm`. `threads` chunk hashers, at
+    // least one. False if the file cannot be read.
+    static bool hashFile(const std::string& path, const ChunkingParams& chunking, uint32_t chunkSize,
+                         HashAlgorithm algorithm, size_t threads, SeedHashResult& out,
+                         SeedProgress* progress = nullptr);
+};
+
+#endif // SEED_HASHER_H
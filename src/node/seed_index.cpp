@@ -0,0 +1,136 @@
+#include "seed_index.h"
+#include "file_utils.h"
+#include <cstring>
+#include <sys/stat.h>
+
+constexpr char INDEX_MAGIC[8] = { 'P', 'W', 'S', 'E', 'E', 'D', 'X', '1' };
+constexpr uint8_t FLAG_CONTENT_DEFINED = 1;
+constexpr uint8_t FLAG_MERKLE = 2;
+constexpr uint8_t FLAG_BLAKE3 = 4;
+
+static void appendRaw(std::vector<char>& out, const void* data, size_t size) {
+    const char* b = static_cast<const char*>(data);
+    out.insert(out.end(), b, b + size);
+}
+
+bool FileStamp::of(const std::string& path, FileStamp& out) {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(path.c_str(), &st) != 0 || !(st.st_mode & _S_IFREG)) return false;
+    out.mtime = (int64_t)st.st_mtime * 1000000000;
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+#if defined(__APPLE__)
+    out.mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    out.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+    out.size = (uint64_t)st.st_size;
+    out.inode = (uint64_t)st.st_ino;
+    return true;
+}
+
+bool SeedIndex::save(const std::string& path, const std::vector<SeedIndexEntry>& entries) {
+    std::vector<char> out;
+    appendRaw(out, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    uint32_t count = (uint32_t)entries.size();
+    appendRaw(out, &count, sizeof(count));
+    for (const SeedIndexEntry& e : entries) {
+        uint32_t chunks = (uint32_t)e.chunkHashes.size();
+        if (chunks != e.layout.count()) return false;
+        uint32_t pathLength = (uint32_t)e.path.size();
+        uint8_t flags = (e.chunking.contentDefined ? FLAG_CONTENT_DEFINED : 0) | (e.merkle ? FLAG_MERKLE : 0) |
+                        (e.hash == HashAlgorithm::BLAKE3 ? FLAG_BLAKE3 : 0);
+        appendRaw(out, &pathLength, sizeof(pathLength));
+        appendRaw(out, e.path.data(), pathLength);
+        appendRaw(out, &e.stamp.size, sizeof(e.stamp.size));
+        appendRaw(out, &e.stamp.mtime, sizeof(e.stamp.mtime));
+        appendRaw(out, &e.stamp.inode, sizeof(e.stamp.inode));
+        uint32_t chunkSize = e.layout.chunkSize();
+        appendRaw(out, &flags, sizeof(flags));
+        appendRaw(out, &chunkSize, sizeof(chunkSize));
+        appendRaw(out, &e.chunking.minSize, sizeof(e.chunking.minSize));
+        appendRaw(out, &e.chunking.avgSize, sizeof(e.chunking.avgSize));
+        appendRaw(out, &e.chunking.maxSize, sizeof(e.chunking.maxSize));
+        appendRaw(out, e.fileHash.data(), Digest::SIZE);
+        appendRaw(out, &chunks, sizeof(chunks));
+        appendRaw(out, e.chunkHashes.data(), (size_t)chunks * Digest::SIZE);
+        if (e.chunking.contentDefined) {
+            std::vector<uint32_t> lengths = e.layout.lengths();
+            appendRaw(out, lengths.data(), lengths.size() * sizeof(uint32_t));
+        }
+    }
+    return FileUtils::writeFileAtomic(path, out.data(), out.size());
+}
+
+bool SeedIndex::load(const std::string& path, std::vector<SeedIndexEntry>& out, size_t& stale) {
+    out.clear();
+    stale = 0;
+    MappedFile file;
+    if (!file.open(path)) return false;
+    const uint8_t* p = file.data();
+    const uint8_t* end = p + file.size();
+    auto take = [&](void* dst, size_t size) {
+        if ((size_t)(end - p) < size) return false;
+        memcpy(dst, p, size);
+        p += size;
+        return true;
+    };
+
+    char magic[sizeof(INDEX_MAGIC)];
+    uint32_t count;
+    if (!take(magic, sizeof(magic)) || memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0) return false;
+    if (!take(&count, sizeof(count))) return false;
+    for (uint32_t i = 0; i < count; ++i) {
+        SeedIndexEntry e;
+        uint32_t pathLength;
+        uint8_t flags;
+        uint32_t chunkSize;
+        uint32_t chunks;
+        if (!take(&pathLength, sizeof(pathLength)) || (size_t)(end - p) < pathLength) return false;
+        e.path.assign(reinterpret_cast<const char*>(p), pathLength);
+        p += pathLength;
+        if (!take(&e.stamp.size, sizeof(e.stamp.size)) || !take(&e.stamp.mtime, sizeof(e.stamp.mtime)) ||
+            !take(&e.stamp.inode, sizeof(e.stamp.inode)) || !take(&flags, sizeof(flags)) ||
+            !take(&chunkSize, sizeof(chunkSize)) ||
+            !take(&e.chunking.minSize, sizeof(e.chunking.minSize)) ||
+            !take(&e.chunking.avgSize, sizeof(e.chunking.avgSize)) ||
+            !take(&e.chunking.maxSize, sizeof(e.chunking.maxSize)) || !take(e.fileHash.data(), Digest::SIZE) ||
+            !take(&chunks, sizeof(chunks))) {
+            return false;
+        }
+        e.chunking.contentDefined = flags & FLAG_CONTENT_DEFINED;
+        e.merkle = flags & FLAG_MERKLE;
+        e.hash = flags & FLAG_BLAKE3 ? HashAlgorithm::BLAKE3 : HashAlgorithm::SHA256;
+        size_t hashesSize = (size_t)chunks * Digest::SIZE;
+        size_t lengthsSize = e.chunking.contentDefined ? (size_t)chunks * sizeof(uint32_t) : 0;
+        if ((size_t)(end - p) < hashesSize + lengthsSize) return false;
+
+        FileStamp now;
+        if (!FileStamp::of(e.path, now) || now != e.stamp || (!e.chunking.contentDefined && chunkSize == 0)) {
+            ++stale;
+            p += hashesSize + lengthsSize;
+            continue;
+        }
+        e.chunkHashes.resize(chunks);
+        memcpy(e.chunkHashes.data(), p, hashesSize);
+        p += hashesSize;
+        if (e.chunking.contentDefined) {
+            std::vector<uint32_t> lengths(chunks);
+            memcpy(lengths.data(), p, lengthsSize);
+            p += lengthsSize;
+            e.layout = ChunkLayout::variable(lengths);
+        } else {
+            e.layout = ChunkLayout::fixed(e.stamp.size, chunkSize);
+        }
+        // A layout that does not cover the file is as good as stale
+        if (e.layout.fileSize() != e.stamp.size || e.layout.count() != chunks) {
+            ++stale;
+            continue;
+        }
+        out.push_back(std::move(e));
+    }
+    return p == end;
+}
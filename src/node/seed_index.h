@@ -0,0 +1,59 @@
+#ifndef SEED_INDEX_H
+#define SEED_INDEX_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "digest.h"
+#include "chunker.h"
+#include "hasher.h"
+
+// What identifies a file's contents on disk without reading it. A file
+// whose size, modification time and inode are unchanged is taken to hold
+// what it held when it was hashed.
+struct FileStamp {
+    uint64_t size = 0;
+    int64_t mtime = 0; // Nanoseconds since the epoch
+    uint64_t inode = 0;
+
+    // False if `path` cannot be stat'ed or is not a regular file.
+    static bool of(const std::string& path, FileStamp& out);
+
+    bool operator==(const FileStamp& other) const {
+        return size == other.size && mtime == other.mtime && inode == other.inode;
+    }
+    bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+
+// One seeded file as it was hashed.
+struct SeedIndexEntry {
+    std::string path;        // As passed to `seed`
+    FileStamp stamp;
+    ChunkingParams chunking; // Sizes only matter if content-defined
+    bool merkle = false;     // fileHash is the Merkle identity
+    HashAlgorithm hash = HashAlgorithm::SHA256;
+    Digest fileHash;
+    ChunkLayout layout;
+    std::vector<Digest> chunkHashes;
+};
+
+// The daemon's record of the files it seeds, so that a restart can serve
+// them again without rehashing. Layout: magic "PWSEEDX1", entry count u32,
+// then per entry: path length u32, path, size u64, mtime i64, inode u64,
+// flags u8 (1 content-defined, 2 Merkle, 4 BLAKE3), fixed chunk size u32 (0 if
+// content-defined), min/avg/max content-defined chunk sizes u32 x 3,
+// file hash 32 bytes, chunk count u32, chunk count x 32-byte chunk hashes,
+// and chunk count x u32 lengths if content-defined. Saved with
+// FileUtils::writeFileAtomic.
+class SeedIndex {
+public:
+    // Maps the index and returns the entries whose files still match their
+    // stamp; `stale` counts the others. The hashes of a stale entry are
+    // skipped without being read. False on a missing, truncated or foreign
+    // index.
+    static bool load(const std::string& path, std::vector<SeedIndexEntry>& out, size_t& stale);
+    static bool save(const std::string& path, const std::vector<SeedIndexEntry>& entries);
+};
+
+#endif // SEED_INDEX_H
@@ -0,0 +1,126 @@
+#include "transfer_budget.h"
+#include <algorithm>
+#include <thread>
+
+// How often a worker waiting for a connection re-checks its stop condition.
+constexpr auto ACQUIRE_POLL = std::chrono::milliseconds(100);
+// The bucket holds at most this much time's worth of bandwidth, so an idle
+// spell cannot be saved up into a burst over the cap.
+constexpr double BURST_SECONDS = 0.1;
+
+TransferBudget::TransferBudget(size_t maxConns, uint64_t bytesPerSecond)
+    : connectionCap(maxConns), rate(bytesPerSecond), lastRefill(Clock::now()) {
+}
+
+void TransferBudget::addJob(uint32_t job, uint32_t weight) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto [it, added] = jobs.emplace(job, Job());
+    if (!added) totalWeight -= it->second.weight;
+    it->second.weight = std::max(1u, weight);
+    totalWeight += it->second.weight;
+    slotFreed.notify_all();
+}
+
+void TransferBudget::setWeight(uint32_t job, uint32_t weight) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(job);
+    if (it == jobs.end()) return;
+    totalWeight -= it->second.weight;
+    it->second.weight = std::max(1u, weight);
+    totalWeight += it->second.weight;
+    slotFreed.notify_all();
+}
+
+void TransferBudget::removeJob(uint32_t job) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(job);
+    if (it == jobs.end()) return;
+    totalWeight -= it->second.weight;
+    inUse -= it->second.held;
+    jobs.erase(it);
+    slotFreed.notify_all();
+}
+
+size_t TransferBudget::share(const Job& job) const {
+    if (connectionCap == 0 || totalWeight == 0) return connectionCap;
+    return std::max<size_t>(1, (size_t)(connectionCap * job.weight / totalWeight));
+}
+
+bool TransferBudget::othersStarved(uint32_t job) const {
+    for (const auto& [id, j] : jobs) {
+        if (id != job && j.waiting > 0 && j.held < share(j)) return true;
+    }
+    return false;
+}
+
+bool TransferBudget::acquireConnection(uint32_t job, const std::function<bool()>& stop) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = jobs.find(job);
+    if (it == jobs.end()) return false;
+    Job& j = it->second;
+    j.waiting++;
+    while (true) {
+        bool granted = connectionCap == 0 ||
+                       (inUse < connectionCap && (j.held < share(j) || !othersStarved(job)));
+        if (granted) {
+            j.waiting--;
+            j.held++;
+            inUse++;
+            return true;
+        }
+        if (stop()) {
+            j.waiting--;
+            return false;
+        }
+        slotFreed.wait_for(lock, ACQUIRE_POLL);
+    }
+}
+
+void TransferBudget::releaseConnection(uint32_t job) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(job);
+    if (it == jobs.end() || it->second.held == 0) return;
+    it->second.held--;
+    inUse--;
+    slotFreed.notify_all();
+}
+
+bool TransferBudget::shouldYield(uint32_t job) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (connectionCap == 0) return false;
+    auto it = jobs.find(job);
+    if (it == jobs.end()) return false;
+    Job& j = it->second;
+    if (j.held <= share(j) || !othersStarved(job)) return false;
+    j.held--;
+    inUse--;
+    slotFreed.notify_all();
+    return true;
+}
+
+void TransferBudget::consume(size_t bytes) {
+    if (rate == 0) return;
+    std::chrono::duration<double> wait;
+    {
+        std::lock_guard<std::mutex> lock(bucketMutex);
+        Clock::time_point now = Clock::now();
+        double elapsed = std::chrono::duration<double>(now - lastRefill).count();
+        lastRefill = now;
+        tokens = std::min(rate * BURST_SECONDS, tokens + elapsed * rate);
+        tokens -= (double)bytes;
+        if (tokens >= 0) return;
+        wait = std::chrono::duration<double>(-tokens / rate);
+    }
+    std::this_thread::sleep_for(wait);
+}
+
+size_t TransferBudget::connectionsInUse() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return inUse;
+}
+
+size_t TransferBudget::shareOf(uint32_t job) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(job);
+    return it == jobs.end() ? 0 : share(it->second);
+}
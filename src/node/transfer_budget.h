@@ -0,0 +1,73 @@
+#ifndef TRANSFER_BUDGET_H
+#define TRANSFER_BUDGET_H
+
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+// Peer connections and download bandwidth shared by every running download.
+//
+// Connections: each running job is entitled to a share of the cap in
+// proportion to its weight (its priority). A job may go past its share while
+// nobody else is waiting, and gives the extra connections back through
+// shouldYield() once another job below its share asks for one.
+//
+// Bandwidth: one token bucket for all downloads. Bytes are charged after
+// they are received; a worker that overdraws the bucket sleeps until it is
+// back in credit, so the long-run rate stays under the cap.
+class TransferBudget {
+public:
+    // 0 means unlimited, for either cap.
+    TransferBudget(size_t maxConnections, uint64_t bytesPerSecond);
+
+    void addJob(uint32_t job, uint32_t weight);
+    void setWeight(uint32_t job, uint32_t weight);
+    void removeJob(uint32_t job);
+
+    // Blocks until `job` may open another connection. Gives up and returns
+    // false once `stop` returns true; it is polled while waiting.
+    bool acquireConnection(uint32_t job, const std::function<bool()>& stop);
+    void releaseConnection(uint32_t job);
+    // True if `job` should close one of its connections so a job below its
+    // share can have it. The slot is released by this call.
+    bool shouldYield(uint32_t job);
+
+    // Charges `bytes` against the bandwidth cap, sleeping if over it.
+    void consume(size_t bytes);
+
+    size_t maxConnections() const { return connectionCap; }
+    uint64_t bytesPerSecond() const { return rate; }
+    size_t connectionsInUse() const;
+    // Connections `job` is entitled to while every job wants all it can get.
+    size_t shareOf(uint32_t job) const;
+
+private:
+    struct Job {
+        uint32_t weight = 1;
+        size_t held = 0;
+        size_t waiting = 0; // Workers blocked in acquireConnection
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    size_t share(const Job& job) const;
+    bool othersStarved(uint32_t job) const;
+
+    size_t connectionCap;
+    uint64_t rate;
+
+    mutable std::mutex mutex;
+    std::condition_variable slotFreed;
+    std::map<uint32_t, Job> jobs;
+    size_t inUse = 0;
+    uint64_t totalWeight = 0;
+
+    std::mutex bucketMutex;
+    double tokens = 0;
+    Clock::time_point lastRefill;
+};
+
+#endif // TRANSFER_BUDGET_H
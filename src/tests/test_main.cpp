@@ -1,7 +1,32 @@
 #include "../common/sha256.h"
+#include "../common/blake3.h"
+#include "../common/hasher.h"
+#include "../node/chunk_cache.h"
+#include "../node/chunk_bitfield.h"
+#include "../node/piece_picker.h"
+#include "../node/peer_rate.h"
+#include "../node/resume_file.h"
+#include "../node/chunk_pipeline.h"
+#include "../node/transfer_budget.h"
+#include "../node/download_manager.h"
+#include "../node/peer_reputation.h"
+#include "../node/bundle.h"
+#include "../node/chunk_store.h"
+#include "../node/chunker.h"
+#include "../node/seed_hasher.h"
+#include "../node/merkle_tree.h"
+#include "../node/seed_index.h"
 #include <iostream>
+#include <fstream>
+#include <filesystem>
 #include <cassert>
 #include <string>
+#include <set>
+#include <map>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <functional>
 
 void testSHA256() {
     std::cout << "Testing SHA256..." << std::endl;
@@ -19,10 +44,810 @@ void testSHA256() {
     std::string expectedEmpty = "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
     assert(SHA256::hash(empty) == expectedEmpty);
     std::cout << "SHA256 empty string passed." << std::endl;
+
+    Digest parsed;
+    assert(Digest::fromHex(expected, parsed) && parsed == SHA256::digest(input) && parsed.hex() == expected);
+    assert(Digest::fromHex("B94D27B9934D3E08A52E52D7DA7DABFAC484EFE37A5380EE9088F7ACE2EFCDE9", parsed));
+    assert(!Digest::fromHex(expected.substr(1), parsed) && !Digest::fromHex(expected.substr(1) + "g", parsed));
+    std::cout << "Digest hex round trip passed." << std::endl;
+}
+
+// Every backend this CPU has must agree with the known vectors, and batched
+// hashing with single hashing, over lengths around the padding boundaries.
+void testSHA256Backends() {
+    std::vector<std::pair<std::string, std::string>> vectors = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"hello world", "b94d27b9934d3e08a52e52d7da7dabfac484efe37a5380ee9088f7ace2efcde9"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+        {std::string(1000000, 'a'), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+    };
+    std::mt19937 rng(3);
+    std::vector<std::string> messages;
+    for (size_t len = 0; len < 200; ++len) {
+        std::string m(len, '\0');
+        for (char& c : m) c = (char)rng();
+        messages.push_back(m);
+    }
+    messages.push_back(std::string(512 * 1024 + 7, 'q'));
+
+    SHA256Backend original = SHA256::backend();
+    [[maybe_unused]] bool portable = SHA256::setBackend(SHA256Backend::PORTABLE);
+    assert(portable);
+    std::vector<Digest> reference;
+    for (const std::string& m : messages) reference.push_back(SHA256::digest(m));
+    std::vector<SHA256Input> inputs;
+    for (const std::string& m : messages) inputs.push_back(SHA256Input{m.data(), m.size()});
+
+    for (SHA256Backend b : {SHA256Backend::PORTABLE, SHA256Backend::SHA_NI, SHA256Backend::AVX2}) {
+        if (!SHA256::setBackend(b)) {
+            std::cout << "SHA256 " << SHA256::backendName(b) << " not supported here, skipped." << std::endl;
+            continue;
+        }
+        for ([[maybe_unused]] const auto& [input, expected] : vectors) {
+            assert(SHA256::hash(input) == expected);
+            assert(SHA256::digestMany({SHA256Input{input.data(), input.size()}})[0].hex() == expected);
+        }
+        for (size_t i = 0; i < messages.size(); ++i) assert(SHA256::digest(messages[i]) == reference[i]);
+        assert(SHA256::digestMany(inputs) == reference);
+        std::cout << "SHA256 " << SHA256::backendName(b) << " backend passed." << std::endl;
+    }
+    SHA256::setBackend(original);
+}
+
+// The official vectors (input byte i is i % 251), through every backend this
+// CPU has, whole and fed in uneven pieces.
+void testBlake3() {
+    std::vector<std::pair<size_t, std::string>> vectors = {
+        {0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"},
+        {1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213"},
+        {1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11"},
+        {1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"},
+        {1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"},
+        {2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a"},
+        {102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085"},
+    };
+    Blake3Backend original = Blake3::backend();
+    for (Blake3Backend b : {Blake3Backend::PORTABLE, Blake3Backend::SSE41, Blake3Backend::AVX2}) {
+        if (!Blake3::setBackend(b)) {
+            std::cout << "BLAKE3 " << Blake3::backendName(b) << " not supported here, skipped." << std::endl;
+            continue;
+        }
+        for (const auto& [length, expected] : vectors) {
+            std::string input(length, '\0');
+            for (size_t i = 0; i < length; ++i) input[i] = (char)(i % 251);
+            assert(Blake3::hash(input) == expected);
+            Blake3Stream stream;
+            for (size_t pos = 0, step = 1; pos < length; pos += step, step = step * 3 + 1) {
+                stream.update(input.data() + pos, std::min(step, length - pos));
+            }
+            assert(stream.finish().hex() == expected);
+        }
+        std::cout << "BLAKE3 " << Blake3::backendName(b) << " backend passed." << std::endl;
+    }
+    Blake3::setBackend(original);
+
+    HashAlgorithm algorithm;
+    [[maybe_unused]] bool parsed = Hasher::parse("blake3", algorithm);
+    assert(parsed && algorithm == HashAlgorithm::BLAKE3);
+    parsed = Hasher::parse("sha256", algorithm);
+    assert(parsed && algorithm == HashAlgorithm::SHA256);
+    parsed = Hasher::parse("md5", algorithm);
+    assert(!parsed);
+    assert(Hasher::digest(HashAlgorithm::BLAKE3, "abc", 3) == Blake3::digest("abc"));
+    assert(Hasher::digest(HashAlgorithm::SHA256, "abc", 3) == SHA256::digest("abc"));
+    std::cout << "Hasher dispatch passed." << std::endl;
+}
+
+static ChunkBuffer makeChunk(size_t size) {
+    return std::make_shared<const std::vector<char>>(size, 'x');
+}
+
+void testChunkCache() {
+    std::cout << "Testing ChunkCache..." << std::endl;
+
+    // LRU: room for three chunks; touching chunk 0 makes chunk 1 the victim.
+    Digest f = SHA256::digest("f");
+    ChunkCache lru(300, CachePolicy::LRU, 1);
+    ChunkBuffer first = makeChunk(100);
+    lru.put(f, 0, first);
+    lru.put(f, 1, makeChunk(100));
+    lru.put(f, 2, makeChunk(100));
+    ChunkBuffer hit = lru.get(f, 0);
+    assert(hit == first); // Same buffer, no copy
+    lru.put(f, 3, makeChunk(100));
+    hit = lru.get(f, 1);
+    assert(hit == nullptr);
+    hit = lru.get(f, 0);
+    assert(hit != nullptr);
+    assert(lru.hits() == 2 && lru.misses() == 1 && lru.evictions() == 1);
+    std::cout << "ChunkCache LRU eviction passed." << std::endl;
+
+    // SLRU: a chunk hit twice survives a scan of one-off chunks.
+    ChunkCache slru(300, CachePolicy::SLRU, 1);
+    slru.put(f, 0, makeChunk(100));
+    slru.get(f, 0);
+    for (uint32_t i = 1; i < 10; ++i) slru.put(f, i, makeChunk(100));
+    hit = slru.get(f, 0);
+    assert(hit != nullptr);
+    hit = slru.get(f, 1);
+    assert(hit == nullptr);
+    assert(slru.sizeBytes() <= 300);
+    std::cout << "ChunkCache SLRU protection passed." << std::endl;
+}
+
+void testPiecePicker() {
+    std::cout << "Testing PiecePicker..." << std::endl;
+
+    // 100-byte chunks in 40-byte blocks; the last chunk is short.
+    // Peer 0 has everything, peer 1 only chunks 0-1, so 2 and 3 are rarest.
+    PiecePicker picker(390, 100, 40);
+    assert(picker.chunkCount() == 4 && picker.chunkLength(3) == 90);
+    picker.setPeerBitfield(0, {true, true, true, true});
+    picker.setPeerBitfield(1, {true, true, false, false});
+    assert(picker.availability(0) == 2 && picker.availability(3) == 1);
+
+    BlockRequest a, b;
+    [[maybe_unused]] bool ok = picker.pickBlock(0, a) && picker.pickBlock(0, b);
+    assert(ok);
+    assert((a.chunk == 2 || a.chunk == 3) && b.chunk == a.chunk);
+    assert(a.offset == 0 && a.length == 40 && b.offset == 40);
+    std::cout << "PiecePicker rarest-first passed." << std::endl;
+
+    // A started chunk is shared between peers and completes once all blocks are in.
+    picker.releaseBlock(0, a);
+    picker.releaseBlock(0, b);
+    BlockRequest c, d, e;
+    ok = picker.pickBlock(1, c) && picker.pickBlock(0, d) && picker.pickBlock(1, e);
+    assert(ok && c.chunk < 2);
+    assert(d.chunk == c.chunk && d.offset == 40);
+    assert(e.chunk == c.chunk && e.offset == 80 && e.length == 20);
+    [[maybe_unused]] bool cDone = picker.blockDone(1, c);
+    [[maybe_unused]] bool dDone = picker.blockDone(0, d);
+    [[maybe_unused]] bool eDone = picker.blockDone(1, e);
+    assert(!cDone && !dDone && eDone);
+    [[maybe_unused]] size_t reset = picker.chunkFailed(c.chunk).size();
+    assert(reset == 2);
+    BlockRequest whole;
+    ok = picker.pickBlock(0, whole, true);
+    assert(ok && whole.offset == 0 && whole.length == picker.chunkLength(whole.chunk));
+    std::cout << "PiecePicker blocks passed." << std::endl;
+
+    // Peer 1 is never handed a chunk it lacks.
+    picker.releaseBlock(0, whole);
+    picker.markDone(0);
+    picker.peerLacks(1, 1);
+    BlockRequest none;
+    ok = picker.pickBlock(1, none);
+    assert(!ok);
+    std::cout << "PiecePicker availability filter passed." << std::endl;
+
+    // Endgame: with one chunk left, an in-flight block is also given to a
+    // second peer, and the first copy to arrive makes the other redundant.
+    PiecePicker end(200, 100, 100);
+    end.setPeerBitfield(0, {true, true});
+    end.setPeerBitfield(1, {true, true});
+    BlockRequest first, second, dup;
+    ok = end.pickBlock(0, first) && end.pickBlock(0, second) && !end.pickBlock(1, dup);
+    assert(ok);
+    end.setEndgameThreshold(1);
+    end.markDone(second.chunk);
+    ok = end.inEndgame() && end.pickBlock(1, dup);
+    assert(ok && dup.chunk == first.chunk);
+    ok = end.pickBlock(1, dup);
+    assert(!ok && end.duplicateRequests() == 1);
+    ok = end.blockDone(1, dup);
+    assert(ok && !end.needsBlock(first));
+    ok = end.blockDone(0, first);
+    assert(!ok);
+    std::cout << "PiecePicker endgame passed." << std::endl;
+
+    // A failed chunk waits out its retry delay, then goes to one peer whole.
+    PiecePicker retry(100, 100, 40);
+    retry.setPeerBitfield(0, {true});
+    BlockRequest part;
+    while (retry.pickBlock(0, part)) retry.blockDone(0, part);
+    [[maybe_unused]] std::vector<int> released = retry.chunkFailed(0, std::chrono::milliseconds(50));
+    assert(released == std::vector<int>{0});
+    ok = retry.pickBlock(0, part);
+    assert(!ok && retry.failureCount(0) == 1 && retry.waitingForRetry());
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    assert(!retry.waitingForRetry());
+    ok = retry.pickBlock(0, part);
+    assert(ok && part.offset == 0 && part.length == 100);
+    ok = retry.blockDone(0, part);
+    assert(ok);
+    retry.chunkFailed(0);
+    retry.giveUp(0);
+    ok = retry.pickBlock(0, part);
+    assert(!ok && !retry.waitingForRetry() && !retry.finished());
+    std::cout << "PiecePicker retry passed." << std::endl;
+
+    // Sequential mode starts chunks in order, within the window past the cursor.
+    PiecePicker seq(500, 100, 100);
+    seq.setSequential(2);
+    seq.setPeerBitfield(0, {true, true, true, true, true});
+    BlockRequest s0, s1, s2;
+    ok = seq.pickBlock(0, s0) && seq.pickBlock(0, s1);
+    assert(ok && s0.chunk == 0 && s1.chunk == 1);
+    ok = seq.pickBlock(0, s2);
+    assert(!ok && seq.waitingForWindow());
+    seq.blockDone(0, s0);
+    seq.markDone(0);
+    ok = seq.pickBlock(0, s2);
+    assert(!ok); // Verified, but not consumed yet
+    seq.setCursor(1);
+    ok = seq.pickBlock(0, s2);
+    assert(ok && s2.chunk == 2);
+    std::cout << "PiecePicker sequential passed." << std::endl;
+
+    // Wire form round-trips through BITFIELD bytes.
+    ChunkBitfield have(10);
+    have.set(0);
+    have.set(9);
+    std::vector<uint8_t> bytes = have.toBytes();
+    assert(bytes.size() == 2 && bytes[0] == 0x80 && bytes[1] == 0x40);
+    std::vector<bool> bits = ChunkBitfield::fromBytes(bytes.data(), 10);
+    assert(bits[0] && bits[9] && !bits[1] && have.countSet() == 2);
+    std::cout << "ChunkBitfield encoding passed." << std::endl;
+}
+
+void testPeerRate() {
+    std::cout << "Testing PeerRate..." << std::endl;
+
+    // 1MB/s at 10ms minimum latency is a 10KB bandwidth-delay product:
+    // with 1KB blocks the window is 2 x 10 + 1 requests.
+    PeerRate rate("127.0.0.1", 9000, 64);
+    PeerRate::Clock::time_point t = PeerRate::Clock::now();
+    rate.touch(t);
+    for (int i = 1; i <= 20; ++i) {
+        rate.onDelivered(10 * 1024, std::chrono::milliseconds(i == 5 ? 10 : 40), t + std::chrono::milliseconds(10 * i));
+    }
+    assert(rate.throughput() > 1000 * 1000 && rate.throughput() < 1100 * 1024);
+    assert(rate.snapshot().minRttMs == 10);
+    assert(rate.targetDepth(1024) == 21);
+    // Capped by the configured maximum.
+    assert(rate.targetDepth(64) == 64);
+    std::cout << "PeerRate window passed." << std::endl;
+
+    assert(!rate.stalled(std::chrono::seconds(10), t + std::chrono::seconds(5)));
+    assert(rate.stalled(std::chrono::seconds(10), t + std::chrono::seconds(11)));
+    std::cout << "PeerRate stall passed." << std::endl;
+}
+
+void testResumeFile() {
+    std::cout << "Testing ResumeFile..." << std::endl;
+
+    ChunkBitfield have(10);
+    have.set(3);
+    have.set(9);
+    ResumeState state;
+    state.fileHash = SHA256::digest("file");
+    state.fileSize = 10 * 100 - 1;
+    state.chunkSize = 100;
+    for (int i = 0; i < 10; ++i) state.chunkHashes.push_back(SHA256::digest(std::to_string(i)));
+    state.haveBits = have.toBytes();
+
+    // Calls made outside assert() so they still run under NDEBUG
+    std::string path = "unit_test.resume";
+    [[maybe_unused]] bool ok = ResumeFile::save(path, state);
+    assert(ok);
+    ResumeState loaded;
+    ok = ResumeFile::load(path, loaded);
+    assert(ok);
+    assert(loaded.fileHash == state.fileHash && loaded.fileSize == state.fileSize && loaded.chunkSize == 100);
+    assert(loaded.chunkHashes == state.chunkHashes && loaded.haveBits == state.haveBits);
+
+    // Content-defined chunks keep their lengths
+    state.chunkSize = 0;
+    state.chunkLengths.assign(10, 99);
+    state.chunkLengths[9] = 108;
+    ok = ResumeFile::save(path, state) && ResumeFile::load(path, loaded);
+    assert(ok);
+    assert(loaded.chunkSize == 0 && loaded.chunkLengths == state.chunkLengths && loaded.haveBits == state.haveBits);
+
+    // A Merkle file keeps no hashes, only the bitfield
+    state.chunkSize = 100;
+    state.chunkLengths.clear();
+    state.chunkHashes.clear();
+    state.merkle = true;
+    ok = ResumeFile::save(path, state) && ResumeFile::load(path, loaded);
+    assert(ok);
+    assert(loaded.merkle && loaded.chunkHashes.empty() && loaded.haveBits == state.haveBits);
+    assert(loaded.hash == HashAlgorithm::SHA256);
+
+    // Only a hash other than SHA-256 is written down
+    state.hash = HashAlgorithm::BLAKE3;
+    ok = ResumeFile::save(path, state) && ResumeFile::load(path, loaded);
+    assert(ok && loaded.hash == HashAlgorithm::BLAKE3);
+    ResumeFile::remove(path);
+    ok = ResumeFile::load(path, loaded);
+    assert(!ok);
+    std::cout << "ResumeFile round trip passed." << std::endl;
+}
+
+void testChunkPipeline() {
+    std::cout << "Testing ChunkPipeline..." << std::endl;
+
+    // Chunks filled with their own index verify; chunk 5 is corrupt.
+    std::mutex mutex;
+    std::set<uint32_t> written;
+    std::set<uint32_t> corrupt;
+    ChunkPipeline pipeline(2, 2, 1,
+        [](uint32_t index, const std::vector<char>& data) {
+            for (char c : data) if (c != (char)index) return false;
+            return true;
+        },
+        [&](uint32_t index) {
+            std::lock_guard<std::mutex> lock(mutex);
+            corrupt.insert(index);
+        },
+        [&](uint32_t index, [[maybe_unused]] const std::vector<char>& data) {
+            std::lock_guard<std::mutex> lock(mutex);
+            assert(data.size() == 100);
+            written.insert(index);
+        });
+    for (uint32_t i = 0; i < 20; ++i) {
+        std::vector<char> buf = pipeline.acquireBuffer(100);
+        std::fill(buf.begin(), buf.end(), (char)(i == 5 ? 0 : i));
+        [[maybe_unused]] bool ok = pipeline.submit(i, std::move(buf));
+        assert(ok);
+    }
+    pipeline.finish();
+    assert(pipeline.pending() == 0);
+    assert(written.size() == 19 && !written.count(5));
+    assert(corrupt.size() == 1 && corrupt.count(5));
+    [[maybe_unused]] bool late = pipeline.submit(20, pipeline.acquireBuffer(100));
+    assert(!late);
+
+    [[maybe_unused]] PipelineStats s = pipeline.stats();
+    assert(s.verified == 19 && s.corrupt == 1 && s.written == 19);
+    assert(s.verifyPeak <= s.verifyCapacity && s.writePeak <= 1);
+    // Twenty chunks through queues this small must have recycled buffers
+    assert(s.buffersReused > 0 && s.buffersAllocated < 20);
+    std::cout << "ChunkPipeline verify/write passed." << std::endl;
+}
+
+static bool waitFor(const std::function<bool()>& cond) {
+    for (int i = 0; i < 500; ++i) {
+        if (cond()) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+void testTransferBudget() {
+    std::cout << "Testing TransferBudget..." << std::endl;
+
+    // Alone, a job may take every connection.
+    TransferBudget budget(4, 0);
+    budget.addJob(1, 1);
+    [[maybe_unused]] bool ok = true;
+    for (int i = 0; i < 4; ++i) ok = budget.acquireConnection(1, [] { return false; }) && ok;
+    assert(ok && budget.connectionsInUse() == 4 && !budget.shouldYield(1));
+
+    // A second job waiting for one gets the first job's extra connections back.
+    budget.addJob(2, 1);
+    assert(budget.shareOf(1) == 2 && budget.shareOf(2) == 2);
+    std::atomic<bool> acquired{false};
+    std::thread waiter([&] { acquired = budget.acquireConnection(2, [] { return false; }); });
+    ok = waitFor([&] { return budget.shouldYield(1); });
+    assert(ok);
+    waiter.join();
+    assert(acquired && budget.connectionsInUse() == 4 && !budget.shouldYield(1));
+    ok = budget.acquireConnection(2, [] { return true; });
+    assert(!ok); // Full: gives up when told to stop
+    budget.removeJob(1);
+    assert(budget.connectionsInUse() == 1);
+    std::cout << "TransferBudget connection shares passed." << std::endl;
+
+    // 1 MB at 4 MB/s takes about a quarter of a second.
+    TransferBudget limited(0, 4 * 1024 * 1024);
+    [[maybe_unused]] auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 16; ++i) limited.consume(64 * 1024);
+    assert(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(200));
+    std::cout << "TransferBudget rate cap passed." << std::endl;
+}
+
+void testDownloadManager() {
+    std::cout << "Testing DownloadManager..." << std::endl;
+
+    // Fake downloads run until released or stopped.
+    std::mutex mutex;
+    std::vector<Digest> started;
+    std::atomic<bool> release{false};
+    DownloadManager manager([&](const DownloadSpec& spec, DownloadControl& control) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            started.push_back(spec.fileHash);
+        }
+        while (!release && !control.stopRequested()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return !control.stopRequested();
+    }, 1, 0, 0);
+    auto stateOf = [&](uint32_t id) {
+        DownloadJobInfo info;
+        [[maybe_unused]] bool found = manager.find(id, info);
+        assert(found);
+        return info.state;
+    };
+    auto spec = [](const Digest& fileHash, const std::string& outputName) {
+        DownloadSpec s;
+        s.fileHash = fileHash;
+        s.outputName = outputName;
+        return s;
+    };
+
+    Digest ha = SHA256::digest("a"), hb = SHA256::digest("b"), hc = SHA256::digest("c");
+    uint32_t a = manager.add(spec(ha, "a.out"), 5);
+    uint32_t b = manager.add(spec(hb, "b.out"), 5);
+    uint32_t c = manager.add(spec(hc, "c.out"), 9);
+    [[maybe_unused]] uint32_t duplicate = manager.add(spec(ha, "a.out"));
+    assert(duplicate == 0); // Same output still in progress
+    assert(stateOf(a) == JobState::RUNNING && stateOf(b) == JobState::QUEUED);
+
+    // Pausing frees the slot for the highest priority job, not the oldest.
+    [[maybe_unused]] bool ok = manager.pause(a);
+    assert(ok);
+    ok = waitFor([&] { return stateOf(a) == JobState::PAUSED; }) &&
+         waitFor([&] { return stateOf(c) == JobState::RUNNING; });
+    assert(ok && stateOf(b) == JobState::QUEUED);
+    ok = manager.resume(a) && !manager.resume(b);
+    assert(ok);
+
+    release = true;
+    ok = waitFor([&] {
+        return stateOf(a) == JobState::DONE && stateOf(b) == JobState::DONE && stateOf(c) == JobState::DONE;
+    });
+    assert(ok);
+    std::lock_guard<std::mutex> lock(mutex);
+    assert((started == std::vector<Digest>{ha, hc, ha, hb}));
+    std::cout << "DownloadManager scheduling passed." << std::endl;
+}
+
+void testPeerReputation() {
+    std::cout << "Testing PeerReputation..." << std::endl;
+
+    PeerReputation reputation(2);
+    std::string peer = PeerReputation::keyOf("10.0.0.1", 9000);
+    assert(peer == "10.0.0.1:9000");
+    reputation.onSuspect(peer);
+    reputation.onSuspect(peer);
+    assert(!reputation.banned(peer)); // Shared blame never bans
+    [[maybe_unused]] bool bannedNow = reputation.onCorrupt(peer);
+    assert(!bannedNow);
+    bannedNow = reputation.onCorrupt(peer);
+    assert(bannedNow && reputation.banned(peer));
+    bannedNow = reputation.onCorrupt(peer);
+    assert(!bannedNow); // Banned once
+
+    [[maybe_unused]] uint32_t failures = reputation.onFailure("b");
+    assert(failures == 1);
+    failures = reputation.onFailure("b");
+    assert(failures == 2);
+    reputation.onSuccess("b");
+    failures = reputation.onFailure("b");
+    assert(failures == 1);
+    auto records = reputation.snapshot();
+    assert(records.size() == 2 && records[1].second.failed == 3 && records[0].second.suspect == 2);
+    std::cout << "PeerReputation ban passed." << std::endl;
+
+    auto base = std::chrono::milliseconds(100);
+    auto cap = std::chrono::milliseconds(1000);
+    assert(PeerReputation::backoff(1, base, cap) == base);
+    assert(PeerReputation::backoff(3, base, cap) == std::chrono::milliseconds(400));
+    assert(PeerReputation::backoff(10, base, cap) == cap);
+    std::cout << "PeerReputation backoff passed." << std::endl;
+}
+
+void testBundle() {
+    std::cout << "Testing Bundle..." << std::endl;
+    namespace fs = std::filesystem;
+
+    // Files are ordered by path and concatenated; 8-byte chunks span them.
+    std::string root = "unit_test_bundle";
+    fs::remove_all(root);
+    std::map<std::string, std::string> contents = {
+        {"z", "zzz"}, {"a", "aaaaa"}, {"b/c", ""}, {"b/d", "dddddddddddd"}};
+    for (const auto& [path, data] : contents) {
+        fs::create_directories(fs::path(root + "/src/" + path).parent_path());
+        std::ofstream(root + "/src/" + path, std::ios::binary) << data;
+    }
+    BundleManifest manifest;
+    manifest.chunkSize = 8;
+    [[maybe_unused]] bool ok = Bundle::scan(root + "/src", manifest) && Bundle::hashChunks(root + "/src", manifest);
+    assert(ok);
+    assert(manifest.files.size() == 4 && manifest.files[1].path == "b/c" && manifest.files[3].offset == 17);
+    std::string stream = "aaaaa" "dddddddddddd" "zzz";
+    assert(manifest.totalSize() == stream.size() && manifest.chunkHashes.size() == 3);
+    assert(manifest.chunkHashes[2] == SHA256::digest(stream.substr(16)));
+
+    std::vector<BundleSegment> segments = manifest.locate(4, 4);
+    assert(segments.size() == 2 && segments[0].file == 0 && segments[0].fileOffset == 4);
+    assert(segments[1].file == 2 && segments[1].length == 3 && segments[1].rangeOffset == 1);
+    std::vector<char> read(stream.size());
+    ok = Bundle::readAt(root + "/src", manifest, 0, read.data(), read.size());
+    assert(ok);
+    assert(std::string(read.data(), read.size()) == stream);
+
+    BundleManifest decoded;
+    ok = Bundle::decode(Bundle::encode(manifest), decoded);
+    assert(ok);
+    assert(decoded.files.size() == 4 && decoded.files[3].offset == 17 && decoded.chunkHashes == manifest.chunkHashes);
+    BundleManifest escaping = manifest;
+    escaping.files[0].path = "../a";
+    ok = Bundle::decode(Bundle::encode(escaping), decoded);
+    assert(!ok);
+    std::cout << "Bundle manifest passed." << std::endl;
+
+    // Only the selected directory is created and written.
+    std::vector<bool> selected = manifest.select({"b/"});
+    assert((selected == std::vector<bool>{false, true, true, false}));
+    auto shared = std::make_shared<const BundleManifest>(manifest);
+    {
+        std::unique_ptr<BundleOutput> out = BundleOutput::open(root + "/out", shared, selected);
+        ok = out && out->writeAt(0, stream.data(), stream.size()) && out->sync();
+        assert(ok);
+    }
+    assert(!fs::exists(root + "/out/a") && fs::exists(root + "/out/b/c"));
+    std::ifstream d(root + "/out/b/d", std::ios::binary);
+    assert(std::string(std::istreambuf_iterator<char>(d), std::istreambuf_iterator<char>()) == contents["b/d"]);
+    d.close();
+    fs::remove_all(root);
+    std::cout << "Bundle partial output passed." << std::endl;
+}
+
+void testChunkStore() {
+    std::cout << "Testing ChunkStore..." << std::endl;
+
+    // Two versions of a file share chunks "a" and "z"; "z" repeats in v2.
+    auto h = [](const char* name) { return SHA256::digest(name); };
+    ChunkStore store;
+    store.addFile(h("v1"), {h("a"), h("b"), h("z")}, {4, 4, 4});
+    store.addFile(h("v2"), {h("a"), h("z"), h("z"), h("c")}, {4, 4, 4, 2});
+    ChunkStoreStats s = store.stats();
+    assert(s.files == 2 && s.uniqueChunks == 4 && s.uniqueBytes == 14);
+    assert(s.referencedChunks == 7 && s.referencedBytes == 26);
+    std::vector<ChunkLocation> z = store.locate(h("z"));
+    assert(z.size() == 3 && z[0].fileHash == h("v1") && z[0].index == 2 && z[2].fileHash == h("v2") && z[2].index == 2);
+    assert(store.locate(h("missing")).empty());
+    std::cout << "ChunkStore dedup passed." << std::endl;
+
+    // Re-adding replaces; removing drops chunks no other file references.
+    store.addFile(h("v2"), {h("a"), h("z"), h("z"), h("c")}, {4, 4, 4, 2});
+    assert(store.stats().referencedChunks == 7);
+    store.removeFile(h("v1"));
+    s = store.stats();
+    assert(s.files == 1 && s.uniqueChunks == 3 && s.uniqueBytes == 10 && s.referencedBytes == 14);
+    assert(store.locate(h("b")).empty() && store.locate(h("z")).size() == 2);
+    store.removeFile(h("v2"));
+    assert(store.stats().uniqueChunks == 0 && store.stats().dedupRatio() == 1.0);
+    std::cout << "ChunkStore removal passed." << std::endl;
+}
+
+void testChunker() {
+    std::cout << "Testing Chunker..." << std::endl;
+
+    ChunkLayout fixed = ChunkLayout::fixed(10, 4);
+    assert(fixed.isFixed() && fixed.count() == 3 && fixed.offset(2) == 8 && fixed.length(2) == 2 && fixed.offset(3) == 10);
+    ChunkLayout variable = ChunkLayout::variable({3, 5, 2});
+    assert(!variable.isFixed() && variable.count() == 3 && variable.fileSize() == 10);
+    assert(variable.offset(1) == 3 && variable.length(1) == 5 && variable.maxLength() == 5);
+    assert(variable.lengths() == std::vector<uint32_t>({3, 5, 2}));
+    assert(ChunkLayout::variable({3, 0}).count() == 0);
+    std::cout << "ChunkLayout passed." << std::endl;
+
+    ChunkingParams params;
+    params.contentDefined = true;
+    params.minSize = 8 * 1024;
+    params.avgSize = 32 * 1024;
+    params.maxSize = 128 * 1024;
+    assert(params.valid());
+    std::mt19937 rng(7);
+    std::vector<uint8_t> data(2 * 1024 * 1024);
+    for (auto& b : data) b = (uint8_t)rng();
+    Chunker chunker(params);
+    auto cutAll = [&](const std::vector<uint8_t>& bytes) {
+        std::vector<size_t> ends;
+        for (size_t pos = 0; pos < bytes.size();) {
+            size_t length = chunker.cut(bytes.data() + pos, bytes.size() - pos);
+            assert(length > 0 && length <= params.maxSize);
+            assert(length >= params.minSize || pos + length == bytes.size());
+            pos += length;
+            ends.push_back(pos);
+        }
+        return ends;
+    };
+    std::vector<size_t> before = cutAll(data);
+    assert(before.size() > data.size() / params.maxSize && before.size() < data.size() / params.minSize);
+
+    // One inserted byte moves the boundaries after it by one and leaves the
+    // ones before it alone
+    std::vector<uint8_t> edited = data;
+    edited.insert(edited.begin() + data.size() / 2, 0x5a);
+    std::vector<size_t> after = cutAll(edited);
+    std::set<size_t> shifted;
+    for (size_t end : after) shifted.insert(end > data.size() / 2 ? end - 1 : end);
+    size_t kept = 0;
+    for (size_t end : before) kept += shifted.count(end);
+    assert(kept + 2 >= before.size());
+    std::cout << "Chunker boundaries passed." << std::endl;
+}
+
+void testSeedHasher() {
+    std::cout << "Testing SeedHasher..." << std::endl;
+
+    // Over two blocks, so content-defined chunks straddle a block boundary
+    std::string path = "unit_test.seed";
+    std::mt19937 rng(11);
+    std::string data(SeedHasher::BLOCK_SIZE + 3 * 1024 * 1024 + 123, '\0');
+    for (char& c : data) c = (char)rng();
+    std::ofstream(path, std::ios::binary) << data;
+    Digest expected;
+    [[maybe_unused]] bool ok = SHA256::digestFile(path, expected);
+    assert(ok);
+
+    ChunkingParams fixed;
+    SeedHashResult result;
+    SeedProgress progress;
+    ok = SeedHasher::hashFile(path, fixed, 512 * 1024, HashAlgorithm::SHA256, 3, result, &progress);
+    assert(ok);
+    assert(result.fileHash == expected && progress.bytesDone == data.size() && progress.totalBytes == data.size());
+    assert(result.layout.isFixed() && result.chunkHashes.size() == result.layout.count());
+    for (uint32_t i = 0; i < result.layout.count(); ++i) {
+        assert(result.chunkHashes[i] ==
+               SHA256::digest(data.data() + result.layout.offset(i), result.layout.length(i)));
+    }
+    std::cout << "SeedHasher fixed chunks passed." << std::endl;
+
+    ok = SeedHasher::hashFile(path, fixed, 512 * 1024, HashAlgorithm::BLAKE3, 2, result);
+    assert(ok && result.fileHash == Blake3::digest(data));
+    for (uint32_t i = 0; i < result.layout.count(); ++i) {
+        assert(result.chunkHashes[i] == Blake3::digest(data.data() + result.layout.offset(i), result.layout.length(i)));
+    }
+    std::cout << "SeedHasher BLAKE3 passed." << std::endl;
+
+    ChunkingParams cdc;
+    cdc.contentDefined = true;
+    std::vector<uint32_t> lengths;
+    ok = Chunker::cutFile(path, cdc, lengths) &&
+         SeedHasher::hashFile(path, cdc, 512 * 1024, HashAlgorithm::SHA256, 2, result);
+    assert(ok && result.fileHash == expected && result.layout.lengths() == lengths);
+    for (uint32_t i = 0; i < result.layout.count(); ++i) {
+        assert(result.chunkHashes[i] == Hasher::digest(HashAlgorithm::SHA256, data.data() + result.layout.offset(i),
+                                                       result.layout.length(i)));
+    }
+    std::remove(path.c_str());
+    ok = SeedHasher::hashFile(path, cdc, 512 * 1024, HashAlgorithm::SHA256, 2, result);
+    assert(!ok);
+    std::cout << "SeedHasher content-defined chunks passed." << std::endl;
+}
+
+void testMerkleTree() {
+    std::cout << "Testing MerkleTree..." << std::endl;
+
+    // Five spans, so the level above them has an unpaired node
+    std::vector<Digest> leaves;
+    for (uint32_t i = 0; i < 4 * MerkleTree::SPAN + 4; ++i) leaves.push_back(SHA256::digest(std::to_string(i)));
+    MerkleTree tree(leaves);
+    assert(tree.leafCount() == leaves.size() && MerkleTree::spanCount(tree.leafCount()) == 5);
+    assert(MerkleTree::spanLength(tree.leafCount(), 4) == 4 && MerkleTree::spanLength(tree.leafCount(), 5) == 0);
+
+    auto spanOf = [&](uint32_t span) {
+        auto begin = leaves.begin() + (size_t)span * MerkleTree::SPAN;
+        return std::vector<Digest>(begin, begin + MerkleTree::spanLength(tree.leafCount(), span));
+    };
+    for (uint32_t s = 0; s < 5; ++s) {
+        assert(MerkleTree::verify(tree.root(), tree.leafCount(), s, spanOf(s), tree.proof(s)));
+    }
+    std::vector<Digest> tampered = spanOf(1);
+    tampered[7] = SHA256::digest("x");
+    assert(!MerkleTree::verify(tree.root(), tree.leafCount(), 1, tampered, tree.proof(1)));
+    assert(!MerkleTree::verify(tree.root(), tree.leafCount(), 2, spanOf(1), tree.proof(1)));
+    assert(!MerkleTree::verify(tree.root(), tree.leafCount(), 0, spanOf(0), tree.proof(1)));
+
+    // A single chunk is its own root
+    MerkleTree one(std::vector<Digest>{leaves[0]});
+    assert(one.root() == leaves[0] && one.proof(0).empty());
+    assert(MerkleTree::identity(100, 100, one.root()) != MerkleTree::identity(100, 50, one.root()));
+    assert(MerkleTree::identity(100, 100, one.root()) !=
+           MerkleTree::identity(100, 100, one.root(), HashAlgorithm::BLAKE3));
+
+    // Spans are fetched on first use and evicted least recently used first
+    int fetches = 0;
+    bool lie = false;
+    MerkleHashes hashes(tree.root(), tree.leafCount(), 2,
+        [&](uint32_t span, std::vector<Digest>& out, std::vector<Digest>& proof) {
+            ++fetches;
+            out = spanOf(span);
+            if (lie) out[0] = SHA256::digest("x");
+            proof = tree.proof(span);
+            return true;
+        });
+    Digest h;
+    assert(hashes.get(5, h) && h == leaves[5] && fetches == 1);
+    assert(hashes.get(MerkleTree::SPAN + 1, h) && h == leaves[MerkleTree::SPAN + 1] && fetches == 2);
+    assert(hashes.get(6, h) && fetches == 2);
+    assert(hashes.get(4 * MerkleTree::SPAN, h) && h == leaves[4 * MerkleTree::SPAN] && fetches == 3);
+    assert(hashes.cached(0) && !hashes.cached(MerkleTree::SPAN));
+    lie = true;
+    assert(!hashes.get(2 * MerkleTree::SPAN, h) && !hashes.cached(2 * MerkleTree::SPAN));
+    assert(hashes.spansFetched() == 3 && !hashes.get(tree.leafCount(), h));
+    std::cout << "MerkleTree proofs passed." << std::endl;
+}
+
+void testSeedIndex() {
+    std::cout << "Testing SeedIndex..." << std::endl;
+
+    std::string fixedPath = "unit_test.fixed";
+    std::string cdcPath = "unit_test.cdc";
+    std::ofstream(fixedPath, std::ios::binary) << std::string(2500, 'a');
+    std::ofstream(cdcPath, std::ios::binary) << std::string(300, 'b');
+
+    SeedIndexEntry fixed;
+    fixed.path = fixedPath;
+    [[maybe_unused]] bool ok = FileStamp::of(fixedPath, fixed.stamp);
+    assert(ok && fixed.stamp.size == 2500);
+    fixed.fileHash = SHA256::digest("fixed");
+    fixed.layout = ChunkLayout::fixed(2500, 1000);
+    for (int i = 0; i < 3; ++i) fixed.chunkHashes.push_back(SHA256::digest(std::to_string(i)));
+    SeedIndexEntry cdc;
+    cdc.path = cdcPath;
+    ok = FileStamp::of(cdcPath, cdc.stamp);
+    assert(ok);
+    cdc.chunking.contentDefined = true;
+    cdc.merkle = true;
+    cdc.hash = HashAlgorithm::BLAKE3;
+    cdc.layout = ChunkLayout::variable({100, 200});
+    cdc.chunkHashes = {SHA256::digest("x"), SHA256::digest("y")};
+
+    std::string path = "unit_test.index";
+    ok = SeedIndex::save(path, {fixed, cdc});
+    assert(ok);
+    std::vector<SeedIndexEntry> loaded;
+    size_t stale = 0;
+    ok = SeedIndex::load(path, loaded, stale);
+    assert(ok && loaded.size() == 2 && stale == 0);
+    assert(loaded[0].path == fixedPath && loaded[0].stamp == fixed.stamp && loaded[0].fileHash == fixed.fileHash);
+    assert(loaded[0].layout.chunkSize() == 1000 && loaded[0].chunkHashes == fixed.chunkHashes);
+    assert(loaded[1].merkle && loaded[1].chunking.contentDefined && loaded[1].layout.lengths() == cdc.layout.lengths());
+    assert(loaded[0].hash == HashAlgorithm::SHA256 && loaded[1].hash == HashAlgorithm::BLAKE3);
+
+    // A file that changed, or went away, is left out
+    std::ofstream(fixedPath, std::ios::binary | std::ios::app) << "more";
+    std::remove(cdcPath.c_str());
+    ok = SeedIndex::load(path, loaded, stale);
+    assert(ok && loaded.empty() && stale == 2);
+
+    // A truncated index is rejected
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+    ok = SeedIndex::load(path, loaded, stale);
+    assert(!ok);
+    std::remove(path.c_str());
+    std::remove(fixedPath.c_str());
+    ok = SeedIndex::load(path, loaded, stale);
+    assert(!ok);
+    std::cout << "SeedIndex round trip passed." << std::endl;
 }
 
 int main() {
     testSHA256();
+    testSHA256Backends();
+    testBlake3();
+    testChunkCache();
+    testPiecePicker();
+    testPeerRate();
+    testResumeFile();
+    testChunkPipeline();
+    testTransferBudget();
+    testDownloadManager();
+    testPeerReputation();
+    testBundle();
+    testChunkStore();
+    testChunker();
+    testSeedHasher();
+    testMerkleTree();
+    testSeedIndex();
     std::cout << "All unit tests passed." << std::endl;
     return 0;
 }
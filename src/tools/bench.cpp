@@ -0,0 +1,230 @@
+#include "chunker.h"
+#include "seed_hasher.h"
+#include "sha256.h"
+#include "blake3.h"
+#include "hasher.h"
+#include <fstream>
+#include <thread>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <set>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <filesystem>
+
+// Fixed-size chunks, as seeded without --chunking=cdc.
+constexpr uint32_t FIXED_CHUNK_SIZE = 512 * 1024;
+// Edits made to the first version to get the second.
+constexpr int VERSION_EDITS = 16;
+
+using Cutter = std::function<size_t(const uint8_t*, size_t)>;
+
+static std::vector<uint32_t> cutAll(const std::vector<uint8_t>& data, const Cutter& cut) {
+    std::vector<uint32_t> lengths;
+    for (size_t pos = 0; pos < data.size();) {
+        size_t length = cut(data.data() + pos, data.size() - pos);
+        lengths.push_back((uint32_t)length);
+        pos += length;
+    }
+    return lengths;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Boundary finding alone, then with every chunk hashed as seeding does.
+static void throughput(const char* name, const std::vector<uint8_t>& data, const Cutter& cut) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint32_t> lengths = cutAll(data, cut);
+    double cutSeconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    size_t pos = 0;
+    for (uint32_t length : lengths) {
+        SHA256::digest(data.data() + pos, length);
+        pos += length;
+    }
+    double hashSeconds = secondsSince(start);
+
+    double gb = data.size() / 1e9;
+    std::cout << std::left << std::setw(8) << name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(10) << (cutSeconds > 0 ? gb / cutSeconds : 0) << " GB/s cut"
+              << std::setw(10) << gb / (cutSeconds + hashSeconds) << " GB/s cut+hash"
+              << std::setw(10) << lengths.size() << " chunks, "
+              << data.size() / std::max<size_t>(lengths.size(), 1) / 1024 << " KB avg" << std::endl;
+}
+
+// Share of the second version's bytes that sit in chunks the first already has.
+static void reuse(const char* name, const std::vector<uint8_t>& v1, const std::vector<uint8_t>& v2, const Cutter& cut) {
+    auto hashes = [&](const std::vector<uint8_t>& data, std::vector<uint32_t>& lengths) {
+        lengths = cutAll(data, cut);
+        std::vector<Digest> out;
+        size_t pos = 0;
+        for (uint32_t length : lengths) {
+            out.push_back(SHA256::digest(data.data() + pos, length));
+            pos += length;
+        }
+        return out;
+    };
+    std::vector<uint32_t> lengths1, lengths2;
+    std::vector<Digest> h1 = hashes(v1, lengths1);
+    std::vector<Digest> h2 = hashes(v2, lengths2);
+    std::set<Digest> known(h1.begin(), h1.end());
+    uint64_t reused = 0;
+    for (size_t i = 0; i < h2.size(); ++i) {
+        if (known.count(h2[i])) reused += lengths2[i];
+    }
+    std::cout << std::left << std::setw(8) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(8) << 100.0 * reused / v2.size() << "% of v2 reused ("
+              << (v2.size() - reused) / 1024 << " KB to fetch)" << std::endl;
+}
+
+// Every SHA-256 and BLAKE3 backend this CPU has, on chunk-sized messages:
+// one at a time as a download verifies them, and for SHA-256 in batches as
+// seeding hashes them. Then each algorithm, on its default backend, seeding
+// a file and verifying its chunks as the daemon does.
+static int benchHash(size_t megabytes) {
+    std::mt19937_64 rng(7);
+    std::vector<char> data(megabytes * 1024 * 1024);
+    for (auto& b : data) b = (char)rng();
+    std::vector<SHA256Input> chunks;
+    for (size_t pos = 0; pos < data.size(); pos += FIXED_CHUNK_SIZE) {
+        chunks.push_back(SHA256Input{data.data() + pos, std::min<size_t>(FIXED_CHUNK_SIZE, data.size() - pos)});
+    }
+    double gb = data.size() / 1e9;
+
+    std::cout << "Hashing " << megabytes << " MB in " << FIXED_CHUNK_SIZE / 1024 << " KB chunks" << std::endl;
+    SHA256Backend original = SHA256::backend();
+    for (SHA256Backend b : {SHA256Backend::PORTABLE, SHA256Backend::SHA_NI, SHA256Backend::AVX2}) {
+        if (!SHA256::setBackend(b)) {
+            std::cout << std::left << std::setw(18) << std::string("sha256 ") + SHA256::backendName(b)
+                      << "not supported" << std::endl;
+            continue;
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (const SHA256Input& chunk : chunks) SHA256::digestMany({chunk});
+        double singleSeconds = secondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        SHA256::digestMany(chunks);
+        double batchSeconds = secondsSince(start);
+
+        std::cout << std::left << std::setw(18) << std::string("sha256 ") + SHA256::backendName(b) << std::right
+                  << std::fixed << std::setprecision(2) << std::setw(8) << gb / singleSeconds << " GB/s single"
+                  << std::setw(8) << gb / batchSeconds << " GB/s batched"
+                  << (b == original ? "  (default)" : "") << std::endl;
+    }
+    SHA256::setBackend(original);
+
+    // A BLAKE3 chunk spreads its own 1 KB pieces over the vector lanes, so
+    // there is nothing to gain from batching messages
+    Blake3Backend originalBlake3 = Blake3::backend();
+    for (Blake3Backend b : {Blake3Backend::PORTABLE, Blake3Backend::SSE41, Blake3Backend::AVX2}) {
+        if (!Blake3::setBackend(b)) {
+            std::cout << std::left << std::setw(18) << std::string("blake3 ") + Blake3::backendName(b)
+                      << "not supported" << std::endl;
+            continue;
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (const SHA256Input& chunk : chunks) Blake3::digest(chunk.data, chunk.size);
+        double singleSeconds = secondsSince(start);
+
+        std::cout << std::left << std::setw(18) << std::string("blake3 ") + Blake3::backendName(b) << std::right
+                  << std::fixed << std::setprecision(2) << std::setw(8) << gb / singleSeconds << " GB/s single"
+                  << (b == originalBlake3 ? "  (default)" : "") << std::endl;
+    }
+    Blake3::setBackend(originalBlake3);
+
+    std::string path = (std::filesystem::temp_directory_path() / "peerwire_bench_hash.bin").string();
+    {
+        std::ofstream out(path, std::ios::binary);
+        out.write(data.data(), (std::streamsize)data.size());
+        if (!out) {
+            std::cerr << "Cannot write " << path << std::endl;
+            return 1;
+        }
+    }
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "Seeding the same data from a file with " << threads << " threads, then verifying its chunks"
+              << " on one" << std::endl;
+    for (HashAlgorithm algorithm : {HashAlgorithm::SHA256, HashAlgorithm::BLAKE3}) {
+        // A first pass warms the page cache, so both read it from memory
+        SeedHashResult result;
+        SeedHasher::hashFile(path, ChunkingParams(), FIXED_CHUNK_SIZE, algorithm, threads, result);
+        auto start = std::chrono::steady_clock::now();
+        bool ok = SeedHasher::hashFile(path, ChunkingParams(), FIXED_CHUNK_SIZE, algorithm, threads, result);
+        double seedSeconds = secondsSince(start);
+
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            ok = ok && Hasher::digest(algorithm, chunks[i].data, chunks[i].size) == result.chunkHashes[i];
+        }
+        double verifySeconds = secondsSince(start);
+
+        std::cout << std::left << std::setw(18) << Hasher::name(algorithm) << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(8) << gb / seedSeconds << " GB/s seed"
+                  << std::setw(8) << gb / verifySeconds << " GB/s verify" << (ok ? "" : "  (MISMATCH)") << std::endl;
+    }
+    std::remove(path.c_str());
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    std::string what = argc > 1 ? argv[1] : "";
+    if (what == "hash") return benchHash(argc > 2 ? (size_t)std::stoul(argv[2]) : 256);
+    if (what != "chunking") {
+        std::cerr << "Usage: bench chunking [MB] [--cdc=MIN,AVG,MAX KB]" << std::endl;
+        std::cerr << "       bench hash [MB]" << std::endl;
+        return 1;
+    }
+    size_t megabytes = 256;
+    ChunkingParams params;
+    params.contentDefined = true;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        unsigned minKb = 0, avgKb = 0, maxKb = 0;
+        if (arg.rfind("--cdc=", 0) == 0 && sscanf(arg.c_str() + 6, "%u,%u,%u", &minKb, &avgKb, &maxKb) == 3) {
+            params.minSize = minKb * 1024;
+            params.avgSize = avgKb * 1024;
+            params.maxSize = maxKb * 1024;
+        } else {
+            megabytes = (size_t)std::stoul(arg);
+        }
+    }
+    if (!params.valid()) {
+        std::cerr << "Invalid chunk sizes" << std::endl;
+        return 1;
+    }
+
+    std::mt19937_64 rng(42);
+    std::vector<uint8_t> v1(megabytes * 1024 * 1024);
+    for (auto& b : v1) b = (uint8_t)rng();
+
+    Chunker chunker(params);
+    Cutter fixed = [](const uint8_t*, size_t size) { return std::min<size_t>(size, FIXED_CHUNK_SIZE); };
+    Cutter cdc = [&](const uint8_t* data, size_t size) { return chunker.cut(data, size); };
+
+    std::cout << "Chunking " << megabytes << " MB of random data; CDC sizes " << params.minSize / 1024 << "/"
+              << params.avgSize / 1024 << "/" << params.maxSize / 1024 << " KB" << std::endl;
+    throughput("fixed", v1, fixed);
+    throughput("cdc", v1, cdc);
+
+    // The next version: a few small inserts and deletes scattered through it
+    std::vector<uint8_t> v2 = v1;
+    for (int e = 0; e < VERSION_EDITS; ++e) {
+        size_t at = (size_t)(rng() % v2.size());
+        if (e % 2 == 0) v2.insert(v2.begin() + at, (size_t)(1 + rng() % 64), (uint8_t)rng());
+        else v2.erase(v2.begin() + at, v2.begin() + std::min(v2.size(), at + 1 + (size_t)(rng() % 64)));
+    }
+    std::cout << "Cross-version reuse after " << VERSION_EDITS << " small inserts and deletes:" << std::endl;
+    reuse("fixed", v1, v2, fixed);
+    reuse("cdc", v1, v2, cdc);
+    return 0;
+}
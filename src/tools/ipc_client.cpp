@@ -3,6 +3,11 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <cstdio>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 
 int main(int argc, char* argv[]) {
     if (argc < 3) {
@@ -32,6 +37,34 @@ int main(int argc, char* argv[]) {
     SocketUtils::sendAll(sock, &len, sizeof(len));
     SocketUtils::sendAll(sock, command.c_str(), len);
 
+    if (std::string(argv[2]) == "stream") {
+        // The file's bytes go to stdout as they arrive, the outcome to stderr
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        std::vector<char> data;
+        uint32_t frameLen = 0;
+        while (SocketUtils::recvAll(sock, &frameLen, sizeof(frameLen)) && frameLen > 0) {
+            data.resize(frameLen);
+            if (!SocketUtils::recvAll(sock, data.data(), frameLen)) break;
+            if (fwrite(data.data(), 1, frameLen, stdout) != frameLen) break; // Reader went away
+        }
+        fflush(stdout);
+        uint8_t ok = 0;
+        uint32_t msgLen = 0;
+        if (frameLen == 0 && SocketUtils::recvAll(sock, &ok, sizeof(ok)) &&
+            SocketUtils::recvAll(sock, &msgLen, sizeof(msgLen))) {
+            std::vector<char> msg(msgLen + 1);
+            if (SocketUtils::recvAll(sock, msg.data(), msgLen)) {
+                msg[msgLen] = '\0';
+                std::cerr << msg.data() << std::endl;
+            }
+        }
+        SocketUtils::closeSocket(sock);
+        SocketUtils::cleanup();
+        return ok ? 0 : 1;
+    }
+
     // Receive response
     uint32_t respLen = 0;
     if (SocketUtils::recvAll(sock, &respLen, sizeof(respLen))) {
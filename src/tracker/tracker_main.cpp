@@ -1,6 +1,7 @@
 #include "socket_utils.h"
 #include "logger.h"
 #include "protocol.h"
+#include "digest.h"
 #include <iostream>
 #include <vector>
 #include <map>
@@ -27,7 +28,7 @@ struct FileRegistryEntry {
 // Global state
 std::mutex stateMutex;
 // FileHash -> Entry
-std::map<std::string, FileRegistryEntry> registry;
+std::map<Digest, FileRegistryEntry> registry;
 
 void cleanupLoop() {
     while (true) {
@@ -85,8 +86,8 @@ void handleClientWithSession(SocketType clientSock, std::string clientIp) {
              }
         }
         else if (header.type == PacketType::ADVERTISE_FILE) {
-            char rawHash[32];
-            if (!SocketUtils::recvAll(clientSock, rawHash, 32)) break;
+            Digest fileHash;
+            if (!SocketUtils::recvAll(clientSock, fileHash.data(), Digest::SIZE)) break;
             
             uint64_t fSize;
             if (!SocketUtils::recvAll(clientSock, &fSize, sizeof(fSize))) break;
@@ -97,13 +98,6 @@ void handleClientWithSession(SocketType clientSock, std::string clientIp) {
             std::vector<char> nBuf(nLen);
              if (!SocketUtils::recvAll(clientSock, nBuf.data(), nLen)) break;
             
-            std::string hashStr;
-            for(int i=0; i<32; i++) {
-                char buf[3];
-                sprintf(buf, "%02x", (unsigned char)rawHash[i]);
-                hashStr += buf;
-            }
-
             if (peerPort == 0) {
                  Logger::error("Peer tried to advertise without REGISTERing port first.");
                  continue; 
@@ -112,7 +106,7 @@ void handleClientWithSession(SocketType clientSock, std::string clientIp) {
             std::lock_guard<std::mutex> lock(stateMutex);
             PeerInfo p{clientIp, peerPort, std::time(nullptr)};
             
-            auto& entry = registry[hashStr];
+            auto& entry = registry[fileHash];
             entry.size = fSize; // Update size (assume consistent)
             
             bool found = false;
@@ -121,25 +115,19 @@ void handleClientWithSession(SocketType clientSock, std::string clientIp) {
             }
             if(!found) entry.peers.push_back(p);
             
-            Logger::log("Registered file " + hashStr + " (" + std::to_string(fSize) + " bytes) for peer " + clientIp);
+            Logger::log("Registered file " + fileHash.hex() + " (" + std::to_string(fSize) + " bytes) for peer " + clientIp);
         }
         else if (header.type == PacketType::REQUEST_PEERS) {
-             char rawHash[32];
-             if (!SocketUtils::recvAll(clientSock, rawHash, 32)) break;
-             
-             std::string hashStr;
-             for(int i=0; i<32; i++) {
-                char buf[3];
-                sprintf(buf, "%02x", (unsigned char)rawHash[i]);
-                hashStr += buf;
-            }
+             Digest fileHash;
+             if (!SocketUtils::recvAll(clientSock, fileHash.data(), Digest::SIZE)) break;
              
              std::lock_guard<std::mutex> lock(stateMutex);
              std::vector<PeerInfo> peers;
              uint64_t fileSize = 0;
-             if (registry.count(hashStr)) {
-                 peers = registry[hashStr].peers;
-                 fileSize = registry[hashStr].size;
+             auto found = registry.find(fileHash);
+             if (found != registry.end()) {
+                 peers = found->second.peers;
+                 fileSize = found->second.size;
              }
              
              // Response: [PacketType RESPONSE_PEERS] [FileSize u64] [Count u32] [IPLen][IP][Port]...
@@ -171,7 +159,7 @@ void handleClientWithSession(SocketType clientSock, std::string clientIp) {
              SocketUtils::sendAll(clientSock, &resp, sizeof(resp));
              SocketUtils::sendAll(clientSock, payload.data(), payload.size());
              
-             Logger::log("Returned " + std::to_string(count) + " peers for " + hashStr);
+             Logger::log("Returned " + std::to_string(count) + " peers for " + fileHash.hex());
         }
     }
     SocketUtils::closeSocket(clientSock);